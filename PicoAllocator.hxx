@@ -0,0 +1,86 @@
+/*
+ * PicoAllocator.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef PICOALLOCATOR_HXX
+#define PICOALLOCATOR_HXX
+
+#include <string>
+#include <memory>
+#include <new>
+#include <pico/platform.h>
+#include <pico-plat.h>
+
+using namespace std;
+
+/*
+ * Standard allocator over arena_alloc(), for pico-plat's own containers,
+ * strings and shared_ptr control blocks: they then stay out of the
+ * malloc heap and its lock. Singletons go in static storage, with only
+ * the control block from here, through the shared_ptr constructor that
+ * takes a deleter and an allocator. Running out of arena is a sizing
+ * error, as running out of heap is with the SDK's pico_malloc, and
+ * panics rather than throwing, which would itself allocate.
+ */
+template <typename T>
+class PicoAllocator {
+
+    static_assert(alignof(T) <= 8, "arena blocks are 8-byte aligned");
+
+public:
+
+    typedef T value_type;
+
+    PicoAllocator() noexcept {
+
+    }
+
+    template <typename U>
+    PicoAllocator(const PicoAllocator<U> &) noexcept {
+
+    }
+
+    T *allocate(size_t n) {
+        void *p = arena_alloc(n * sizeof(T));
+
+        if (p == NULL) {
+            panic("arena: no block for %u bytes",
+                  (unsigned int) (n * sizeof(T)));
+        }
+
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, size_t) noexcept {
+        arena_free(p);
+    }
+
+};
+
+template <typename T, typename U>
+inline bool operator==(const PicoAllocator<T> &, const PicoAllocator<U> &)
+{
+    return true;
+}
+
+template <typename T, typename U>
+inline bool operator!=(const PicoAllocator<T> &, const PicoAllocator<U> &)
+{
+    return false;
+}
+
+typedef basic_string<char, char_traits<char>, PicoAllocator<char>> PicoString;
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
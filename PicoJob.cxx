@@ -0,0 +1,301 @@
+/*
+ * PicoJob.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <PicoJob.hxx>
+#include <PicoAllocator.hxx>
+
+#if ((PICO_JOB_QUEUE_SIZE & (PICO_JOB_QUEUE_SIZE - 1)) != 0)
+#error "PICO_JOB_QUEUE_SIZE must be a power of two"
+#endif
+
+#ifndef PICO_JOB_TASK_STACK
+#define PICO_JOB_TASK_STACK  512
+#endif
+
+#if (configTASK_NOTIFICATION_ARRAY_ENTRIES < PICO_PLAT_NOTIFY_ENTRIES)
+#error "configTASK_NOTIFICATION_ARRAY_ENTRIES is too small for pico-plat"
+#endif
+
+PicoJob::PicoJob(Func func, void *ctx, Done done)
+    : _func(func), _ctx(ctx), _done(done), _result(0), _state(IDLE),
+      _waiter(NULL), _pool(NULL)
+{
+
+}
+
+PicoJob::~PicoJob()
+{
+
+}
+
+bool PicoJob::isDone(void) const
+{
+    return __atomic_load_n(&_state, __ATOMIC_ACQUIRE) == DONE;
+}
+
+/*
+ * Returns 0 once the job is done, -1 on timeout or if it was never
+ * submitted. Only one task may wait on a job at a time. The wait is on
+ * PICO_PLAT_NOTIFY_DONE, cleared on the way in and out, so that neither
+ * a leftover notification nor one of this job's can reach another wait.
+ */
+int PicoJob::wait(unsigned int timeout_ms)
+{
+    int ret = 0;
+    TimeOut_t timeout;
+    TickType_t ticks;
+    uint32_t save;
+
+    if ((_pool == NULL) || (_state == IDLE)) {
+        ret = -1;
+        goto done;
+    }
+
+    ticks = (timeout_ms == SERIAL_WAIT_FOREVER) ?
+        portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+    vTaskSetTimeOutState(&timeout);
+
+    /*
+     * Registered under the pool lock, which the worker also holds while
+     * marking the job done and notifying: either it sees the waiter, or
+     * this sees the job done, and the worker never looks at the job, or
+     * at this task, afterwards.
+     */
+    ulTaskNotifyTakeIndexed(PICO_PLAT_NOTIFY_DONE, pdTRUE, 0);
+    save = spin_lock_blocking(_pool->_lock);
+    _waiter = (_state == DONE) ? NULL : xTaskGetCurrentTaskHandle();
+    spin_unlock(_pool->_lock, save);
+
+    while (!isDone()) {
+        if (xTaskCheckForTimeOut(&timeout, &ticks) != pdFALSE) {
+            ret = -1;
+            break;
+        }
+        ulTaskNotifyTakeIndexed(PICO_PLAT_NOTIFY_DONE, pdTRUE, ticks);
+    }
+
+    save = spin_lock_blocking(_pool->_lock);
+    _waiter = NULL;
+    spin_unlock(_pool->_lock, save);
+    ulTaskNotifyTakeIndexed(PICO_PLAT_NOTIFY_DONE, pdTRUE, 0);
+
+done:
+
+    return ret;
+}
+
+shared_ptr<PicoJobPool> PicoJobPool::pjp = NULL;
+
+shared_ptr<PicoJobPool> PicoJobPool::get(void)
+{
+    alignas(PicoJobPool) static uint8_t storage[sizeof(PicoJobPool)];
+
+    if (PicoJobPool::pjp == NULL) {
+        PicoJobPool::pjp =
+            shared_ptr<PicoJobPool>(new (storage) PicoJobPool(),
+                                    [](PicoJobPool *p) {
+                                        p->~PicoJobPool();
+                                    }, PicoAllocator<PicoJobPool>());
+    }
+
+    return PicoJobPool::pjp;
+}
+
+PicoJobPool::PicoJobPool()
+    : _head(0), _tail(0), _nworkers(0)
+{
+    _lock = spin_lock_instance(spin_lock_claim_unused(true));
+    _sem = xSemaphoreCreateCounting(PICO_JOB_QUEUE_SIZE, 0);
+    for (unsigned int i = 0; i < PICO_JOB_WORKERS_MAX; i++) {
+        _workers[i] = NULL;
+    }
+}
+
+PicoJobPool::~PicoJobPool()
+{
+    stop();
+    vSemaphoreDelete(_sem);
+}
+
+/*
+ * Start 'workers' tasks, pinned to 'core' unless it is negative. Jobs
+ * already queued are picked up right away.
+ */
+int PicoJobPool::start(unsigned int workers, int core, unsigned int priority)
+{
+    int ret = 0;
+    BaseType_t rc;
+
+    if ((_nworkers > 0) || (workers == 0) ||
+        (workers > PICO_JOB_WORKERS_MAX) || (_sem == NULL)) {
+        ret = -1;
+        goto done;
+    }
+
+    for (_nworkers = 0; _nworkers < workers; _nworkers++) {
+#if (configNUMBER_OF_CORES > 1) && (configUSE_CORE_AFFINITY == 1)
+        if (core >= 0) {
+            rc = xTaskCreateAffinitySet(PicoJobPool::worker, "job",
+                                        PICO_JOB_TASK_STACK, this, priority,
+                                        1 << core, &_workers[_nworkers]);
+        } else
+#endif
+        {
+            (void) core;
+            rc = xTaskCreate(PicoJobPool::worker, "job",
+                             PICO_JOB_TASK_STACK, this, priority,
+                             &_workers[_nworkers]);
+        }
+
+        if (rc != pdPASS) {
+            _workers[_nworkers] = NULL;
+            stop();
+            ret = -1;
+            goto done;
+        }
+    }
+
+done:
+
+    return ret;
+}
+
+/*
+ * Delete the workers. A job that is running is cut short and never
+ * completes; stop only once the pool has gone quiet.
+ */
+void PicoJobPool::stop(void)
+{
+    for (unsigned int i = 0; i < PICO_JOB_WORKERS_MAX; i++) {
+        if (_workers[i] != NULL) {
+            vTaskDelete(_workers[i]);
+            _workers[i] = NULL;
+        }
+    }
+
+    _nworkers = 0;
+}
+
+int PicoJobPool::submit(PicoJob *job)
+{
+    int ret = 0;
+    uint32_t save;
+    BaseType_t woken = pdFALSE;
+
+    if ((job == NULL) || (job->_func == NULL)) {
+        ret = -1;
+        goto done;
+    }
+
+    /* Under the lock, so that two submits of one job cannot both queue it */
+    save = spin_lock_blocking(_lock);
+    if ((job->_state == PicoJob::QUEUED) ||
+        (job->_state == PicoJob::RUNNING) ||
+        ((_head - _tail) >= PICO_JOB_QUEUE_SIZE)) {
+        ret = -1;
+    } else {
+        job->_state = PicoJob::QUEUED;
+        job->_pool = this;
+        _queue[_head & (PICO_JOB_QUEUE_SIZE - 1)] = job;
+        _head++;
+    }
+    spin_unlock(_lock, save);
+
+    if (ret != 0) {
+        goto done;
+    }
+
+    if (portCHECK_IF_IN_ISR()) {
+        xSemaphoreGiveFromISR(_sem, &woken);
+        portYIELD_FROM_ISR(woken);
+    } else {
+        xSemaphoreGive(_sem);
+    }
+
+done:
+
+    return ret;
+}
+
+int PicoJobPool::submit(PicoJob *job, PicoJob::Func func, void *ctx,
+                        PicoJob::Done done)
+{
+    if (job == NULL) {
+        return -1;
+    }
+
+    job->set(func, ctx, done);
+
+    return submit(job);
+}
+
+PicoJob *PicoJobPool::take(void)
+{
+    PicoJob *job = NULL;
+    uint32_t save;
+
+    save = spin_lock_blocking(_lock);
+    if (_head != _tail) {
+        job = _queue[_tail & (PICO_JOB_QUEUE_SIZE - 1)];
+        _tail++;
+    }
+    spin_unlock(_lock, save);
+
+    return job;
+}
+
+/*
+ * Once a job is marked done its owner may reuse or free it, so what the
+ * completion needs is copied out first; the 'done' callback runs after,
+ * which lets it resubmit the job. The waiter is notified with the pool
+ * lock still held: wait() takes it to deregister before returning, so a
+ * waiter that timed out, or its task since deleted, is never notified.
+ */
+void PicoJobPool::worker(void *arg)
+{
+    PicoJobPool *pool = (PicoJobPool *) arg;
+    PicoJob *job;
+    PicoJob::Done done;
+    void *ctx;
+    int result;
+    uint32_t save;
+
+    for (;;) {
+        xSemaphoreTake(pool->_sem, portMAX_DELAY);
+
+        job = pool->take();
+        if (job == NULL) {
+            continue;
+        }
+
+        job->_state = PicoJob::RUNNING;
+        result = job->_func(job->_ctx);
+        done = job->_done;
+        ctx = job->_ctx;
+        job->_result = result;
+
+        save = spin_lock_blocking(pool->_lock);
+        __atomic_store_n(&job->_state, PicoJob::DONE, __ATOMIC_RELEASE);
+        if (job->_waiter != NULL) {
+            xTaskNotifyGiveIndexed(job->_waiter, PICO_PLAT_NOTIFY_DONE);
+        }
+        spin_unlock(pool->_lock, save);
+
+        if (done) {
+            done(ctx, result);
+        }
+    }
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,136 @@
+/*
+ * PicoJob.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef PICOJOB_HXX
+#define PICOJOB_HXX
+
+#include <memory>
+#include <hardware/sync.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <semphr.h>
+#include <pico-plat.h>
+
+using namespace std;
+
+#ifndef PICO_JOB_QUEUE_SIZE
+#define PICO_JOB_QUEUE_SIZE   16    // power of two
+#endif
+
+#ifndef PICO_JOB_WORKERS_MAX
+#define PICO_JOB_WORKERS_MAX  4
+#endif
+
+/*
+ * A unit of work for PicoJobPool, owned by the submitter, which must keep
+ * it alive until it is done, even after a wait() timed out. It doubles as
+ * the future: poll isDone() or block in wait(), then read result(); or
+ * have the optional 'done' callback run in the worker once it is done.
+ * A job may be submitted again once it is done, also from its callback.
+ */
+class PicoJob {
+
+public:
+
+    typedef int (*Func)(void *ctx);
+    typedef void (*Done)(void *ctx, int result);
+
+    PicoJob(Func func = NULL, void *ctx = NULL, Done done = NULL);
+    ~PicoJob();
+
+    inline void set(Func func, void *ctx, Done done = NULL) {
+        _func = func;
+        _ctx = ctx;
+        _done = done;
+    }
+
+    bool isDone(void) const;
+    int wait(unsigned int timeout_ms = SERIAL_WAIT_FOREVER);
+    inline int result(void) const {
+        return _result;
+    }
+
+protected:
+
+    friend class PicoJobPool;
+
+    enum State {
+        IDLE = 0,
+        QUEUED,
+        RUNNING,
+        DONE,
+    };
+
+    Func _func;
+    void *_ctx;
+    Done _done;
+    int _result;
+    volatile int _state;
+    TaskHandle_t volatile _waiter;
+    class PicoJobPool *_pool;
+
+};
+
+/*
+ * Worker tasks, optionally pinned to one core, fed from a bounded queue
+ * of job pointers. The Cortex-M0+ has no atomic read-modify-write, so
+ * the queue indices are updated under an RP2040 hardware spinlock for
+ * a few instructions instead of a mutex: submit() never sleeps and
+ * works from interrupt handlers and either core.
+ */
+class PicoJobPool {
+
+public:
+
+    static shared_ptr<PicoJobPool> get(void);
+
+    int start(unsigned int workers = 1, int core = 1,
+              unsigned int priority = tskIDLE_PRIORITY + 1);
+    void stop(void);
+
+    int submit(PicoJob *job);
+    int submit(PicoJob *job, PicoJob::Func func, void *ctx,
+               PicoJob::Done done = NULL);
+
+    inline unsigned int workers(void) const {
+        return _nworkers;
+    }
+    inline unsigned int pending(void) const {
+        return _head - _tail;
+    }
+
+protected:
+
+    friend class PicoJob;
+    static shared_ptr<PicoJobPool> pjp;
+
+    PicoJobPool();
+    ~PicoJobPool();
+
+    static void worker(void *arg);
+    PicoJob *take(void);
+
+    spin_lock_t *_lock;
+    SemaphoreHandle_t _sem;
+    PicoJob *_queue[PICO_JOB_QUEUE_SIZE];
+    uint32_t _head;
+    uint32_t _tail;
+    TaskHandle_t _workers[PICO_JOB_WORKERS_MAX];
+    unsigned int _nworkers;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
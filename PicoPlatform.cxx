@@ -4,6 +4,7 @@
  * Copyright (C) 2025, Charles Chiou
  */
 
+#include <cmath>
 #include <pico/bootrom.h>
 #include <hardware/watchdog.h>
 #include <hardware/gpio.h>
@@ -12,16 +13,21 @@
 #include <pico/cyw43_arch.h>
 #include <pico-plat.h>
 #include <PicoPlatform.hxx>
+#include <PicoJob.hxx>
+#include <PicoAllocator.hxx>
 
 shared_ptr<PicoPlatform> PicoPlatform::pp = NULL;
 
 shared_ptr<PicoPlatform> PicoPlatform::get(void)
 {
+    alignas(PicoPlatform) static uint8_t storage[sizeof(PicoPlatform)];
+
     if (PicoPlatform::pp == NULL) {
         PicoPlatform::pp =
-            shared_ptr<PicoPlatform>(new PicoPlatform(), [](PicoPlatform *p) {
-                delete p;
-            });
+            shared_ptr<PicoPlatform>(new (storage) PicoPlatform(),
+                                     [](PicoPlatform *p) {
+                                         p->~PicoPlatform();
+                                     }, PicoAllocator<PicoPlatform>());
     }
 
     return PicoPlatform::pp;
@@ -49,6 +55,9 @@ PicoPlatform::PicoPlatform()
         gpio_set_dir(25, GPIO_OUT);
         gpio_put(25, false);
     }
+
+    /* The one-off reads above are the last; the sampler owns the ADC now */
+    setAdcSampling(0);
 }
 
 PicoPlatform::~PicoPlatform()
@@ -82,17 +91,104 @@ void PicoPlatform::flipOnboardLed(void)
 
 float PicoPlatform::getOnboardTempC(void) const
 {
-    static const float conversionFactor = 3.3f / (1 << 12);
     float adc;
     float temperature_c = 0.0;
 
-    adc_select_input(4);
-    adc = (float) adc_read() * conversionFactor;
-    temperature_c = 27.0f - (adc - 0.706f) / 0.001721f;
+    adc = getAdcVolts(ADCSAMPLER_TEMP_SENSOR);
+    if (!isnan(adc)) {
+        temperature_c = 27.0f - (adc - 0.706f) / 0.001721f;
+    }
 
     return temperature_c;
 }
 
+/*
+ * On the Pico W, ADC3's pin is shared with the wireless chip's SPI, so
+ * VSYS is not sampled there and this returns NAN.
+ */
+float PicoPlatform::getVsysVolts(void) const
+{
+    return getAdcVolts(3) * 3.0f;
+}
+
+/*
+ * Latest filtered reading of an ADC input (0..3, or 4 for the sensor),
+ * or NAN if it is not being sampled. Does not touch the ADC.
+ */
+float PicoPlatform::getAdcVolts(unsigned int channel) const
+{
+    static const float conversionFactor = 3.3f / (1 << 16);
+    int value;
+
+    value = adcsampler_get(channel);
+    if (value < 0) {
+        return NAN;
+    }
+
+    return (float) value * conversionFactor;
+}
+
+/*
+ * (Re)start background sampling of the temperature sensor, VSYS (not on
+ * the Pico W) and the ADC0..2 inputs set in 'userChannels'.
+ */
+int PicoPlatform::setAdcSampling(uint32_t userChannels, unsigned int rateHz,
+                                 unsigned int oversample,
+                                 unsigned int avgShift)
+{
+    uint32_t mask;
+
+    mask = (userChannels & 0x7) | (1 << ADCSAMPLER_TEMP_SENSOR);
+    if (!hasWireless()) {
+        mask |= (1 << 3);
+    }
+
+    adcsampler_stop();
+
+    return adcsampler_start(mask, rateHz, oversample, avgShift);
+}
+
+/*
+ * Trade power for throughput: switch clk_sys to the frequency configured
+ * for 'mode', along with the core voltage it needs.
+ */
+int PicoPlatform::setPerformanceMode(enum PerformanceMode mode)
+{
+    int ret = 0;
+
+    switch (mode) {
+    case PERFORMANCE_LOW:
+        ret = setSysClockHz(PICO_PLATFORM_CLK_LOW_HZ);
+        break;
+    case PERFORMANCE_NORMAL:
+        ret = setSysClockHz(PICO_PLATFORM_CLK_NORMAL_HZ);
+        break;
+    case PERFORMANCE_HIGH:
+        ret = setSysClockHz(PICO_PLATFORM_CLK_HIGH_HZ);
+        break;
+    default:
+        ret = -1;
+        break;
+    }
+
+    return ret;
+}
+
+/*
+ * Change clk_sys at run time; see sysclock_set_hz(). pico-plat re-times
+ * the UARTs and the FreeRTOS tick itself; anything else clocked from
+ * clk_sys or clk_peri should do so from a sysclock_add_listener().
+ */
+int PicoPlatform::setSysClockHz(uint32_t hz)
+{
+    return sysclock_set_hz(hz);
+}
+
+uint32_t PicoPlatform::getSysClockHz(void) const
+{
+    return sysclock_get_hz();
+}
+
 void PicoPlatform::reboot(void)
 {
     watchdog_enable(1, 0);
@@ -104,6 +200,15 @@ void PicoPlatform::bootsel(void)
     reset_usb_boot(0, 0);
 }
 
+/*
+ * Worker pool for moving CPU-heavy work off the calling core; call
+ * start() on it once, e.g. getJobPool()->start(2, 1).
+ */
+shared_ptr<PicoJobPool> PicoPlatform::getJobPool(void)
+{
+    return PicoJobPool::get();
+}
+
 /*
  * Local variables:
  * mode: C++
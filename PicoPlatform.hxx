@@ -12,10 +12,40 @@
 
 using namespace std;
 
+/* Background ADC sampling set up by the constructor */
+#ifndef PICO_PLATFORM_ADC_RATE_HZ
+#define PICO_PLATFORM_ADC_RATE_HZ     10000   // conversions/s, all channels
+#endif
+#ifndef PICO_PLATFORM_ADC_OVERSAMPLE
+#define PICO_PLATFORM_ADC_OVERSAMPLE  16
+#endif
+#ifndef PICO_PLATFORM_ADC_AVG_SHIFT
+#define PICO_PLATFORM_ADC_AVG_SHIFT   3
+#endif
+
+/* clk_sys of each setPerformanceMode() mode */
+#ifndef PICO_PLATFORM_CLK_LOW_HZ
+#define PICO_PLATFORM_CLK_LOW_HZ      48000000
+#endif
+#ifndef PICO_PLATFORM_CLK_NORMAL_HZ
+#define PICO_PLATFORM_CLK_NORMAL_HZ   125000000
+#endif
+#ifndef PICO_PLATFORM_CLK_HIGH_HZ
+#define PICO_PLATFORM_CLK_HIGH_HZ     200000000
+#endif
+
+class PicoJobPool;
+
 class PicoPlatform : public enable_shared_from_this<PicoPlatform> {
 
 public:
 
+    enum PerformanceMode {
+        PERFORMANCE_LOW = 0,
+        PERFORMANCE_NORMAL,
+        PERFORMANCE_HIGH,
+    };
+
     static shared_ptr<PicoPlatform> get(void);
 
     string getName(void) const;
@@ -23,9 +53,20 @@ public:
     bool hasWireless(void) const;
     void flipOnboardLed(void);
     float getOnboardTempC(void) const;
+    float getVsysVolts(void) const;
+    float getAdcVolts(unsigned int channel) const;
+    int setAdcSampling(uint32_t userChannels,
+                       unsigned int rateHz = PICO_PLATFORM_ADC_RATE_HZ,
+                       unsigned int oversample = PICO_PLATFORM_ADC_OVERSAMPLE,
+                       unsigned int avgShift = PICO_PLATFORM_ADC_AVG_SHIFT);
+    int setPerformanceMode(enum PerformanceMode mode);
+    int setSysClockHz(uint32_t hz);
+    uint32_t getSysClockHz(void) const;
     void reboot(void);
     void bootsel(void);
 
+    shared_ptr<PicoJobPool> getJobPool(void);
+
 protected:
 
     friend shared_ptr<PicoPlatform> make_shared<PicoPlatform>();
@@ -6,40 +6,93 @@
 
 #include <ctime>
 #include <cstring>
+#include <cstdlib>
 #include <malloc.h>
 #include <hardware/clocks.h>
+#include <hardware/timer.h>
 #include <FreeRTOS.h>
 #include <task.h>
 #include <pico-plat.h>
 #include <PicoPlatform.hxx>
 #include <PicoShell.hxx>
 
+#if (configTASK_NOTIFICATION_ARRAY_ENTRIES < PICO_PLAT_NOTIFY_ENTRIES)
+#error "configTASK_NOTIFICATION_ARRAY_ENTRIES is too small for pico-plat"
+#endif
+
+/* Replies to IAC IP, so that telnet discards what it still has queued */
+static const uint8_t iac_do_tm[3] = { 0xff, 0xfd, 0x06, };
+static const uint8_t iac_will_tm[3] = { 0xff, 0xfb, 0x06, };
+
+constexpr PicoShellCmd PicoShell::commands[] = {
+    { "bootsel", &PicoShell::bootsel, "",
+      "reboot into the USB boot loader", 0, 0, },
+    { "clock", &PicoShell::clock, "[low|normal|high|<MHz>]",
+      "show or change clk_sys", 0, 1, },
+    { "heap", &PicoShell::heap, "[tasks|recent|reset]",
+      "show heap use, peak and fragmentation", 0, 1, },
+    { "help", &PicoShell::help, "[command]",
+      "list commands, or show how to use one", 0, 1, },
+    { "irqlat", &PicoShell::irqlat, "[core] [samples] [cold] [load]",
+      "measure interrupt latency", 0, 4, },
+    { "jitter", &PicoShell::jitter, "[core] [ticks]",
+      "measure tick wakeup jitter", 0, 2, },
+    { "reboot", &PicoShell::reboot, "",
+      "reboot", 0, 0, },
+    { "stacks", &PicoShell::stacks, "[start [period_ms] [margin]|stop]",
+      "show each stack's least free space, or run the monitor", 0, 3, },
+    { "system", &PicoShell::system, "[-v]",
+      "show platform, heap and task status", 0, 1, },
+    { "top", &PicoShell::top, "[interval] [count]",
+      "show CPU use per task and per core", 0, 2, },
+    { "version", &PicoShell::version, "",
+      "show the firmware version", 0, 0, },
+};
+
 PicoShell::PicoShell(enum PicoShellDevice device)
     : _device(device)
 {
     _noEcho = false;
     _inproc.i = 0;
+    _inproc.iac = false;
+    _txLen = 0;
+    _txLine = false;
     _since = time(NULL);
-    _help_list.push_back("help");
-    _help_list.push_back("version");
-    _help_list.push_back("system");
-    _help_list.push_back("reboot");
-    _help_list.push_back("bootsel");
+    _nCmdTables = 0;
+    _worker = NULL;
+    _cmdSem = NULL;
+    _busy = false;
+    _cancel = false;
+    _iacReply = false;
+
+    static_assert(PicoShellCmd::sorted(commands),
+                  "PicoShell::commands[] must be sorted by name");
+    addCommands(commands);
 }
 
 PicoShell::~PicoShell()
 {
-
+    if (_worker != NULL) {
+        vTaskDelete(_worker);
+    }
+    if (_cmdSem != NULL) {
+        vSemaphoreDelete(_cmdSem);
+    }
 }
 
+/*
+ * Take whatever has arrived in chunks of PICO_SHELL_RX_CHUNK, and echo
+ * each chunk with a single write rather than one per keystroke, so that
+ * a script pasted into the terminal is consumed at line rate.
+ */
 int PicoShell::process(void)
 {
     int ret = 0;
     int rx;
-    char c;
+    uint8_t buf[PICO_SHELL_RX_CHUNK];
 
     while (this->rx_ready() > 0) {
-        rx = this->rx_read((uint8_t *) &c, 1);
+        rx = this->rx_read(buf, sizeof(buf));
         if (rx < 0) {
             ret = rx;
             break;
@@ -49,57 +102,255 @@ int PicoShell::process(void)
 
         ret += rx;
 
-        if (c == 0xff) {  // IAC received
-            static const uint8_t iac_do_tm[3] = { 0xff, 0xfd, 0x06};
-            static const uint8_t iac_will_tm[3] = { 0xff, 0xfb, 0x06};
-            char iac2;
-
-            ret = this->rx_read((uint8_t *) &iac2, 1);
-            if (ret == 1) {
-                switch (iac2) {
-                case 0xf4:  // IAC IP (interrupt process)
-                    ret = this->tx_write(iac_do_tm, sizeof(iac_do_tm));
-                    ret = this->tx_write(iac_will_tm, sizeof(iac_will_tm));
-                    this->printf("\n> ");
-                    _inproc.i = 0;
-                    break;
-                default:
-                    break;
-                }
-            }
+        for (int i = 0; i < rx; i++) {
+            this->rx_char(buf[i]);
+        }
 
-            continue;
+        if (!this->isBusy()) {
+            this->tx_flush();
         }
+    }
 
-        if (c == '\r') {
-            _inproc.cmdline[_inproc.i] = '\0';
-            if (!_noEcho) {
-                this->printf("\n");
+    /* While a command runs in the worker, the output is its own */
+    if (!this->isBusy()) {
+        this->tx_flush();
+    }
+
+    return ret;
+}
+
+/*
+ * Block for up to 'timeout_ms' (SERIAL_WAIT_FOREVER for no limit) on the
+ * device's receive semaphore until there is input, then process it.
+ * Returns the number of bytes processed, 0 on timeout.
+ */
+int PicoShell::process(unsigned int timeout_ms)
+{
+    int ret = 0;
+
+    ret = this->rx_wait(timeout_ms);
+    if (ret <= 0) {
+        goto done;
+    }
+
+    ret = this->process();
+
+done:
+
+    return ret;
+}
+
+/*
+ * Serve the shell from the calling task, for good. In between input the
+ * task is blocked without a timeout, so it costs no CPU and leaves the
+ * idle task (and a tickless idle) free to sleep the core, and it is
+ * woken straight from the receive interrupt.
+ */
+void PicoShell::run(void)
+{
+    for (;;) {
+        if (this->process(SERIAL_WAIT_FOREVER) < 0) {
+            vTaskDelay(pdMS_TO_TICKS(PICO_SHELL_RETRY_MS));
+        }
+    }
+}
+
+/*
+ * Run commands in a task of their own, at 'priority', rather than in the
+ * one calling process(), which then keeps reading the input while a
+ * command runs: ^C or IAC IP cancels it, through cancel(), and anything
+ * else is dropped until the command is done. Fails while one is running.
+ */
+int PicoShell::setAsync(bool async, unsigned int priority)
+{
+    int ret = 0;
+
+    if (this->isBusy()) {
+        ret = -1;
+        goto done;
+    }
+
+    if (async && (_worker == NULL)) {
+        if (_cmdSem == NULL) {
+            _cmdSem = xSemaphoreCreateBinary();
+            if (_cmdSem == NULL) {
+                ret = -1;
+                goto done;
             }
-            this->exec(_inproc.cmdline);
-            this->printf("> ");
-            _inproc.i = 0;
-            _inproc.cmdline[0] = '\0';
-        } else if ((c == '\x7f') || (c == '\x08')) {
-            if (_inproc.i > 0) {
-                this->printf("\b \b");
-                _inproc.i--;
+        }
+
+        if (xTaskCreate(PicoShell::worker, "shellcmd", PICO_SHELL_TASK_STACK,
+                        this, priority, &_worker) != pdPASS) {
+            _worker = NULL;
+            ret = -1;
+            goto done;
+        }
+    } else if (!async && (_worker != NULL)) {
+        vTaskDelete(_worker);
+        _worker = NULL;
+    }
+
+done:
+
+    return ret;
+}
+
+void PicoShell::worker(void *arg)
+{
+    PicoShell *shell = (PicoShell *) arg;
+
+    for (;;) {
+        xSemaphoreTake(shell->_cmdSem, portMAX_DELAY);
+
+        /* Whatever cancel() may have left from the previous command */
+        ulTaskNotifyTakeIndexed(PICO_PLAT_NOTIFY_CANCEL, pdTRUE, 0);
+
+        shell->exec(shell->_asyncCmd);
+        if (shell->_iacReply) {
+            shell->_iacReply = false;
+            shell->tx_put(iac_do_tm, sizeof(iac_do_tm));
+            shell->tx_put(iac_will_tm, sizeof(iac_will_tm));
+        }
+        if (shell->_cancel) {
+            shell->printf("^C\n");
+        }
+        shell->printf("> ");
+        shell->tx_flush();
+
+        __atomic_store_n(&shell->_busy, false, __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * Ask the running command to stop. This only sets the token that
+ * cancelled() returns and wakes a cancelWait(); the command decides where
+ * it is safe to bail out. The wakeup goes on an index of its own, so
+ * that it cannot end a wait inside whatever the command calls.
+ */
+void PicoShell::cancel(void)
+{
+    _cancel = true;
+    if (_worker != NULL) {
+        xTaskNotifyGiveIndexed(_worker, PICO_PLAT_NOTIFY_CANCEL);
+    }
+}
+
+/*
+ * For long-running commands to check between steps. In async mode this
+ * is a load of the token; otherwise the pending input is looked at
+ * without blocking.
+ */
+bool PicoShell::cancelled(void)
+{
+    if ((_worker == NULL) && !_cancel && this->catch_ctr_c(false)) {
+        _cancel = true;
+    }
+
+    return _cancel;
+}
+
+/*
+ * Sleep for up to 'timeout_ms' (SERIAL_WAIT_FOREVER for no limit), in
+ * place of vTaskDelay() in a command, returning early with true if the
+ * command is cancelled meanwhile.
+ */
+bool PicoShell::cancelWait(unsigned int timeout_ms)
+{
+    TimeOut_t timeout;
+    TickType_t ticks;
+
+    this->tx_flush();
+
+    ticks = (timeout_ms == SERIAL_WAIT_FOREVER) ?
+        portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+    vTaskSetTimeOutState(&timeout);
+
+    while (!this->cancelled()) {
+        if (xTaskCheckForTimeOut(&timeout, &ticks) != pdFALSE) {
+            break;
+        }
+
+        if (_worker != NULL) {
+            ulTaskNotifyTakeIndexed(PICO_PLAT_NOTIFY_CANCEL, pdTRUE, ticks);
+        } else {
+            this->rx_wait((ticks == portMAX_DELAY) ?
+                          SERIAL_WAIT_FOREVER : ticks * portTICK_PERIOD_MS);
+        }
+    }
+
+    return _cancel;
+}
+
+void PicoShell::rx_char(uint8_t c)
+{
+    /* Nothing reaches the line editor while the worker runs a command */
+    if (this->isBusy()) {
+        if (_inproc.iac) {
+            _inproc.iac = false;
+            if (c == 0xf4) {  // IAC IP (interrupt process)
+                _iacReply = true;
+                this->cancel();
             }
+        } else if (c == 0xff) {
+            _inproc.iac = true;
         } else if (c == '\x03') {
-            this->printf("^C\n> ");
+            this->cancel();
+        }
+        return;
+    }
+
+    /* An IAC sequence may be split across reads */
+    if (_inproc.iac) {
+        _inproc.iac = false;
+        if (c == 0xf4) {  // IAC IP (interrupt process)
+            this->tx_put(iac_do_tm, sizeof(iac_do_tm));
+            this->tx_put(iac_will_tm, sizeof(iac_will_tm));
+            this->printf("\n> ");
             _inproc.i = 0;
-        } else if ((c != '\n') && isprint(c)) {
-            if (_inproc.i < (CMDLINE_SIZE - 1)) {
-                if (!_noEcho) {
-                    this->printf("%c", c);
-                }
-                _inproc.cmdline[_inproc.i] = c;
-                _inproc.i++;
-            }
         }
+        return;
     }
 
-    return ret;
+    if (c == 0xff) {  // IAC received
+        _inproc.iac = true;
+    } else if (c == '\r') {
+        _inproc.cmdline[_inproc.i] = '\0';
+        if (!_noEcho) {
+            this->tx_put("\r\n", 2);
+        }
+        /* Show the command line before what may be a slow command */
+        this->tx_flush();
+        _cancel = false;
+        if (_worker != NULL) {
+            memcpy(_asyncCmd, _inproc.cmdline, _inproc.i + 1);
+            __atomic_store_n(&_busy, true, __ATOMIC_RELEASE);
+            xSemaphoreGive(_cmdSem);
+        } else {
+            this->exec(_inproc.cmdline);
+            if (_cancel) {
+                this->printf("^C\n");
+            }
+            this->printf("> ");
+        }
+        _inproc.i = 0;
+        _inproc.cmdline[0] = '\0';
+    } else if ((c == '\x7f') || (c == '\x08')) {
+        if (_inproc.i > 0) {
+            this->tx_put("\b \b", 3);
+            _inproc.i--;
+        }
+    } else if (c == '\x03') {
+        this->printf("^C\n> ");
+        _inproc.i = 0;
+    } else if ((c != '\n') && isprint(c)) {
+        if (_inproc.i < (CMDLINE_SIZE - 1)) {
+            if (!_noEcho) {
+                this->tx_put(&c, 1);
+            }
+            _inproc.cmdline[_inproc.i] = c;
+            _inproc.i++;
+        }
+    }
 }
 
 int PicoShell::exec(char *cmdline)
@@ -107,6 +358,7 @@ int PicoShell::exec(char *cmdline)
     int ret = 0;
     int argc = 0;
     char *argv[32];
+    const PicoShellCmd *cmd;
 
     if (cmdline == NULL) {
         ret = -1;
@@ -145,52 +397,141 @@ int PicoShell::exec(char *cmdline)
         goto done;
     }
 
-    if (strcmp(argv[0], "help") == 0) {
-        ret = this->help(argc, argv);
-    } else if (strcmp(argv[0], "version") == 0) {
-        ret = this->version(argc, argv);
-    } else if (strcmp(argv[0], "system") == 0) {
-        ret = this->system(argc, argv);
-    } else if (strcmp(argv[0], "reboot") == 0) {
-        ret = this->reboot(argc, argv);
-    } else if (strcmp(argv[0], "bootsel") == 0) {
-        ret = this->bootsel(argc, argv);
-    } else {
+    cmd = findCommand(argv[0]);
+    if (cmd == NULL) {
         ret = this->unknown_command(argc, argv);
+    } else if ((argc - 1 < cmd->minArgs) ||
+               ((cmd->maxArgs != PICO_SHELL_ARGC_ANY) &&
+                (argc - 1 > cmd->maxArgs))) {
+        this->usage(cmd);
+        ret = -1;
+    } else {
+        ret = (this->*cmd->fn)(argc, argv);
+    }
+
+done:
+
+    return ret;
+}
+
+/*
+ * Register a table of commands, which must stay valid for the life of the
+ * shell and be sorted by name. Later tables take precedence, so that a
+ * subclass can replace a command of the base class by registering one of
+ * the same name.
+ */
+int PicoShell::addCommands(const PicoShellCmd *table, size_t count)
+{
+    int ret = 0;
+
+    if ((table == NULL) || (_nCmdTables >= PICO_SHELL_CMD_TABLES_MAX)) {
+        ret = -1;
+        goto done;
+    }
+
+    for (size_t i = 1; i < count; i++) {
+        if (strcmp(table[i - 1].name, table[i].name) >= 0) {
+            ret = -1;
+            goto done;
+        }
     }
 
+    _cmdTables[_nCmdTables] = table;
+    _cmdCounts[_nCmdTables] = count;
+    _nCmdTables++;
+
 done:
 
     return ret;
 }
 
+const PicoShellCmd *PicoShell::findCommand(const char *name) const
+{
+    const PicoShellCmd *table;
+    size_t lo, hi, mid;
+    int cmp;
+
+    for (unsigned int t = _nCmdTables; t-- > 0; ) {
+        table = _cmdTables[t];
+        lo = 0;
+        hi = _cmdCounts[t];
+        while (lo < hi) {
+            mid = (lo + hi) / 2;
+            cmp = strcmp(name, table[mid].name);
+            if (cmp == 0) {
+                return &table[mid];
+            } else if (cmp < 0) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+void PicoShell::usage(const PicoShellCmd *cmd)
+{
+    if (cmd->args[0] != '\0') {
+        this->printf("Usage: %s %s\n", cmd->name, cmd->args);
+    } else {
+        this->printf("Usage: %s\n", cmd->name);
+    }
+}
+
+/*
+ * Lists the commands of all tables merged in name order, each under the
+ * table that takes precedence for it.
+ */
 int PicoShell::help(int argc, char **argv)
 {
     int ret = 0;
-    unsigned int i;
+    size_t pos[PICO_SHELL_CMD_TABLES_MAX] = { 0, };
+    const PicoShellCmd *cmd, *next;
+    unsigned int t;
+
+    if (argc == 2) {
+        cmd = findCommand(argv[1]);
+        if (cmd == NULL) {
+            ret = this->unknown_command(argc - 1, argv + 1);
+            goto done;
+        }
 
-    (void)(argc);
-    (void)(argv);
+        this->usage(cmd);
+        this->printf("  %s\n", cmd->help);
+        goto done;
+    }
 
     this->printf("Available commands:\n");
 
-    i = 0;
-    for (vector<string>::const_iterator it = _help_list.begin();
-         it != _help_list.end(); it++, i++) {
-        if ((i % 4) == 0) {
-            this->printf("\t");
+    for (;;) {
+        next = NULL;
+        for (t = 0; t < _nCmdTables; t++) {
+            if (pos[t] >= _cmdCounts[t]) {
+                continue;
+            }
+            cmd = &_cmdTables[t][pos[t]];
+            if ((next == NULL) || (strcmp(cmd->name, next->name) <= 0)) {
+                next = cmd;
+            }
         }
 
-        this->printf("%s\t", it->c_str());
+        if (next == NULL) {
+            break;
+        }
 
-        if ((i % 4) == 3) {
-            this->printf("\n");
+        this->printf("  %-10s %s\n", next->name, next->help);
+
+        for (t = 0; t < _nCmdTables; t++) {
+            if ((pos[t] < _cmdCounts[t]) &&
+                (strcmp(_cmdTables[t][pos[t]].name, next->name) == 0)) {
+                pos[t]++;
+            }
         }
     }
 
-    if ((i % 4) != 0) {
-        this->printf("\n");
-    }
+done:
 
     return ret;
 }
@@ -211,6 +552,61 @@ int PicoShell::version(int argc, char **argv)
     return ret;
 }
 
+/* Single-letter task states, as vTaskListTasks() shows them */
+static char task_state(eTaskState state)
+{
+    switch (state) {
+    case eRunning: return 'X';
+    case eReady: return 'R';
+    case eBlocked: return 'B';
+    case eSuspended: return 'S';
+    case eDeleted: return 'D';
+    default: break;
+    }
+
+    return '?';
+}
+
+static const char *task_affinity(const TaskStatus_t *task)
+{
+#if (configNUMBER_OF_CORES > 1) && (configUSE_CORE_AFFINITY == 1)
+    switch (task->uxCoreAffinityMask & ((1 << configNUMBER_OF_CORES) - 1)) {
+    case 0x1: return "core0";
+    case 0x2: return "core1";
+    default: break;
+    }
+#else
+    (void) task;
+#endif
+
+    return "any";
+}
+
+/*
+ * uxTaskGetSystemState() into an arena block, sized for the tasks there
+ * are now and a few more, and sized again if more got created in
+ * between. Returns NULL, with '*count' 0, when no block is big enough;
+ * the caller arena_free()s it once it has streamed it out.
+ */
+static TaskStatus_t *task_snapshot(UBaseType_t *count)
+{
+    TaskStatus_t *tasks = NULL;
+    UBaseType_t size;
+
+    *count = 0;
+    do {
+        arena_free(tasks);
+        size = uxTaskGetNumberOfTasks() + 4;
+        tasks = (TaskStatus_t *) arena_alloc(size * sizeof(TaskStatus_t));
+        if (tasks == NULL) {
+            break;
+        }
+        *count = uxTaskGetSystemState(tasks, size, NULL);
+    } while (*count == 0);
+
+    return tasks;
+}
+
 int PicoShell::system(int argc, char **argv)
 {
     int ret = 0;
@@ -221,7 +617,8 @@ int PicoShell::system(int argc, char **argv)
     unsigned int total_heap = &__StackLimit  - &__bss_end__;
     unsigned int used_heap = m.uordblks;
     unsigned int free_heap = total_heap - used_heap;
-    char cTaskListBuffer[512];
+    TaskStatus_t *tasks;
+    UBaseType_t count;
     shared_ptr<PicoPlatform> pico = PicoPlatform::get();
 
     this->printf("  Platform: %s\n", pico->getName().c_str());
@@ -247,12 +644,187 @@ int PicoShell::system(int argc, char **argv)
         this->printf("clk_adc:  %lu Hz\n", clock_get_hz(clk_adc));
         this->printf("clk_peri: %lu Hz\n", clock_get_hz(clk_peri));
     }
-    bzero(cTaskListBuffer, sizeof(cTaskListBuffer));
-    vTaskListTasks(cTaskListBuffer, sizeof(cTaskListBuffer));
     this->printf("  FreeRTOS:\n");
     this->printf("Name        State  Priority  StackRem   Task#   CPU Affn\n");
     this->printf("--------------------------------------------------------\n");
-    this->printf("%s", cTaskListBuffer);
+    tasks = task_snapshot(&count);
+    for (UBaseType_t i = 0; i < count; i++) {
+        this->printf("%-12s %c      %8lu  %8lu  %6lu   %8s\n",
+                     tasks[i].pcTaskName, task_state(tasks[i].eCurrentState),
+                     (unsigned long) tasks[i].uxCurrentPriority,
+                     (unsigned long) tasks[i].usStackHighWaterMark,
+                     (unsigned long) tasks[i].xTaskNumber,
+                     task_affinity(&tasks[i]));
+    }
+    arena_free(tasks);
+
+    return ret;
+}
+
+/*
+ * CPU use per task over each 'interval' seconds, redrawn in place until
+ * ^C, or for 'count' refreshes. Tasks are charged from the FreeRTOS
+ * run-time counters, which are best kept on the 1 MHz hardware timer: it
+ * counts true microseconds whatever clk_sys is. In FreeRTOSConfig.h:
+ *
+ *   #define configGENERATE_RUN_TIME_STATS            1
+ *   #define configRUN_TIME_COUNTER_TYPE              uint64_t
+ *   #define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()
+ *   #define portGET_RUN_TIME_COUNTER_VALUE()         time_us_64()
+ *
+ * Some task always runs on every core, so over an interval the tasks'
+ * run time adds up to the interval times the number of cores; a task's
+ * share is shown as a percentage of one core. The idle tasks are not
+ * tied to a core under SMP, so the load of each core is taken from
+ * sysclock_sleep_us() instead, when the idle hooks call sysclock_idle().
+ */
+int PicoShell::top(int argc, char **argv)
+{
+    int ret = 0;
+    struct sample {
+        UBaseType_t num;
+        configRUN_TIME_COUNTER_TYPE runtime;
+    };
+    struct sample *last = NULL, *next;
+    TaskStatus_t *tasks = NULL, t;
+    UBaseType_t n, nlast = 0, i, j;
+    configRUN_TIME_COUNTER_TYPE delta;
+    uint64_t sum, idle;
+    uint32_t now, then = 0, elapsed;
+    uint32_t slept0[configNUMBER_OF_CORES], slept[configNUMBER_OF_CORES];
+    unsigned int interval_ms = 1000;
+    unsigned int count = 0;
+    unsigned int frames = 0;
+    unsigned int core, load;
+    bool percore = false;
+
+    if (argc > 1) {
+        interval_ms = (unsigned int) (strtof(argv[1], NULL) * 1000.0f);
+        if (interval_ms < 100) {
+            this->printf("interval must be at least 0.1 s\n");
+            ret = -1;
+            goto done;
+        }
+    }
+    if (argc > 2) {
+        count = strtoul(argv[2], NULL, 0);
+    }
+
+    if (configGENERATE_RUN_TIME_STATS == 0) {
+        this->printf("needs configGENERATE_RUN_TIME_STATS\n");
+        ret = -1;
+        goto done;
+    }
+
+    this->printf("\x1b[2J\x1b[H");
+
+    for (;;) {
+        tasks = task_snapshot(&n);
+        now = time_us_32();
+        for (core = 0; core < configNUMBER_OF_CORES; core++) {
+            slept[core] = sysclock_sleep_us(core);
+            if (slept[core] != 0) {
+                percore = true;
+            }
+        }
+        next = (struct sample *) arena_alloc(n * sizeof(struct sample));
+        if ((tasks == NULL) || (next == NULL)) {
+            this->printf("out of memory\n");
+            arena_free(next);
+            ret = -1;
+            break;
+        }
+
+        /* Turn the counters into run time over the interval */
+        sum = 0;
+        idle = 0;
+        for (i = 0; i < n; i++) {
+            next[i].num = tasks[i].xTaskNumber;
+            next[i].runtime = tasks[i].ulRunTimeCounter;
+            delta = tasks[i].ulRunTimeCounter;
+            for (j = 0; j < nlast; j++) {
+                if (last[j].num == tasks[i].xTaskNumber) {
+                    delta -= last[j].runtime;
+                    break;
+                }
+            }
+            tasks[i].ulRunTimeCounter = delta;
+            sum += delta;
+            if (strncmp(tasks[i].pcTaskName, configIDLE_TASK_NAME,
+                        sizeof(configIDLE_TASK_NAME) - 1) == 0) {
+                idle += delta;
+            }
+        }
+
+        if ((last != NULL) && (sum > 0)) {
+            /* Busiest first; there are only ever a few dozen tasks */
+            for (i = 1; i < n; i++) {
+                t = tasks[i];
+                for (j = i; (j > 0) &&
+                         (tasks[j - 1].ulRunTimeCounter < t.ulRunTimeCounter);
+                     j--) {
+                    tasks[j] = tasks[j - 1];
+                }
+                tasks[j] = t;
+            }
+
+            elapsed = now - then;
+            this->printf("\x1b[Htop - %lu tasks, every %u.%u s, "
+                         "clk_sys %lu MHz\x1b[K\n",
+                         (unsigned long) n, interval_ms / 1000,
+                         (interval_ms % 1000) / 100,
+                         (unsigned long) (clock_get_hz(clk_sys) / 1000000));
+            load = 1000 - (unsigned int) (idle * 1000 / sum);
+            this->printf("CPU %3u.%u%%", load / 10, load % 10);
+            for (core = 0; percore && (core < configNUMBER_OF_CORES);
+                 core++) {
+                load = (slept[core] - slept0[core]) >= elapsed ? 0 :
+                    1000 - (unsigned int)
+                    ((uint64_t) (slept[core] - slept0[core]) * 1000 / elapsed);
+                this->printf("   core%u %3u.%u%%", core, load / 10, load % 10);
+            }
+            this->printf("\x1b[K\n\x1b[K\n");
+            this->printf("Task# Name         State Prio StackRem Affn"
+                         "      CPU%%\x1b[K\n");
+            for (i = 0; i < n; i++) {
+                load = (unsigned int)
+                    ((uint64_t) tasks[i].ulRunTimeCounter * 1000 *
+                     configNUMBER_OF_CORES / sum);
+                this->printf("%5lu %-12s %c     %4lu %8lu %-8s %3u.%u"
+                             "\x1b[K\n",
+                             (unsigned long) tasks[i].xTaskNumber,
+                             tasks[i].pcTaskName,
+                             task_state(tasks[i].eCurrentState),
+                             (unsigned long) tasks[i].uxCurrentPriority,
+                             (unsigned long) tasks[i].usStackHighWaterMark,
+                             task_affinity(&tasks[i]), load / 10, load % 10);
+            }
+            this->printf("\x1b[J");
+            this->tx_flush();
+
+            frames++;
+        }
+
+        arena_free(tasks);
+        tasks = NULL;
+        arena_free(last);
+        last = next;
+        nlast = n;
+        then = now;
+        for (core = 0; core < configNUMBER_OF_CORES; core++) {
+            slept0[core] = slept[core];
+        }
+
+        if (((count > 0) && (frames >= count)) ||
+            this->cancelWait(interval_ms)) {
+            break;
+        }
+    }
+
+    arena_free(tasks);
+    arena_free(last);
+
+done:
 
     return ret;
 }
@@ -281,6 +853,262 @@ int PicoShell::bootsel(int argc, char **argv)
     return ret;
 }
 
+int PicoShell::jitter(int argc, char **argv)
+{
+    int ret = 0;
+    static const unsigned int bounds[] = IOCORE_JITTER_BOUNDS;
+    struct iocore_jitter jitter;
+    unsigned int core = (PICO_PLAT_IO_CORE == 0) ? 1 : 0;
+    unsigned int samples = 5000;
+    unsigned int i;
+
+    if (argc > 1) {
+        core = strtoul(argv[1], NULL, 0);
+    }
+    if (argc > 2) {
+        samples = strtoul(argv[2], NULL, 0);
+    }
+
+    if (PICO_PLAT_IO_CORE >= 0) {
+        this->printf("I/O core: %d\n", PICO_PLAT_IO_CORE);
+    } else {
+        this->printf("I/O core: none\n");
+    }
+    this->printf("Measuring %u ticks on core %u ...\n", samples, core);
+
+    ret = iocore_measure_jitter(core, samples, &jitter);
+    if (ret != 0) {
+        this->printf("failed!\n");
+        goto done;
+    }
+
+    this->printf("Period: %u us  min: %u us  avg: %u us  max: %u us\n",
+                 jitter.period_us, jitter.min_us, jitter.avg_us,
+                 jitter.max_us);
+    for (i = 0; i < IOCORE_JITTER_BUCKETS; i++) {
+        if (i < IOCORE_JITTER_BUCKETS - 1) {
+            this->printf("  <  %3u us: %u\n", bounds[i], jitter.hist[i]);
+        } else {
+            this->printf("  >= %3u us: %u\n", bounds[i - 1], jitter.hist[i]);
+        }
+    }
+
+done:
+
+    return ret;
+}
+
+int PicoShell::irqlat(int argc, char **argv)
+{
+    int ret = 0;
+    struct iocore_irqlat lat;
+    unsigned int core = (PICO_PLAT_IO_CORE >= 0) ? PICO_PLAT_IO_CORE : 0;
+    unsigned int samples = 10000;
+    unsigned int mhz;
+    int flags = 0;
+    int pos = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "cold") == 0) {
+            flags |= IOCORE_IRQLAT_COLD;
+        } else if (strcmp(argv[i], "load") == 0) {
+            flags |= IOCORE_IRQLAT_LOAD;
+        } else if (pos == 0) {
+            core = strtoul(argv[i], NULL, 0);
+            pos++;
+        } else if (pos == 1) {
+            samples = strtoul(argv[i], NULL, 0);
+            pos++;
+        } else {
+            this->usage(this->findCommand(argv[0]));
+            ret = -1;
+            goto done;
+        }
+    }
+
+    this->printf("RAM hot path: %s\n", PICO_PLAT_RAM_HOT_PATH ? "on" : "off");
+    this->printf("Measuring %u interrupts on core %u%s%s ...\n",
+                 samples, core,
+                 (flags & IOCORE_IRQLAT_COLD) ? ", cold cache" : "",
+                 (flags & IOCORE_IRQLAT_LOAD) ? ", flash load" : "");
+
+    ret = iocore_measure_irq_latency(core, samples, flags, &lat);
+    if (ret != 0) {
+        this->printf("failed!\n");
+        goto done;
+    }
+
+    mhz = lat.hz / 1000000;
+    if (mhz == 0) {
+        mhz = 1;
+    }
+    this->printf("min: %u cycles (%u ns)\n", lat.min_cycles,
+                 lat.min_cycles * 1000 / mhz);
+    this->printf("avg: %u cycles (%u ns)\n", lat.avg_cycles,
+                 lat.avg_cycles * 1000 / mhz);
+    this->printf("max: %u cycles (%u ns)\n", lat.max_cycles,
+                 lat.max_cycles * 1000 / mhz);
+
+done:
+
+    return ret;
+}
+
+int PicoShell::clock(int argc, char **argv)
+{
+    int ret = 0;
+    shared_ptr<PicoPlatform> pico = PicoPlatform::get();
+    unsigned long mhz;
+    char *end;
+
+    if (argc == 2) {
+        if (strcmp(argv[1], "low") == 0) {
+            ret = pico->setPerformanceMode(PicoPlatform::PERFORMANCE_LOW);
+        } else if (strcmp(argv[1], "normal") == 0) {
+            ret = pico->setPerformanceMode(PicoPlatform::PERFORMANCE_NORMAL);
+        } else if (strcmp(argv[1], "high") == 0) {
+            ret = pico->setPerformanceMode(PicoPlatform::PERFORMANCE_HIGH);
+        } else {
+            mhz = strtoul(argv[1], &end, 0);
+            if ((*end != '\0') || (mhz == 0)) {
+                this->usage(this->findCommand(argv[0]));
+                ret = -1;
+                goto done;
+            }
+            ret = pico->setSysClockHz(mhz * 1000000);
+        }
+
+        if (ret != 0) {
+            this->printf("failed!\n");
+            goto done;
+        }
+    }
+
+    this->printf("clk_sys:  %lu Hz\n", clock_get_hz(clk_sys));
+    this->printf("clk_peri: %lu Hz\n", clock_get_hz(clk_peri));
+    this->printf("vreg:     %u mV\n", sysclock_get_vreg_mv());
+
+done:
+
+    return ret;
+}
+
+/*
+ * Needs pico-plat built with PICO_PLAT_HEAP_TRACE. Fragmentation is how
+ * much of the free memory cannot be had in one allocation.
+ */
+int PicoShell::heap(int argc, char **argv)
+{
+    int ret = 0;
+    struct heaptrace_stats stats;
+    struct heaptrace_task tasks[16];
+    struct heaptrace_rec recs[16];
+    unsigned int i, n;
+    uint32_t now;
+
+    if (heaptrace_get(&stats) != 0) {
+        this->printf("needs PICO_PLAT_HEAP_TRACE\n");
+        ret = -1;
+        goto done;
+    }
+
+    if (argc == 1) {
+        this->printf("   Arena: %8u bytes\n", (unsigned int) stats.arena);
+        this->printf("  In use: %8u bytes, peak %u\n",
+                     (unsigned int) stats.used, (unsigned int) stats.peak);
+        this->printf("    Free: %8u bytes, %u holes\n",
+                     (unsigned int) stats.free, stats.free_blocks);
+        this->printf(" Largest: %8u bytes, %u%% fragmented\n",
+                     (unsigned int) stats.largest,
+                     (stats.free == 0) ? 0 : (unsigned int)
+                     (100 - (uint64_t) stats.largest * 100 / stats.free));
+        this->printf("  Allocs: %lu  frees: %lu  failed: %lu\n",
+                     stats.allocs, stats.frees, stats.failures);
+    } else if (strcmp(argv[1], "tasks") == 0) {
+        n = heaptrace_tasks(tasks, sizeof(tasks) / sizeof(tasks[0]));
+        this->printf("Name              Allocs     Frees   Alloc'd     Freed"
+                     "       Net\n");
+        for (i = 0; i < n; i++) {
+            this->printf("%-16s %7lu %9lu %9lu %9lu %9ld\n",
+                         tasks[i].name, tasks[i].allocs, tasks[i].frees,
+                         (unsigned long) tasks[i].alloc_bytes,
+                         (unsigned long) tasks[i].free_bytes,
+                         (long) (int32_t) (tasks[i].alloc_bytes -
+                                           tasks[i].free_bytes));
+        }
+    } else if (strcmp(argv[1], "recent") == 0) {
+        n = heaptrace_recent(recs, sizeof(recs) / sizeof(recs[0]));
+        heaptrace_tasks(tasks, sizeof(tasks) / sizeof(tasks[0]));
+        now = time_us_32();
+        this->printf("     Age  Op     Size  Address     Caller      Task\n");
+        for (i = 0; i < n; i++) {
+            this->printf("%5lu ms  %s %7lu  %p  %p  %s\n",
+                         (unsigned long) ((now - recs[i].time_us) / 1000),
+                         (recs[i].op == HEAPTRACE_ALLOC) ? "+" : "-",
+                         (unsigned long) recs[i].size, recs[i].ptr,
+                         recs[i].pc,
+                         (recs[i].task < (sizeof(tasks) / sizeof(tasks[0]))) ?
+                         tasks[recs[i].task].name : "?");
+        }
+    } else if (strcmp(argv[1], "reset") == 0) {
+        heaptrace_reset();
+    } else {
+        this->usage(this->findCommand(argv[0]));
+        ret = -1;
+    }
+
+done:
+
+    return ret;
+}
+
+/*
+ * The lows are in words, as uxTaskGetStackHighWaterMark() counts them,
+ * each with the uptime in seconds it was first seen at; a '*' marks a
+ * task that has since been deleted.
+ */
+int PicoShell::stacks(int argc, char **argv)
+{
+    int ret = 0;
+    struct stackmon_task t;
+    unsigned int period_ms = 1000;
+    unsigned int margin = 32;
+    unsigned int i, j;
+
+    if (argc == 1) {
+        this->printf("Monitor %s\n",
+                     stackmon_running() ? "running" : "stopped");
+        this->printf("Name               Free  Lows (s:words)\n");
+        for (i = 0; stackmon_get(i, &t) == 0; i++) {
+            this->printf("%-16s %6u%s", t.name, t.free_words,
+                         t.gone ? "*" : " ");
+            for (j = 0; (j < t.nlows) && (j < STACKMON_HISTORY); j++) {
+                this->printf(" %lu:%u", (unsigned long) t.lows[j].uptime_s,
+                             t.lows[j].free_words);
+            }
+            this->printf("\n");
+        }
+    } else if (strcmp(argv[1], "start") == 0) {
+        if (argc > 2) {
+            period_ms = strtoul(argv[2], NULL, 0);
+        }
+        if (argc > 3) {
+            margin = strtoul(argv[3], NULL, 0);
+        }
+        if (stackmon_start(period_ms, margin, NULL, NULL) != 0) {
+            this->printf("cannot start the monitor\n");
+            ret = -1;
+        }
+    } else if (strcmp(argv[1], "stop") == 0) {
+        stackmon_stop();
+    } else {
+        this->usage(this->findCommand(argv[0]));
+        ret = -1;
+    }
+
+    return ret;
+}
+
 int PicoShell::unknown_command(int argc, char **argv)
 {
     (void)(argc);
@@ -298,38 +1126,98 @@ int PicoShell::tx_write(const uint8_t *buf, size_t size)
     case PICO_SHELL_USB_CDC: ret = usbcdc_write(buf, size); break;
     case PICO_SHELL_SERIAL0: ret = serial0_write(buf, size); break;
     case PICO_SHELL_SERIAL1: ret = serial1_write(buf, size); break;
+    case PICO_SHELL_USB_CDC1: ret = usbcdc_n_write(1, buf, size); break;
     default: break;
     }
 
     return ret;
 }
 
+/*
+ * Append to the output buffer, writing it out whenever it fills up.
+ * Everything the shell prints goes through here, in order.
+ */
+void PicoShell::tx_put(const void *buf, size_t size)
+{
+    const uint8_t *p = (const uint8_t *) buf;
+    size_t n;
+
+    while (size > 0) {
+        if (_txLen == sizeof(_txBuf)) {
+            this->tx_flush();
+        }
+
+        n = sizeof(_txBuf) - _txLen;
+        if (n > size) {
+            n = size;
+        }
+        memcpy(_txBuf + _txLen, p, n);
+        _txLen += n;
+        p += n;
+        size -= n;
+    }
+}
+
+void PicoShell::tx_flush(void)
+{
+    size_t off = 0;
+    int n;
+
+    while (off < _txLen) {
+        n = this->tx_write(_txBuf + off, _txLen - off);
+        if (n <= 0) {
+            break;
+        }
+        off += n;
+    }
+
+    _txLen = 0;
+    _txLine = false;
+}
+
+/*
+ * fmt_vprintf() sink: buffer the formatted chunk with "\r\n" in place of
+ * each bare newline, and note that a line is complete.
+ */
+void PicoShell::tx_sink(void *ctx, const char *s, size_t len)
+{
+    PicoShell *shell = (PicoShell *) ctx;
+    const char *nl;
+
+    while ((nl = (const char *) memchr(s, '\n', len)) != NULL) {
+        shell->tx_put(s, nl - s);
+        shell->tx_put("\r\n", 2);
+        shell->_txLine = true;
+        len -= nl - s + 1;
+        s = nl + 1;
+    }
+
+    shell->tx_put(s, len);
+}
+
 int PicoShell::printf(const char *format, ...)
 {
     int ret = 0;
     va_list ap;
 
     va_start(ap, format);
-    switch (_device) {
-    case PICO_SHELL_USB_CDC: ret = usbcdc_vprintf(format, ap); break;
-    case PICO_SHELL_SERIAL0: ret = serial0_vprintf(format, ap); break;
-    case PICO_SHELL_SERIAL1: ret = serial1_vprintf(format, ap); break;
-    default: break;
-    }
+    ret = this->vprintf(format, ap);
     va_end(ap);
 
     return ret;
 }
 
+/*
+ * Output is line buffered: it goes out once a line is complete, or when
+ * process() returns, or before catch_ctr_c() looks for input.
+ */
 int PicoShell::vprintf(const char *format, va_list ap)
 {
     int ret = 0;
 
-    switch (_device) {
-    case PICO_SHELL_USB_CDC: ret = usbcdc_vprintf(format, ap); break;
-    case PICO_SHELL_SERIAL0: ret = serial0_vprintf(format, ap); break;
-    case PICO_SHELL_SERIAL1: ret = serial1_vprintf(format, ap); break;
-    default: break;
+    ret = fmt_vprintf(PicoShell::tx_sink, this, format, ap);
+    if (_txLine) {
+        this->tx_flush();
     }
 
     return ret;
@@ -343,6 +1231,7 @@ int PicoShell::rx_ready(void) const
     case PICO_SHELL_USB_CDC: ret = usbcdc_rx_ready(); break;
     case PICO_SHELL_SERIAL0: ret = serial0_rx_ready(); break;
     case PICO_SHELL_SERIAL1: ret = serial1_rx_ready(); break;
+    case PICO_SHELL_USB_CDC1: ret = usbcdc_n_rx_ready(1); break;
     default: break;
     }
 
@@ -357,53 +1246,80 @@ int PicoShell::rx_read(uint8_t *buf, size_t size)
     case PICO_SHELL_USB_CDC: ret = usbcdc_read(buf, size); break;
     case PICO_SHELL_SERIAL0: ret = serial0_read(buf, size); break;
     case PICO_SHELL_SERIAL1: ret = serial1_read(buf, size); break;
+    case PICO_SHELL_USB_CDC1: ret = usbcdc_n_read(1, buf, size); break;
     default: break;
     }
 
     return ret;
 }
 
+int PicoShell::rx_wait(unsigned int timeout_ms)
+{
+    int ret = 0;
+
+    switch (_device) {
+    case PICO_SHELL_USB_CDC: ret = usbcdc_rx_wait(timeout_ms); break;
+    case PICO_SHELL_SERIAL0: ret = serial0_rx_wait(timeout_ms); break;
+    case PICO_SHELL_SERIAL1: ret = serial1_rx_wait(timeout_ms); break;
+    case PICO_SHELL_USB_CDC1: ret = usbcdc_n_rx_wait(1, timeout_ms); break;
+    default: ret = -1; break;
+    }
+
+    return ret;
+}
+
+/*
+ * Whether ^C or IAC IP has been typed; with 'untilFound', block (without
+ * spinning) until it is. Other input is discarded. In async mode the
+ * input task does the looking, and this only consults the token.
+ */
 bool PicoShell::catch_ctr_c(bool untilFound)
 {
     bool result = false;
+    int ret;
+    uint8_t c;
 
-    do {
-        int ret;
-        char c;
+    if (_worker != NULL) {
+        return this->cancelWait(untilFound ? SERIAL_WAIT_FOREVER : 0);
+    }
+
+    this->tx_flush();
 
-        ret = this->rx_read((uint8_t *) &c, 1);
-        if (ret == -1) {
+    for (;;) {
+        ret = this->rx_read(&c, 1);
+        if (ret < 0) {
             break;
+        } else if (ret == 0) {
+            if (!untilFound) {
+                break;
+            }
+            if (this->rx_wait(SERIAL_WAIT_FOREVER) < 0) {
+                break;
+            }
+            continue;
         }
 
-        if (c == 0xff) {  // IAC received
-            static const uint8_t iac_do_tm[3] = { 0xff, 0xfd, 0x06, };
-            static const uint8_t iac_will_tm[3] = { 0xff, 0xfb, 0x06, };
-            char iac2;
-
-            ret = this->rx_read((uint8_t *) &iac2, 1);
-            if (ret == 1) {
-                switch (iac2) {
-                case 0xf4:  // IAC IP (interrupt process)
-                    ret = this->tx_write(iac_do_tm, sizeof(iac_do_tm));
-                    ret = this->tx_write(iac_will_tm, sizeof(iac_will_tm));
-                    this->printf("\n> ");
-                    _inproc.i = 0;
-                    result = true;
-                    break;
-                default:
-                    break;
-                }
+        if (_inproc.iac) {
+            _inproc.iac = false;
+            if (c == 0xf4) {  // IAC IP (interrupt process)
+                this->tx_put(iac_do_tm, sizeof(iac_do_tm));
+                this->tx_put(iac_will_tm, sizeof(iac_will_tm));
+                this->tx_flush();
+                result = true;
+                break;
             }
-
+        } else if (c == 0xff) {  // IAC received
+            _inproc.iac = true;
+            continue;
+        } else if (c == '\x03') {
+            result = true;
             break;
         }
 
-        if (c == '\x03') {
-            result = true;
+        if (!untilFound) {
             break;
         }
-    } while (untilFound);
+    }
 
     return result;
 }
@@ -9,14 +9,96 @@
 
 #include <string>
 #include <memory>
-#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <semphr.h>
+#include <PicoAllocator.hxx>
 
 using namespace std;
 
+#ifndef PICO_SHELL_CMD_TABLES_MAX
+#define PICO_SHELL_CMD_TABLES_MAX  4
+#endif
+
+#define PICO_SHELL_ARGC_ANY  0xff
+
+/* Bytes taken from the device per read */
+#ifndef PICO_SHELL_RX_CHUNK
+#define PICO_SHELL_RX_CHUNK  64
+#endif
+
+/* Back-off when waiting on the device fails, e.g. before it is set up */
+#ifndef PICO_SHELL_RETRY_MS
+#define PICO_SHELL_RETRY_MS  100
+#endif
+
+/* Output is gathered here and written out a line at a time */
+#ifndef PICO_SHELL_TX_BUF_SIZE
+#define PICO_SHELL_TX_BUF_SIZE  256
+#endif
+
+/* Stack of the task running commands in async mode, in words */
+#ifndef PICO_SHELL_TASK_STACK
+#define PICO_SHELL_TASK_STACK  1024
+#endif
+
 enum PicoShellDevice {
     PICO_SHELL_USB_CDC,
     PICO_SHELL_SERIAL0,
     PICO_SHELL_SERIAL1,
+    PICO_SHELL_USB_CDC1,
+};
+
+class PicoShell;
+
+/*
+ * One shell command. Tables of these are meant to be constexpr arrays,
+ * sorted by name, which end up in flash: registering one with
+ * PicoShell::addCommands() copies nothing and allocates nothing, and a
+ * lookup is a binary search per table. 'minArgs' and 'maxArgs' bound the
+ * number of arguments after the name (PICO_SHELL_ARGC_ANY for no upper
+ * bound); exec() prints the usage line built from 'args' when they are
+ * not met.
+ *
+ * A subclass declares its table as a static member, defines it constexpr
+ * out of the class like PicoShell::commands, with 'fn' set through
+ * static_cast<PicoShellCmd::Handler>(&MyShell::method), and registers it
+ * from its constructor after static_assert()ing that it is sorted().
+ */
+struct PicoShellCmd {
+
+    typedef int (PicoShell::*Handler)(int argc, char **argv);
+
+    const char *name;
+    Handler fn;
+    const char *args;
+    const char *help;
+    uint8_t minArgs;
+    uint8_t maxArgs;
+
+    static constexpr int compare(const char *a, const char *b) {
+        while ((*a != '\0') && (*a == *b)) {
+            a++;
+            b++;
+        }
+
+        return (int) (unsigned char) *a - (int) (unsigned char) *b;
+    }
+
+    /* For static_assert()ing that a table is sorted */
+    template <size_t N>
+    static constexpr bool sorted(const PicoShellCmd (&table)[N]) {
+        for (size_t i = 1; i < N; i++) {
+            if (compare(table[i - 1].name, table[i].name) >= 0) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
 };
 
 class PicoShell {
@@ -26,29 +108,41 @@ public:
     PicoShell(enum PicoShellDevice device);
     ~PicoShell();
 
-    inline void setBanner(const string &banner) {
+    inline void setBanner(const char *banner) {
         _banner = banner;
     }
-    inline void setVersion(const string &version) {
+    inline void setBanner(const string &banner) {
+        _banner.assign(banner.data(), banner.size());
+    }
+    inline void setVersion(const char *version) {
         _version = version;
     }
-    inline void setBuilt(const string &built) {
+    inline void setVersion(const string &version) {
+        _version.assign(version.data(), version.size());
+    }
+    inline void setBuilt(const char *built) {
         _built = built;
     }
-    inline void setCopyright(const string &copyright) {
+    inline void setBuilt(const string &built) {
+        _built.assign(built.data(), built.size());
+    }
+    inline void setCopyright(const char *copyright) {
         _copyright = copyright;
     }
+    inline void setCopyright(const string &copyright) {
+        _copyright.assign(copyright.data(), copyright.size());
+    }
 
-    inline const string &banner(void) const {
+    inline const PicoString &banner(void) const {
         return _banner;
     }
-    inline const string &version(void) const {
+    inline const PicoString &version(void) const {
         return _version;
     }
-    inline const string &built(void) const {
+    inline const PicoString &built(void) const {
         return _built;
     }
-    inline const string &copyright(void) const {
+    inline const PicoString &copyright(void) const {
         return _copyright;
     }
 
@@ -64,35 +158,72 @@ public:
         this->printf("-------------------------------------------\n");
         this->printf("%s\n", _copyright.c_str());
         this->printf("> ");
+        this->tx_flush();
     }
 
     virtual int process(void);
+    int process(unsigned int timeout_ms);
+    void run(void);
+
+    int addCommands(const PicoShellCmd *table, size_t count);
+    template <size_t N>
+    inline int addCommands(const PicoShellCmd (&table)[N]) {
+        return addCommands(table, N);
+    }
+    const PicoShellCmd *findCommand(const char *name) const;
+
+    int setAsync(bool async, unsigned int priority = tskIDLE_PRIORITY + 1);
+    inline bool isAsync(void) const {
+        return _worker != NULL;
+    }
+    inline bool isBusy(void) const {
+        return __atomic_load_n(&_busy, __ATOMIC_ACQUIRE);
+    }
+    void cancel(void);
+    bool cancelled(void);
+    bool cancelWait(unsigned int timeout_ms);
 
 protected:
 
     virtual int tx_write(const uint8_t *buf, size_t size);
+    void tx_put(const void *buf, size_t size);
+    void tx_flush(void);
+    static void tx_sink(void *ctx, const char *s, size_t len);
     virtual int printf(const char *format, ...);
     virtual int vprintf(const char *format, va_list ap);
     virtual int rx_ready(void) const;
     virtual int rx_read(uint8_t *buf, size_t size);
+    virtual int rx_wait(unsigned int timeout_ms);
     virtual bool catch_ctr_c(bool untilFound = true);
+    virtual void rx_char(uint8_t c);
 
     virtual int exec(char *cmdline);
+    virtual void usage(const PicoShellCmd *cmd);
     virtual int help(int argc, char **argv);
     virtual int version(int argc, char **argv);
     virtual int system(int argc, char **argv);
     virtual int reboot(int argc, char **argv);
     virtual int bootsel(int argc, char **argv);
+    virtual int jitter(int argc, char **argv);
+    virtual int irqlat(int argc, char **argv);
+    virtual int clock(int argc, char **argv);
+    virtual int top(int argc, char **argv);
+    virtual int heap(int argc, char **argv);
+    virtual int stacks(int argc, char **argv);
     virtual int unknown_command(int argc, char **argv);
 
     time_t _since;
 
-    string _banner;
-    string _version;
-    string _built;
-    string _copyright;
+    PicoString _banner;
+    PicoString _version;
+    PicoString _built;
+    PicoString _copyright;
+
+    static const PicoShellCmd commands[];
 
-    vector<string> _help_list;
+    const PicoShellCmd *_cmdTables[PICO_SHELL_CMD_TABLES_MAX];
+    size_t _cmdCounts[PICO_SHELL_CMD_TABLES_MAX];
+    unsigned int _nCmdTables;
 
 protected:
 
@@ -105,10 +236,24 @@ protected:
     struct inproc {
         char cmdline[CMDLINE_SIZE];
         unsigned int i;
+        bool iac;
     };
 
     struct inproc _inproc;
 
+    uint8_t _txBuf[PICO_SHELL_TX_BUF_SIZE];
+    size_t _txLen;
+    bool _txLine;
+
+    static void worker(void *arg);
+
+    TaskHandle_t _worker;
+    SemaphoreHandle_t _cmdSem;
+    char _asyncCmd[CMDLINE_SIZE];
+    volatile bool _busy;
+    volatile bool _cancel;
+    volatile bool _iacReply;
+
 };
 
 #endif
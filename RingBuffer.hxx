@@ -0,0 +1,214 @@
+/*
+ * RingBuffer.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef RINGBUFFER_HXX
+#define RINGBUFFER_HXX
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+#include <ringbuf.h>
+
+using namespace std;
+
+/*
+ * Typed counterpart of struct ringbuf for C++ users: same index scheme,
+ * same ordering rules and same overflow policies, with the storage and
+ * size fixed at compile time.
+ */
+template <typename T, size_t N, enum ringbuf_policy P = RINGBUF_DROP_NEW>
+class RingBuffer {
+
+    static_assert((N > 0) && ((N & (N - 1)) == 0),
+                  "RingBuffer size must be a power of two");
+    static_assert(is_trivially_copyable<T>::value,
+                  "RingBuffer elements are copied with memcpy");
+
+public:
+
+    RingBuffer() : _head(0), _resv(0), _tail(0), _dropped(0) {
+
+    }
+
+    static constexpr size_t size(void) {
+        return N;
+    }
+
+    inline size_t used(void) const {
+        uint32_t used = _head.load(memory_order_acquire) -
+            _tail.load(memory_order_relaxed);
+
+        return used > N ? N : used;
+    }
+
+    inline size_t free(void) const {
+        uint32_t used = _head.load(memory_order_relaxed) -
+            _tail.load(memory_order_acquire);
+
+        return used > N ? 0 : N - used;
+    }
+
+    inline bool empty(void) const {
+        return _head.load(memory_order_acquire) ==
+            _tail.load(memory_order_relaxed);
+    }
+
+    inline size_t dropped(void) const {
+        return _dropped;
+    }
+
+    size_t write(const T *data, size_t len) {
+        uint32_t head = _head.load(memory_order_relaxed);
+
+        if (P == RINGBUF_DROP_NEW) {
+            uint32_t room = N - (head - _tail.load(memory_order_acquire));
+
+            if (len > room) {
+                _dropped += len - room;
+                len = room;
+            }
+        } else {
+            if (len > N) {
+                data += len - N;
+                head += len - N;
+                len = N;
+            }
+
+            _resv.store(head + len, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+        }
+
+        copyIn(head, data, len);
+        _head.store(head + len, memory_order_release);
+
+        return len;
+    }
+
+    size_t read(T *data, size_t len) {
+        uint32_t tail;
+
+        for (;;) {
+            uint32_t used = avail(tail);
+
+            if (len > used) {
+                len = used;
+            }
+
+            copyOut(tail, data, len);
+
+            if (P == RINGBUF_DROP_OLD) {
+                uint32_t resv;
+
+                atomic_thread_fence(memory_order_seq_cst);
+                resv = _resv.load(memory_order_relaxed);
+                if (resv - tail > N) {
+                    _dropped += resv - N - tail;
+                    _tail.store(resv - N, memory_order_release);
+                    continue;
+                }
+            }
+
+            break;
+        }
+
+        _tail.store(tail + len, memory_order_release);
+
+        return len;
+    }
+
+    size_t peek(const T **ptr1, size_t *len1,
+                const T **ptr2, size_t *len2) {
+        uint32_t tail;
+        uint32_t used = avail(tail);
+        uint32_t off = tail & (N - 1);
+        uint32_t n = N - off;
+
+        _tail.store(tail, memory_order_release);
+        if (n > used) {
+            n = used;
+        }
+
+        *ptr1 = _buf + off;
+        *len1 = n;
+        *ptr2 = _buf;
+        *len2 = used - n;
+
+        return used;
+    }
+
+    size_t consume(size_t len) {
+        uint32_t tail;
+        uint32_t used = avail(tail);
+
+        if (len > used) {
+            len = used;
+        }
+
+        _tail.store(tail + len, memory_order_release);
+
+        return len;
+    }
+
+    inline bool push(const T &v) {
+        return write(&v, 1) == 1;
+    }
+
+    inline bool pop(T &v) {
+        return read(&v, 1) == 1;
+    }
+
+private:
+
+    uint32_t avail(uint32_t &tail) {
+        uint32_t head = _head.load(memory_order_acquire);
+        uint32_t used;
+
+        tail = _tail.load(memory_order_relaxed);
+        used = head - tail;
+        if (used > N) {
+            _dropped += used - N;
+            tail = head - N;
+            used = N;
+        }
+
+        return used;
+    }
+
+    void copyIn(uint32_t pos, const T *src, size_t len) {
+        size_t off = pos & (N - 1);
+        size_t n = (N - off) < len ? (N - off) : len;
+
+        memcpy(_buf + off, src, n * sizeof(T));
+        memcpy(_buf, src + n, (len - n) * sizeof(T));
+    }
+
+    void copyOut(uint32_t pos, T *dst, size_t len) const {
+        size_t off = pos & (N - 1);
+        size_t n = (N - off) < len ? (N - off) : len;
+
+        memcpy(dst, _buf + off, n * sizeof(T));
+        memcpy(dst + n, _buf, (len - n) * sizeof(T));
+    }
+
+    atomic<uint32_t> _head;
+    atomic<uint32_t> _resv;
+    atomic<uint32_t> _tail;
+    uint32_t _dropped;
+    T _buf[N];
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
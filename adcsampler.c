@@ -0,0 +1,244 @@
+/*
+ * adcsampler.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pico/stdio.h>
+#include <hardware/adc.h>
+#include <hardware/dma.h>
+#include <hardware/irq.h>
+#include <hardware/clocks.h>
+#include <pico-plat.h>
+
+#ifndef ADCSAMPLER_DMA_IRQN
+#define ADCSAMPLER_DMA_IRQN     1
+#endif
+
+#define ADCSAMPLER_CHANNELS        5    // ADC0..3 and the sensor
+#define ADCSAMPLER_OVERSAMPLE_MAX  64
+#define ADCSAMPLER_HALF_MAX  (ADCSAMPLER_CHANNELS * ADCSAMPLER_OVERSAMPLE_MAX)
+
+/*
+ * The ADC runs free in round-robin mode over the selected channels, and
+ * two chained DMA channels take turns filling one half of 'buf' each:
+ * 'oversample' conversions of every channel, in ascending channel order.
+ * When a half completes, its interrupt averages each channel's samples
+ * and feeds the mean through a first-order IIR filter, kept with 12
+ * fractional bits, of which the top 4 are published. Readings are single
+ * aligned 32-bit words, so readers on either core need no lock.
+ */
+struct adcsampler {
+    int chan[2];
+    uint32_t mask;
+    unsigned int nch;
+    unsigned int oversample;
+    unsigned int avg_shift;
+    unsigned int half;
+    uint8_t order[ADCSAMPLER_CHANNELS];
+    int32_t filt[ADCSAMPLER_CHANNELS];
+    bool primed;
+    volatile uint32_t value[ADCSAMPLER_CHANNELS];
+    volatile uint32_t frames;
+    uint16_t buf[2][ADCSAMPLER_HALF_MAX];
+};
+
+static struct adcsampler adcs = { .chan = { -1, -1, }, };
+
+static void PICO_PLAT_HOT(adcsampler_frame)(const uint16_t *buf)
+{
+    uint32_t sum[ADCSAMPLER_CHANNELS] = { 0, };
+    int32_t mean;
+    unsigned int i, ch;
+
+    for (i = 0; i < adcs.half; i += adcs.nch) {
+        for (ch = 0; ch < adcs.nch; ch++) {
+            sum[ch] += buf[i + ch] & 0xfff;
+        }
+    }
+
+    for (ch = 0; ch < adcs.nch; ch++) {
+        mean = (int32_t) ((sum[ch] << 12) / adcs.oversample);
+        if (!adcs.primed) {
+            adcs.filt[ch] = mean;
+        } else {
+            adcs.filt[ch] += (mean - adcs.filt[ch]) >> adcs.avg_shift;
+        }
+        __atomic_store_n(&adcs.value[adcs.order[ch]],
+                         (uint32_t) adcs.filt[ch] >> 8, __ATOMIC_RELEASE);
+    }
+
+    adcs.primed = true;
+    __atomic_store_n(&adcs.frames, adcs.frames + 1, __ATOMIC_RELEASE);
+}
+
+static void PICO_PLAT_HOT(adcsampler_interrupt_handler)(void)
+{
+    for (unsigned int i = 0; i < 2; i++) {
+        int chan = adcs.chan[i];
+
+        if ((chan < 0) ||
+            !dma_irqn_get_channel_status(ADCSAMPLER_DMA_IRQN, chan)) {
+            continue;
+        }
+
+        dma_irqn_acknowledge_channel(ADCSAMPLER_DMA_IRQN, chan);
+        adcsampler_frame(adcs.buf[i]);
+
+        /* Re-arm this half for when its partner chains back to it */
+        dma_channel_set_write_addr(chan, adcs.buf[i], false);
+        dma_channel_set_trans_count(chan, adcs.half, false);
+    }
+}
+
+static void adcsampler_irq_init(void *arg)
+{
+    static bool irq_installed = false;
+
+    (void) arg;
+
+    if (!irq_installed) {
+        irq_add_shared_handler(DMA_IRQ_0 + ADCSAMPLER_DMA_IRQN,
+                               adcsampler_interrupt_handler,
+                               PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+        irq_set_enabled(DMA_IRQ_0 + ADCSAMPLER_DMA_IRQN, true);
+        irq_installed = true;
+    }
+}
+
+/*
+ * Start sampling the channels in 'mask' (bit n for ADCn, bit 4 for the
+ * temperature sensor) at 'rate_hz' conversions per second in total. Each
+ * published reading is the mean of 'oversample' conversions, smoothed by
+ * an IIR filter with weight 1 / 2^avg_shift (0 for none). The caller owns
+ * the ADC from here on: adc_read() and adc_select_input() must not be
+ * used until adcsampler_stop().
+ */
+int adcsampler_start(uint32_t mask, unsigned int rate_hz,
+                     unsigned int oversample, unsigned int avg_shift)
+{
+    int ret = 0;
+    dma_channel_config c;
+    unsigned int ch;
+    float div;
+
+    mask &= (1 << ADCSAMPLER_CHANNELS) - 1;
+    if ((mask == 0) || (rate_hz == 0) || (oversample == 0) ||
+        (oversample > ADCSAMPLER_OVERSAMPLE_MAX) || (avg_shift > 12) ||
+        (adcs.chan[0] >= 0)) {
+        ret = -1;
+        goto done;
+    }
+
+    memset(adcs.filt, 0, sizeof(adcs.filt));
+    memset((void *) adcs.value, 0, sizeof(adcs.value));
+    adcs.mask = mask;
+    adcs.oversample = oversample;
+    adcs.avg_shift = avg_shift;
+    adcs.primed = false;
+    adcs.frames = 0;
+    adcs.nch = 0;
+    for (ch = 0; ch < ADCSAMPLER_CHANNELS; ch++) {
+        if (mask & (1 << ch)) {
+            adcs.order[adcs.nch++] = ch;
+            if (ch < 4) {
+                adc_gpio_init(26 + ch);
+            }
+        }
+    }
+    adcs.half = adcs.nch * oversample;
+
+    adc_init();
+    adc_set_temp_sensor_enabled((mask & (1 << 4)) != 0);
+    adc_select_input(adcs.order[0]);
+    adc_set_round_robin(adcs.nch > 1 ? mask : 0);
+    adc_fifo_setup(true, true, 1, false, false);
+
+    /* A conversion takes 96 cycles of clk_adc at the least */
+    div = (float) clock_get_hz(clk_adc) / (float) rate_hz - 1.0f;
+    adc_set_clkdiv(div < 95.0f ? 0.0f : div);
+
+    adcs.chan[0] = dma_claim_unused_channel(true);
+    adcs.chan[1] = dma_claim_unused_channel(true);
+
+    for (unsigned int i = 0; i < 2; i++) {
+        c = dma_channel_get_default_config(adcs.chan[i]);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        channel_config_set_dreq(&c, DREQ_ADC);
+        channel_config_set_chain_to(&c, adcs.chan[i ^ 1]);
+        dma_channel_configure(adcs.chan[i], &c, adcs.buf[i], &adc_hw->fifo,
+                              adcs.half, false);
+        dma_irqn_set_channel_enabled(ADCSAMPLER_DMA_IRQN, adcs.chan[i],
+                                     true);
+    }
+
+    iocore_run(adcsampler_irq_init, NULL);
+
+    adc_fifo_drain();
+    dma_channel_start(adcs.chan[0]);
+    adc_run(true);
+
+done:
+
+    return ret;
+}
+
+void adcsampler_stop(void)
+{
+    if (adcs.chan[0] < 0) {
+        return;
+    }
+
+    adc_run(false);
+
+    for (unsigned int i = 0; i < 2; i++) {
+        dma_irqn_set_channel_enabled(ADCSAMPLER_DMA_IRQN, adcs.chan[i],
+                                     false);
+        dma_channel_abort(adcs.chan[i]);
+        dma_irqn_acknowledge_channel(ADCSAMPLER_DMA_IRQN, adcs.chan[i]);
+        dma_channel_unclaim(adcs.chan[i]);
+        adcs.chan[i] = -1;
+    }
+
+    adc_fifo_setup(false, false, 0, false, false);
+    adc_fifo_drain();
+    adc_set_round_robin(0);
+    adcs.mask = 0;
+}
+
+/*
+ * Latest filtered reading of 'channel' scaled to 16 bits (the 12-bit
+ * result times 16, with oversampling filling in the low bits), or -1 if
+ * the channel is not sampled or has no reading yet. Never blocks.
+ */
+int adcsampler_get(unsigned int channel)
+{
+    int ret = -1;
+
+    if ((channel < ADCSAMPLER_CHANNELS) && (adcs.mask & (1 << channel)) &&
+        (__atomic_load_n(&adcs.frames, __ATOMIC_ACQUIRE) > 0)) {
+        ret = (int) __atomic_load_n(&adcs.value[channel], __ATOMIC_ACQUIRE);
+    }
+
+    return ret;
+}
+
+unsigned long adcsampler_frames(void)
+{
+    return __atomic_load_n(&adcs.frames, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
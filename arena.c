@@ -0,0 +1,199 @@
+/*
+ * arena.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <hardware/sync.h>
+#include <pico-plat.h>
+
+/*
+ * Blocks per size class. What pico-plat itself allocates once running is
+ * small and bounded: shell strings and shared_ptr control blocks go in
+ * the small classes, the task snapshots of 'system' and 'top' in the
+ * large ones (a 2048-byte block holds about 50 tasks).
+ */
+#ifndef ARENA_BLOCKS_32
+#define ARENA_BLOCKS_32    16
+#endif
+#ifndef ARENA_BLOCKS_128
+#define ARENA_BLOCKS_128   8
+#endif
+#ifndef ARENA_BLOCKS_512
+#define ARENA_BLOCKS_512   4
+#endif
+#ifndef ARENA_BLOCKS_2048
+#define ARENA_BLOCKS_2048  2
+#endif
+
+struct arena_block {
+    struct arena_block *next;
+};
+
+struct arena_class {
+    size_t size;
+    unsigned int nblocks;
+    uint8_t *base;
+    struct arena_block *free;
+    unsigned int used;
+    unsigned int peak;
+};
+
+static uint64_t arena_32[ARENA_BLOCKS_32][32 / 8];
+static uint64_t arena_128[ARENA_BLOCKS_128][128 / 8];
+static uint64_t arena_512[ARENA_BLOCKS_512][512 / 8];
+static uint64_t arena_2048[ARENA_BLOCKS_2048][2048 / 8];
+
+static struct arena_class classes[ARENA_CLASSES] = {
+    { 32, ARENA_BLOCKS_32, (uint8_t *) arena_32, NULL, 0, 0, },
+    { 128, ARENA_BLOCKS_128, (uint8_t *) arena_128, NULL, 0, 0, },
+    { 512, ARENA_BLOCKS_512, (uint8_t *) arena_512, NULL, 0, 0, },
+    { 2048, ARENA_BLOCKS_2048, (uint8_t *) arena_2048, NULL, 0, 0, },
+};
+
+static spin_lock_t *arena_lock = NULL;
+static bool arena_ready = false;
+static unsigned long arena_failures = 0;
+
+/*
+ * Ahead of C++ static constructors, which may already allocate, and of
+ * the other core; until then there is nothing to race.
+ */
+static void __attribute__((constructor(101))) arena_init(void)
+{
+    arena_lock = spin_lock_instance(spin_lock_claim_unused(true));
+}
+
+static inline uint32_t arena_lock_blocking(void)
+{
+    return (arena_lock != NULL) ? spin_lock_blocking(arena_lock) : 0;
+}
+
+static inline void arena_unlock(uint32_t save)
+{
+    if (arena_lock != NULL) {
+        spin_unlock(arena_lock, save);
+    }
+}
+
+/* Thread every class's blocks onto its free list; under the lock */
+static void arena_setup(void)
+{
+    struct arena_class *c;
+    unsigned int i, j;
+
+    for (i = 0; i < ARENA_CLASSES; i++) {
+        c = &classes[i];
+        c->free = NULL;
+        for (j = c->nblocks; j > 0; j--) {
+            struct arena_block *b =
+                (struct arena_block *) (c->base + (j - 1) * c->size);
+
+            b->next = c->free;
+            c->free = b;
+        }
+    }
+
+    arena_ready = true;
+}
+
+/*
+ * A block of at least 'size' bytes, 8-byte aligned, from the smallest
+ * class that has one left; NULL once none does. Takes a few dozen
+ * cycles under a hardware spinlock, never sleeps, and never touches the
+ * heap, so it works from either core, from interrupt handlers and with
+ * malloc() locked out.
+ */
+void *arena_alloc(size_t size)
+{
+    struct arena_class *c;
+    struct arena_block *b = NULL;
+    uint32_t save;
+
+    save = arena_lock_blocking();
+
+    if (!arena_ready) {
+        arena_setup();
+    }
+
+    for (unsigned int i = 0; i < ARENA_CLASSES; i++) {
+        c = &classes[i];
+        if ((size <= c->size) && (c->free != NULL)) {
+            b = c->free;
+            c->free = b->next;
+            c->used++;
+            if (c->used > c->peak) {
+                c->peak = c->used;
+            }
+            break;
+        }
+    }
+
+    if (b == NULL) {
+        arena_failures++;
+    }
+
+    arena_unlock(save);
+
+    return b;
+}
+
+void arena_free(void *ptr)
+{
+    struct arena_class *c;
+    struct arena_block *b = (struct arena_block *) ptr;
+    uint32_t save;
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    save = arena_lock_blocking();
+
+    for (unsigned int i = 0; i < ARENA_CLASSES; i++) {
+        c = &classes[i];
+        if (((uint8_t *) ptr >= c->base) &&
+            ((uint8_t *) ptr < c->base + c->nblocks * c->size)) {
+            b->next = c->free;
+            c->free = b;
+            c->used--;
+            break;
+        }
+    }
+
+    arena_unlock(save);
+}
+
+int arena_get_stats(struct arena_stats *stats)
+{
+    uint32_t save;
+
+    if (stats == NULL) {
+        return -1;
+    }
+
+    save = arena_lock_blocking();
+    for (unsigned int i = 0; i < ARENA_CLASSES; i++) {
+        stats->size[i] = classes[i].size;
+        stats->blocks[i] = classes[i].nblocks;
+        stats->used[i] = classes[i].used;
+        stats->peak[i] = classes[i].peak;
+    }
+    stats->failures = arena_failures;
+    arena_unlock(save);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
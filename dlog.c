@@ -0,0 +1,398 @@
+/*
+ * dlog.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pico/platform.h>
+#include <hardware/sync.h>
+#include <hardware/timer.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <pico-plat.h>
+#include <ringbuf.h>
+#include <dlog.h>
+
+#ifndef DLOG_RING_SIZE
+#define DLOG_RING_SIZE     1024
+#endif
+#ifndef DLOG_ARGS_MAX
+#define DLOG_ARGS_MAX      64
+#endif
+#ifndef DLOG_STR_MAX
+#define DLOG_STR_MAX       32
+#endif
+#ifndef DLOG_DRAIN_MS
+#define DLOG_DRAIN_MS      10
+#endif
+#ifndef DLOG_TASK_STACK
+#define DLOG_TASK_STACK    256
+#endif
+#ifndef DLOG_TASK_PRIORITY
+#define DLOG_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+#endif
+
+/*
+ * In the ring each record is prefixed with its length byte:
+ *
+ *   len | flags | id | ts | [lost] | args...
+ *
+ * where id, ts (microseconds since the previous record of the same core,
+ * or absolute with DLOG_F_ABS) and lost are LEB128 varints. Integer args
+ * are varints (zigzag for signed), doubles are 8 raw bytes, strings are a
+ * varint length followed by the bytes. On the wire the length byte is
+ * dropped and the rest is sent as one COBS frame terminated by 0x00.
+ */
+#define DLOG_HDR_MAX  (1 + 1 + 5 + 5 + 5)
+#define DLOG_REC_MAX  (DLOG_HDR_MAX + DLOG_ARGS_MAX)
+
+struct dlog_core {
+    struct ringbuf ring;
+    uint32_t last_ts;
+    uint32_t lost;        // records dropped since the last one stored
+    bool resync;          // next record carries an absolute timestamp
+    unsigned long total_lost;
+    uint8_t buf[DLOG_RING_SIZE];
+};
+
+static struct dlog_core dlog_cores[NUM_CORES] = {
+    {
+        .ring = RINGBUF_INIT(dlog_cores[0].buf, DLOG_RING_SIZE,
+                             RINGBUF_DROP_NEW),
+        .resync = true,
+    },
+    {
+        .ring = RINGBUF_INIT(dlog_cores[1].buf, DLOG_RING_SIZE,
+                             RINGBUF_DROP_NEW),
+        .resync = true,
+    },
+};
+
+static enum dlog_output dlog_out = DLOG_OUT_SERIAL0;
+static TaskHandle_t dlog_task_handle = NULL;
+
+static inline uint8_t *dlog_varint(uint8_t *p, uint32_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t) (v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t) v;
+
+    return p;
+}
+
+static uint8_t *PICO_PLAT_HOT(dlog_varint64)(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t) (v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t) v;
+
+    return p;
+}
+
+void PICO_PLAT_HOT(dlog_write)(uint32_t id, uint32_t sig, ...)
+{
+    uint8_t args[DLOG_ARGS_MAX];
+    uint8_t hdr[DLOG_HDR_MAX];
+    uint8_t *p = args;
+    uint8_t *q;
+    struct dlog_core *dc;
+    uint32_t save, now, ts;
+    size_t alen, hlen;
+    va_list ap;
+
+    va_start(ap, sig);
+
+    /* Encode the arguments; anything that does not fit is left off */
+    for (; sig != DLOG_T_END; sig >>= 4) {
+        if ((size_t) (args + sizeof(args) - p) < 10) {
+            break;
+        }
+
+        switch (sig & 0xf) {
+        case DLOG_T_I32: {
+            int32_t v = va_arg(ap, int);
+
+            p = dlog_varint(p, ((uint32_t) v << 1) ^ (uint32_t) (v >> 31));
+            break;
+        }
+        case DLOG_T_U32:
+            p = dlog_varint(p, va_arg(ap, unsigned int));
+            break;
+        case DLOG_T_I64: {
+            int64_t v = va_arg(ap, long long);
+
+            p = dlog_varint64(p, ((uint64_t) v << 1) ^ (uint64_t) (v >> 63));
+            break;
+        }
+        case DLOG_T_U64:
+            p = dlog_varint64(p, va_arg(ap, unsigned long long));
+            break;
+        case DLOG_T_F64: {
+            double v = va_arg(ap, double);
+
+            memcpy(p, &v, sizeof(v));
+            p += sizeof(v);
+            break;
+        }
+        case DLOG_T_STR: {
+            const char *s = va_arg(ap, const char *);
+            size_t n, room;
+
+            if (s == NULL) {
+                s = "(null)";
+            }
+            room = args + sizeof(args) - p - 1;
+            n = strnlen(s, room < DLOG_STR_MAX ? room : DLOG_STR_MAX);
+            *p++ = (uint8_t) n;
+            memcpy(p, s, n);
+            p += n;
+            break;
+        }
+        case DLOG_T_PTR:
+        default:
+            p = dlog_varint(p, (uint32_t) (uintptr_t) va_arg(ap, void *));
+            break;
+        }
+    }
+
+    va_end(ap);
+    alen = p - args;
+
+    /*
+     * With interrupts off nothing else on this core can log, and the
+     * calling task cannot migrate, so each ring keeps a single producer.
+     */
+    save = save_and_disable_interrupts();
+    dc = &dlog_cores[get_core_num()];
+    now = time_us_32();
+
+    hdr[1] = get_core_num() ? DLOG_F_CORE1 : 0;
+    if (dc->resync) {
+        hdr[1] |= DLOG_F_ABS;
+        ts = now;
+    } else {
+        ts = now - dc->last_ts;
+    }
+    if (dc->lost > 0) {
+        hdr[1] |= DLOG_F_LOST;
+    }
+    q = dlog_varint(hdr + 2, id);
+    q = dlog_varint(q, ts);
+    if (dc->lost > 0) {
+        q = dlog_varint(q, dc->lost);
+    }
+    hlen = q - hdr;
+    hdr[0] = (uint8_t) (hlen - 1 + alen);
+
+    if (ringbuf_free(&dc->ring) >= hlen + alen) {
+        ringbuf_write(&dc->ring, hdr, hlen);
+        ringbuf_write(&dc->ring, args, alen);
+        dc->last_ts = now;
+        dc->lost = 0;
+        dc->resync = false;
+    } else {
+        dc->lost++;
+        dc->total_lost++;
+        dc->resync = true;
+    }
+
+    restore_interrupts(save);
+}
+
+static size_t dlog_cobs(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    uint8_t *code = dst;
+    uint8_t *p = dst + 1;
+    uint8_t c = 1;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (src[i] == 0x00) {
+            *code = c;
+            code = p++;
+            c = 1;
+        } else {
+            *p++ = src[i];
+            if (++c == 0xff) {
+                *code = c;
+                code = p++;
+                c = 1;
+            }
+        }
+    }
+
+    *code = c;
+    *p++ = 0x00;
+
+    return p - dst;
+}
+
+static int dlog_out_write(const uint8_t *buf, size_t len)
+{
+    int ret = (int) len;
+
+    switch (dlog_out) {
+    case DLOG_OUT_SERIAL0: ret = serial_write(0, buf, len); break;
+    case DLOG_OUT_SERIAL1: ret = serial_write(1, buf, len); break;
+    case DLOG_OUT_USBCDC:  ret = usbcdc_write(buf, len); break;
+    default: break;
+    }
+
+    return ret;
+}
+
+/*
+ * Put a whole frame on the wire. The transports take what they have room
+ * for, and half a frame would throw the decoder off until the next
+ * delimiter, so once a frame has started the rest follows as room
+ * frees up. False if none of it could go.
+ */
+static bool dlog_send(const uint8_t *frame, size_t len)
+{
+    size_t off = 0;
+    int n;
+
+    while (off < len) {
+        n = dlog_out_write(frame + off, len - off);
+        if (n > 0) {
+            off += n;
+        } else if (off == 0) {
+            return false;
+        } else {
+            vTaskDelay(1);
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Send one complete record from the ring, if there is one. The producer
+ * stores a record in two steps, so the consumer may see only its start.
+ * The record stays in the ring until its frame is out.
+ */
+static bool dlog_drain(struct dlog_core *dc)
+{
+    uint8_t rec[DLOG_REC_MAX];
+    uint8_t frame[DLOG_REC_MAX + 2];
+    const uint8_t *p1, *p2;
+    size_t l1, l2, used, len, n;
+
+    used = ringbuf_peek(&dc->ring, &p1, &l1, &p2, &l2);
+    if ((used == 0) || (used < 1 + (size_t) p1[0])) {
+        return false;
+    }
+
+    len = 1 + p1[0];
+    n = (len < l1) ? len : l1;
+    memcpy(rec, p1, n);
+    memcpy(rec + n, p2, len - n);
+    len = dlog_cobs(frame, rec + 1, len - 1);
+
+    if (!dlog_send(frame, len)) {
+        return false;
+    }
+    ringbuf_consume(&dc->ring, 1 + rec[0]);
+
+    return true;
+}
+
+static void dlog_task(void *arg)
+{
+    unsigned int i;
+    bool sent;
+
+    (void) arg;
+
+    for (;;) {
+        sent = false;
+        for (i = 0; i < NUM_CORES; i++) {
+            while (dlog_drain(&dlog_cores[i])) {
+                sent = true;
+            }
+        }
+
+        if (!sent) {
+            vTaskDelay(pdMS_TO_TICKS(DLOG_DRAIN_MS));
+        }
+    }
+}
+
+int dlog_init(enum dlog_output out)
+{
+    int ret = 0;
+    BaseType_t rc;
+
+    switch (out) {
+    case DLOG_OUT_SERIAL0:
+    case DLOG_OUT_SERIAL1:
+    case DLOG_OUT_USBCDC:
+        break;
+    default:
+        ret = -1;
+        goto done;
+        break;
+    }
+
+    dlog_out = out;
+
+    if (dlog_task_handle == NULL) {
+#if (PICO_PLAT_IO_CORE >= 0) && (configNUMBER_OF_CORES > 1) && \
+    (configUSE_CORE_AFFINITY == 1)
+        rc = xTaskCreateAffinitySet(dlog_task, "dlog", DLOG_TASK_STACK, NULL,
+                                    DLOG_TASK_PRIORITY,
+                                    1 << PICO_PLAT_IO_CORE,
+                                    &dlog_task_handle);
+#else
+        rc = xTaskCreate(dlog_task, "dlog", DLOG_TASK_STACK, NULL,
+                         DLOG_TASK_PRIORITY, &dlog_task_handle);
+#endif
+        if (rc != pdPASS) {
+            dlog_task_handle = NULL;
+            ret = -1;
+            goto done;
+        }
+    }
+
+done:
+
+    return ret;
+}
+
+void dlog_deinit(void)
+{
+    if (dlog_task_handle != NULL) {
+        vTaskDelete(dlog_task_handle);
+        dlog_task_handle = NULL;
+    }
+}
+
+unsigned long dlog_lost(void)
+{
+    unsigned long lost = 0;
+    unsigned int i;
+
+    for (i = 0; i < NUM_CORES; i++) {
+        lost += dlog_cores[i].total_lost;
+    }
+
+    return lost;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
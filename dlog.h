@@ -0,0 +1,170 @@
+/*
+ * dlog.h
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef DLOG_H
+#define DLOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pico-plat.h>
+
+#if defined(__cplusplus)
+#include <type_traits>
+#endif
+
+/*
+ * Deferred binary logging.
+ *
+ *   DLOG("adc ch%u = %d mV\n", ch, mv);
+ *
+ * The format string never leaves the build host: it is placed, together
+ * with a compile-time signature of the argument types, in the non-loaded
+ * ELF section .pplog_fmt, and its offset in that section becomes the
+ * string ID. A call only encodes the ID, a timestamp and the raw argument
+ * values into a per-core RAM ring; a low-priority task drains the rings
+ * as COBS frames to a UART or the USB CDC port, and tools/dlog-decode.py
+ * turns the frames back into text using the ELF.
+ *
+ * At most DLOG_MAX_ARGS arguments, of integer, floating point, string or
+ * pointer type, are supported per call. GCC does not honour the section
+ * attribute inside C++ template instances; the descriptor then lands in
+ * .rodata, which costs flash but still decodes.
+ */
+
+EXTERN_C_BEGIN
+
+#define DLOG_MAX_ARGS  8
+
+/* Argument type codes, 4 bits each in the signature, first arg lowest */
+#define DLOG_T_END  0
+#define DLOG_T_I32  1
+#define DLOG_T_U32  2
+#define DLOG_T_I64  3
+#define DLOG_T_U64  4
+#define DLOG_T_F64  5
+#define DLOG_T_STR  6
+#define DLOG_T_PTR  7
+
+/* Record flags (first byte of each frame) */
+#define DLOG_F_CORE1  0x01     // logged on core 1
+#define DLOG_F_ABS    0x02     // timestamp is absolute, not a delta
+#define DLOG_F_LOST   0x04     // varint count of lost records follows
+
+enum dlog_output {
+    DLOG_OUT_SERIAL0 = 0,
+    DLOG_OUT_SERIAL1,
+    DLOG_OUT_USBCDC,
+};
+
+extern int dlog_init(enum dlog_output out);
+extern void dlog_deinit(void);
+extern void dlog_write(uint32_t id, uint32_t sig, ...);
+extern unsigned long dlog_lost(void);
+
+EXTERN_C_END
+
+/*
+ * The section flags are overridden through the name: GCC emits
+ * '.section <name>,"a"' and everything from the '@' on is an assembler
+ * comment on ARM, which leaves a section that is not allocated and so
+ * takes no flash. Other targets may define DLOG_SECTION themselves.
+ */
+#ifndef DLOG_SECTION
+#define DLOG_SECTION  ".pplog_fmt,\"\",%progbits @"
+#endif
+
+#if defined(__cplusplus)
+
+template <typename T> constexpr uint32_t dlog_type(void)
+{
+    return std::is_floating_point<T>::value ? DLOG_T_F64 :
+        (std::is_same<T, char *>::value ||
+         std::is_same<T, const char *>::value) ? DLOG_T_STR :
+        (std::is_pointer<T>::value ||
+         std::is_null_pointer<T>::value) ? DLOG_T_PTR :
+        (sizeof(T) > 4) ?
+        (std::is_signed<T>::value ? DLOG_T_I64 : DLOG_T_U64) :
+        (std::is_signed<T>::value ? DLOG_T_I32 : DLOG_T_U32);
+}
+
+#define DLOG_T(x)  dlog_type<std::decay_t<decltype(x)>>()
+
+#else
+
+#define DLOG_T(x) _Generic((x),                                         \
+        _Bool: DLOG_T_U32,                                              \
+        char: DLOG_T_U32,                                               \
+        signed char: DLOG_T_I32,                                        \
+        unsigned char: DLOG_T_U32,                                      \
+        short: DLOG_T_I32,                                              \
+        unsigned short: DLOG_T_U32,                                     \
+        int: DLOG_T_I32,                                                \
+        unsigned int: DLOG_T_U32,                                       \
+        long: (sizeof(long) > 4 ? DLOG_T_I64 : DLOG_T_I32),             \
+        unsigned long: (sizeof(long) > 4 ? DLOG_T_U64 : DLOG_T_U32),    \
+        long long: DLOG_T_I64,                                          \
+        unsigned long long: DLOG_T_U64,                                 \
+        float: DLOG_T_F64,                                              \
+        double: DLOG_T_F64,                                             \
+        char *: DLOG_T_STR,                                             \
+        const char *: DLOG_T_STR,                                       \
+        default: DLOG_T_PTR)
+
+#endif
+
+#define DLOG_CAT_(a, b)  a##b
+#define DLOG_CAT(a, b)   DLOG_CAT_(a, b)
+#define DLOG_NARGS_(_f, _1, _2, _3, _4, _5, _6, _7, _8, n, ...)  n
+#define DLOG_NARGS(...)                                         \
+    DLOG_NARGS_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0, ~)
+
+#define DLOG_SIG0(f)  0
+#define DLOG_SIG1(f, a)                         \
+    ((uint32_t) DLOG_T(a))
+#define DLOG_SIG2(f, a, b)                                      \
+    (DLOG_SIG1(f, a) | ((uint32_t) DLOG_T(b) << 4))
+#define DLOG_SIG3(f, a, b, c)                                   \
+    (DLOG_SIG2(f, a, b) | ((uint32_t) DLOG_T(c) << 8))
+#define DLOG_SIG4(f, a, b, c, d)                                \
+    (DLOG_SIG3(f, a, b, c) | ((uint32_t) DLOG_T(d) << 12))
+#define DLOG_SIG5(f, a, b, c, d, e)                             \
+    (DLOG_SIG4(f, a, b, c, d) | ((uint32_t) DLOG_T(e) << 16))
+#define DLOG_SIG6(f, a, b, c, d, e, g)                          \
+    (DLOG_SIG5(f, a, b, c, d, e) | ((uint32_t) DLOG_T(g) << 20))
+#define DLOG_SIG7(f, a, b, c, d, e, g, h)                       \
+    (DLOG_SIG6(f, a, b, c, d, e, g) | ((uint32_t) DLOG_T(h) << 24))
+#define DLOG_SIG8(f, a, b, c, d, e, g, h, i)                            \
+    (DLOG_SIG7(f, a, b, c, d, e, g, h) | ((uint32_t) DLOG_T(i) << 28))
+#define DLOG_SIG(...)                                           \
+    DLOG_CAT(DLOG_SIG, DLOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+#define DLOG(...)                                                       \
+    do {                                                                \
+        static const struct {                                           \
+            uint32_t sig;                                               \
+            char fmt[sizeof(DLOG_FMT_(__VA_ARGS__, ~))];                \
+        } _dlog_desc __attribute__((section(DLOG_SECTION), used)) = {   \
+            DLOG_SIG(__VA_ARGS__),                                      \
+            DLOG_FMT_(__VA_ARGS__, ~),                                  \
+        };                                                              \
+        dlog_write((uint32_t) (uintptr_t) &_dlog_desc,                  \
+                   DLOG_SIG(__VA_ARGS__) DLOG_ARGS_(__VA_ARGS__));      \
+    } while (0)
+
+#define DLOG_FMT_(f, ...)  f
+#define DLOG_ARGS_(f, ...)  , ##__VA_ARGS__
+
+#endif  // DLOG_H
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
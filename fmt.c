@@ -0,0 +1,1098 @@
+/*
+ * fmt.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pico-plat.h>
+
+/*
+ * printf-style formatter that hands its output to a sink in chunks:
+ * literal text goes out as spans straight from the format string, and
+ * each conversion is built in a small buffer on the stack. There is no
+ * intermediate line buffer, so output length is unbounded and the
+ * formatter itself is reentrant.
+ */
+
+#define FMT_LEFT   0x01
+#define FMT_PLUS   0x02
+#define FMT_SPACE  0x04
+#define FMT_ALT    0x08
+#define FMT_ZERO   0x10
+#define FMT_UPPER  0x20
+#define FMT_PREC   0x40
+
+/* Float precisions up to this are built in a buffer, longer ones not */
+#define FMT_MAX_PREC  17
+
+enum fmt_length {
+    FMT_LEN_NONE = 0,
+    FMT_LEN_HH,
+    FMT_LEN_H,
+    FMT_LEN_L,
+    FMT_LEN_LL,
+    FMT_LEN_J,
+    FMT_LEN_Z,
+    FMT_LEN_T,
+    FMT_LEN_LD,
+};
+
+struct fmt_out {
+    fmt_sink_t sink;
+    void *ctx;
+    int count;
+};
+
+static void fmt_emit(struct fmt_out *out, const char *s, size_t len)
+{
+    if (len > 0) {
+        out->sink(out->ctx, s, len);
+        out->count += len;
+    }
+}
+
+static void fmt_pad(struct fmt_out *out, char c, int n)
+{
+    static const char spaces[16] = "                ";
+    static const char zeros[16] = "0000000000000000";
+
+    while (n > 0) {
+        int k = n > 16 ? 16 : n;
+
+        fmt_emit(out, c == '0' ? zeros : spaces, k);
+        n -= k;
+    }
+}
+
+/*
+ * Lay out one conversion: [spaces] prefix [zeros] body [spaces], where
+ * 'zeros' is the precision padding and FMT_ZERO widens it to 'width'.
+ */
+static int fmt_field_head(struct fmt_out *out, unsigned int flags,
+                          int width, const char *prefix, int plen,
+                          int zeros, int blen)
+{
+    int pad = width - (plen + zeros + blen);
+
+    if (pad < 0) {
+        pad = 0;
+    }
+
+    if ((flags & FMT_LEFT) == 0) {
+        if (flags & FMT_ZERO) {
+            zeros += pad;
+        } else {
+            fmt_pad(out, ' ', pad);
+        }
+        pad = 0;
+    }
+
+    fmt_emit(out, prefix, plen);
+    fmt_pad(out, '0', zeros);
+
+    /* What goes after the body */
+    return pad;
+}
+
+static void fmt_field(struct fmt_out *out, unsigned int flags, int width,
+                      const char *prefix, int plen, int zeros,
+                      const char *body, int blen)
+{
+    int pad = fmt_field_head(out, flags, width, prefix, plen, zeros, blen);
+
+    fmt_emit(out, body, blen);
+    fmt_pad(out, ' ', pad);
+}
+
+/* Convert backwards from 'end'; returns the number of digits */
+static int fmt_utoa(char *end, uint64_t v, unsigned int base, bool upper)
+{
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char *p = end;
+
+    /* Stay in 32-bit arithmetic when possible; 64-bit division is slow */
+    while (v > UINT32_MAX) {
+        *--p = digits[v % base];
+        v /= base;
+    }
+
+    uint32_t v32 = (uint32_t) v;
+    do {
+        *--p = digits[v32 % base];
+        v32 /= base;
+    } while (v32 != 0);
+
+    return end - p;
+}
+
+static void fmt_integer(struct fmt_out *out, uint64_t v, bool neg,
+                        unsigned int base, unsigned int flags,
+                        int width, int prec)
+{
+    char buf[24];
+    char *end = buf + sizeof(buf);
+    char prefix[3];
+    int plen = 0;
+    int blen = 0;
+    int zeros = 0;
+
+    if (((flags & FMT_PREC) == 0) || (prec != 0) || (v != 0)) {
+        blen = fmt_utoa(end, v, base, (flags & FMT_UPPER) != 0);
+    }
+
+    if (neg) {
+        prefix[plen++] = '-';
+    } else if (flags & FMT_PLUS) {
+        prefix[plen++] = '+';
+    } else if (flags & FMT_SPACE) {
+        prefix[plen++] = ' ';
+    }
+
+    if ((flags & FMT_ALT) && (base == 16) && (v != 0)) {
+        prefix[plen++] = '0';
+        prefix[plen++] = (flags & FMT_UPPER) ? 'X' : 'x';
+    }
+
+    if (flags & FMT_PREC) {
+        flags &= ~FMT_ZERO;
+        if (prec > blen) {
+            zeros = prec - blen;
+        }
+    }
+
+    if ((flags & FMT_ALT) && (base == 8) && (zeros == 0) &&
+        ((blen == 0) || (end[-blen] != '0'))) {
+        zeros = 1;
+    }
+
+    fmt_field(out, flags, width, prefix, plen, zeros, end - blen, blen);
+}
+
+static int fmt_digits(char *p, uint64_t v, int ndigits)
+{
+    char tmp[24];
+    int n = fmt_utoa(tmp + sizeof(tmp), v, 10, false);
+    int i = 0;
+
+    for (; i < ndigits - n; i++) {
+        p[i] = '0';
+    }
+    memcpy(p + i, tmp + sizeof(tmp) - n, n);
+
+    return i + n;
+}
+
+static int fmt_strip_zeros(char *buf, int len)
+{
+    if (memchr(buf, '.', len) == NULL) {
+        return len;
+    }
+
+    while (buf[len - 1] == '0') {
+        len--;
+    }
+    if (buf[len - 1] == '.') {
+        len--;
+    }
+
+    return len;
+}
+
+/*
+ * Exact decimal expansion of a finite double, read out a digit at a
+ * time: the integer part's digits, then the fraction's. A double is
+ * m * 2^e, so both are finite; the fraction is kept as w / 2^k, w < 2^k,
+ * in 32-bit words, and each digit multiplies it by ten and takes what
+ * spills over bit k. Rounding then looks at the actual digits that
+ * follow, which is what makes it agree with C99 (and newlib), ties going
+ * to even.
+ */
+struct fmt_num {
+    const char *idig;
+    int ilen;
+    uint32_t *w;
+    int k;
+    int n;
+};
+
+/*
+ * Words for w: for the fraction, k / 32 + 2 of them with k up to 1074;
+ * for an integer part up to 2^1024, which is built in them first, 32.
+ */
+#define FMT_BIG_WORDS   35
+
+/* Digits of the largest double, and a %f of it */
+#define FMT_BIG_DIGITS  309
+#define FMT_BIG_BUF     (FMT_BIG_DIGITS + FMT_MAX_PREC + 8)
+
+/*
+ * Set up 'num' for m * 2^e with the integer part's digits at the end of
+ * 'buf', where fmt_fixed() can build its output from the start without
+ * catching up with them. 'w' needs to have FMT_BIG_WORDS words unless
+ * -60 <= e <= 11, when 3 are enough.
+ */
+static void fmt_num_init(struct fmt_num *num, uint64_t m, int e,
+                         char *buf, size_t size, uint32_t *w)
+{
+    char *end = buf + size;
+    uint32_t rem;
+    uint64_t cur;
+    int i, q, sh, nw;
+
+    num->w = w;
+    num->k = 0;
+    num->n = 0;
+    num->ilen = 0;
+
+    if (e > 11) {
+        /* m << e no longer fits in 64 bits: divide it down by 10^9 */
+        q = e / 32;
+        sh = e % 32;
+        nw = q + 3;
+        memset(w, 0, nw * sizeof(uint32_t));
+        w[q] = (uint32_t) (m << sh);
+        w[q + 1] = (uint32_t) ((sh > 0) ? (m >> (32 - sh)) : (m >> 32));
+        w[q + 2] = (sh > 11) ? (uint32_t) (m >> (64 - sh)) : 0;
+
+        while (nw > 0) {
+            rem = 0;
+            for (i = nw - 1; i >= 0; i--) {
+                cur = ((uint64_t) rem << 32) | w[i];
+                w[i] = (uint32_t) (cur / 1000000000);
+                rem = (uint32_t) (cur % 1000000000);
+            }
+            while ((nw > 0) && (w[nw - 1] == 0)) {
+                nw--;
+            }
+            if (nw > 0) {
+                end -= 9;
+                fmt_digits(end, rem, 9);
+                num->ilen += 9;
+            } else {
+                num->ilen += fmt_utoa(end, rem, 10, false);
+            }
+        }
+        num->idig = buf + size - num->ilen;
+    } else if (e >= 0) {
+        if (m != 0) {
+            num->ilen = fmt_utoa(end, m << e, 10, false);
+        }
+        num->idig = end - num->ilen;
+    } else {
+        num->k = -e;
+        if (num->k < 53) {
+            if ((m >> num->k) != 0) {
+                num->ilen = fmt_utoa(end, m >> num->k, 10, false);
+            }
+            m &= ((uint64_t) 1 << num->k) - 1;
+        }
+        num->idig = end - num->ilen;
+        num->n = num->k / 32 + 2;
+        memset(w, 0, num->n * sizeof(uint32_t));
+        w[0] = (uint32_t) m;
+        w[1] = (uint32_t) (m >> 32);
+    }
+}
+
+static int fmt_num_next(struct fmt_num *num)
+{
+    uint32_t carry = 0, d;
+    uint64_t t;
+    int i, q, r;
+
+    if (num->ilen > 0) {
+        num->ilen--;
+        return *num->idig++ - '0';
+    }
+    if (num->n == 0) {
+        return 0;
+    }
+
+    for (i = 0; i < num->n; i++) {
+        t = (uint64_t) num->w[i] * 10 + carry;
+        num->w[i] = (uint32_t) t;
+        carry = (uint32_t) (t >> 32);
+    }
+
+    q = num->k / 32;
+    r = num->k % 32;
+    d = num->w[q] >> r;
+    num->w[q] &= ((uint32_t) 1 << r) - 1;
+    if (r > 28) {
+        d |= num->w[q + 1] << (32 - r);
+        num->w[q + 1] = 0;
+    }
+
+    return d;
+}
+
+/* Whether anything but zeros is left */
+static bool fmt_num_rest(const struct fmt_num *num)
+{
+    int i;
+
+    for (i = 0; i < num->ilen; i++) {
+        if (num->idig[i] != '0') {
+            return true;
+        }
+    }
+    for (i = 0; i < num->n; i++) {
+        if (num->w[i] != 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Round the 'n' digits in 'd' by what follows them in 'num'; true if
+ * they were all nines and are now zeros, with a 1 to go in front.
+ */
+static bool fmt_round(char *d, int n, struct fmt_num *num)
+{
+    int r = fmt_num_next(num);
+    int i;
+
+    if ((r < 5) ||
+        ((r == 5) && !fmt_num_rest(num) &&
+         ((n == 0) || (((d[n - 1] - '0') & 1) == 0)))) {
+        return false;
+    }
+
+    for (i = n - 1; i >= 0; i--) {
+        if (d[i] != '9') {
+            d[i]++;
+            return false;
+        }
+        d[i] = '0';
+    }
+
+    return true;
+}
+
+/* %f body: the integer part, then 'prec' decimals */
+static int fmt_fixed(char *buf, struct fmt_num *num, int prec, bool alt)
+{
+    char *d = buf + 1;
+    int ilen = (num->ilen > 0) ? num->ilen : 1;
+    int n = 0;
+    int len;
+
+    if (num->ilen == 0) {
+        d[n++] = '0';
+    }
+    while (n < ilen + prec) {
+        d[n++] = '0' + fmt_num_next(num);
+    }
+    if (fmt_round(d, n, num)) {
+        *--d = '1';
+        ilen++;
+    }
+
+    /* Make room for the point */
+    memmove(buf + ilen + 1, d + ilen, prec);
+    memmove(buf, d, ilen);
+    len = ilen;
+    if ((prec > 0) || alt) {
+        buf[len++] = '.';
+    }
+
+    return len + prec;
+}
+
+/*
+ * Read up to the first significant digit and return it, with its
+ * exponent in 'exp'; a zero gives 0 and 0, and zeros after it.
+ */
+static int fmt_num_lead(struct fmt_num *num, int *exp)
+{
+    int c;
+
+    if (!fmt_num_rest(num)) {
+        *exp = 0;
+        return 0;
+    }
+
+    if (num->ilen > 0) {
+        *exp = num->ilen - 1;
+        return fmt_num_next(num);
+    }
+
+    *exp = -1;
+    while ((c = fmt_num_next(num)) == 0) {
+        (*exp)--;
+    }
+
+    return c;
+}
+
+/* The first 'ndig' significant digits, rounded; returns the exponent */
+static int fmt_sci(char *d, int ndig, struct fmt_num *num)
+{
+    int exp;
+    int n = 0;
+
+    d[n++] = '0' + fmt_num_lead(num, &exp);
+    while (n < ndig) {
+        d[n++] = '0' + fmt_num_next(num);
+    }
+    if (fmt_round(d, n, num)) {
+        d[0] = '1';
+        exp++;
+    }
+
+    return exp;
+}
+
+/* The "e+dd" that ends %e */
+static int fmt_exp_tail(char *buf, int exp, unsigned int flags)
+{
+    int len = 0;
+
+    buf[len++] = (flags & FMT_UPPER) ? 'E' : 'e';
+    buf[len++] = exp < 0 ? '-' : '+';
+
+    return len + fmt_digits(buf + len, exp < 0 ? -exp : exp, 2);
+}
+
+static int fmt_exp(char *buf, const char *d, int ndig, int exp,
+                   unsigned int flags, bool strip)
+{
+    int len = 0;
+
+    buf[len++] = d[0];
+    if ((ndig > 1) || (flags & FMT_ALT)) {
+        buf[len++] = '.';
+    }
+    memcpy(buf + len, d + 1, ndig - 1);
+    len += ndig - 1;
+    if (strip) {
+        len = fmt_strip_zeros(buf, len);
+    }
+
+
+    return len + fmt_exp_tail(buf + len, exp, flags);
+}
+
+/* %g in %f style, from the significant digits; -4 <= exp < ndig */
+static int fmt_gfixed(char *buf, const char *d, int ndig, int exp,
+                      bool alt)
+{
+    int len = 0;
+
+    if (exp < 0) {
+        buf[len++] = '0';
+        buf[len++] = '.';
+        memset(buf + len, '0', -exp - 1);
+        len += -exp - 1;
+        memcpy(buf + len, d, ndig);
+        len += ndig;
+    } else {
+        memcpy(buf, d, exp + 1);
+        len = exp + 1;
+        if ((ndig > exp + 1) || alt) {
+            buf[len++] = '.';
+        }
+        memcpy(buf + len, d + exp + 1, ndig - exp - 1);
+        len += ndig - exp - 1;
+    }
+
+    return len;
+}
+
+/* Convert m * 2^e, with 'buf' and 'w' as fmt_num_init() needs them */
+static void fmt_float_conv(struct fmt_out *out, uint64_t m, int e,
+                           char conv, unsigned int flags, int width,
+                           int prec, const char *prefix, int plen,
+                           char *buf, size_t size, uint32_t *w)
+{
+    struct fmt_num num;
+    char d[FMT_MAX_PREC + 1];
+    int blen, exp, p;
+    bool strip;
+
+    fmt_num_init(&num, m, e, buf, size, w);
+
+    switch (conv) {
+    case 'f':
+    case 'F':
+        blen = fmt_fixed(buf, &num, prec, (flags & FMT_ALT) != 0);
+        break;
+    case 'e':
+    case 'E':
+        exp = fmt_sci(d, prec + 1, &num);
+        blen = fmt_exp(buf, d, prec + 1, exp, flags, false);
+        break;
+    default:
+        p = (prec == 0) ? 1 : prec;
+        strip = (flags & FMT_ALT) == 0;
+        exp = fmt_sci(d, p, &num);
+        if ((exp < p) && (exp >= -4)) {
+            blen = fmt_gfixed(buf, d, p, exp, !strip);
+            if (strip) {
+                blen = fmt_strip_zeros(buf, blen);
+            }
+        } else {
+            blen = fmt_exp(buf, d, p, exp, flags, strip);
+        }
+        break;
+    }
+
+    fmt_field(out, flags, width, prefix, plen, 0, buf, blen);
+}
+
+/*
+ * Doubles of 2^64 and up, and below about 2^-8, take the wide buffers:
+ * kept out of fmt_float() so that the usual conversions stay at their
+ * few dozen bytes of stack.
+ */
+static void __attribute__((noinline))
+fmt_float_big(struct fmt_out *out, uint64_t m, int e, char conv,
+              unsigned int flags, int width, int prec,
+              const char *prefix, int plen)
+{
+    char buf[FMT_BIG_BUF];
+    uint32_t w[FMT_BIG_WORDS];
+
+    fmt_float_conv(out, m, e, conv, flags, width, prec, prefix, plen,
+                   buf, sizeof(buf), w);
+}
+
+/*
+ * Precisions past FMT_MAX_PREC need more digits than the buffers hold,
+ * so the number is read out twice. The first pass sees how the last
+ * digit rounds and how far back a carry would run, which settles the
+ * length; the second writes the digits out as they come, through a small
+ * buffer, so that the stack stays that of fmt_float_big().
+ */
+struct fmt_long {
+    int last9;      /* last digit that is not a 9, or -1 */
+    int lastnz;     /* last that is not a 0 once rounded, or -1 */
+    bool up;        /* whether it rounds up */
+};
+
+struct fmt_chunk {
+    struct fmt_out *out;
+    int len;
+    char buf[32];
+};
+
+static void fmt_chunk_put(struct fmt_chunk *ch, char c)
+{
+    if (ch->len == (int) sizeof(ch->buf)) {
+        fmt_emit(ch->out, ch->buf, ch->len);
+        ch->len = 0;
+    }
+    ch->buf[ch->len++] = c;
+}
+
+/* The first digit: %f's leftmost, or %e's and %g's first significant */
+static int fmt_long_first(struct fmt_num *num, bool fixed, int *exp)
+{
+    if (fixed) {
+        *exp = 0;
+        return (num->ilen > 0) ? fmt_num_next(num) : 0;
+    }
+
+    return fmt_num_lead(num, exp);
+}
+
+/* The first pass, over the 'n' digits from 'c' on */
+static void fmt_long_scan(struct fmt_long *sc, struct fmt_num *num,
+                          int c, int n)
+{
+    int i, r;
+
+    sc->last9 = -1;
+    sc->lastnz = -1;
+    for (i = 0; i < n; i++) {
+        if (i > 0) {
+            c = fmt_num_next(num);
+        }
+        if (c != 9) {
+            sc->last9 = i;
+        }
+        if (c != 0) {
+            sc->lastnz = i;
+        }
+    }
+
+    r = fmt_num_next(num);
+    sc->up = (r > 5) || ((r == 5) && (fmt_num_rest(num) || (c & 1)));
+    if (sc->up) {
+        sc->lastnz = (sc->last9 >= 0) ? sc->last9 : 0;
+    }
+}
+
+static void __attribute__((noinline))
+fmt_float_long(struct fmt_out *out, uint64_t m, int e, char conv,
+               unsigned int flags, int width, int prec,
+               const char *prefix, int plen)
+{
+    char buf[FMT_BIG_DIGITS + 8];
+    uint32_t w[FMT_BIG_WORDS];
+    char tail[8];
+    struct fmt_num num;
+    struct fmt_long sc;
+    struct fmt_chunk ch;
+    bool fixed = (conv == 'f') || (conv == 'F');
+    bool alt = (flags & FMT_ALT) != 0;
+    bool carry;
+    int first, exp, ilen, n, ndig, dot, c, j, pad;
+    int lead = -1, tlen = 0;
+
+    fmt_num_init(&num, m, e, buf, sizeof(buf), w);
+    ilen = (num.ilen > 0) ? num.ilen : 1;
+    first = fmt_long_first(&num, fixed, &exp);
+
+    /* Digits to read, then to write with a point after 'dot' of them */
+    if (fixed) {
+        n = ilen + prec;
+        fmt_long_scan(&sc, &num, first, n);
+        carry = sc.up && (sc.last9 < 0);
+        ndig = n + carry;
+        dot = ((prec > 0) || alt) ? ilen + carry : -1;
+    } else if ((conv == 'e') || (conv == 'E')) {
+        n = prec + 1;
+        fmt_long_scan(&sc, &num, first, n);
+        carry = sc.up && (sc.last9 < 0);
+        exp += carry;
+        ndig = n;
+        dot = ((n > 1) || alt) ? 1 : -1;
+        tlen = fmt_exp_tail(tail, exp, flags);
+    } else {
+        n = prec;
+        fmt_long_scan(&sc, &num, first, n);
+        carry = sc.up && (sc.last9 < 0);
+        exp += carry;
+        ndig = alt ? n : ((sc.lastnz >= 0) ? sc.lastnz + 1 : 1);
+        if ((exp < n) && (exp >= -4)) {
+            if (exp < 0) {
+                /* "0.", then the zeros before the first digit */
+                lead = -exp - 1;
+                dot = -1;
+            } else {
+                if (ndig < exp + 1) {
+                    ndig = exp + 1;
+                }
+                dot = ((ndig > exp + 1) || alt) ? exp + 1 : -1;
+            }
+        } else {
+            dot = ((ndig > 1) || alt) ? 1 : -1;
+            tlen = fmt_exp_tail(tail, exp, flags);
+        }
+    }
+
+    pad = fmt_field_head(out, flags, width, prefix, plen, 0,
+                         ((lead >= 0) ? lead + 2 : 0) + ndig +
+                         (dot >= 0) + tlen);
+    if (lead >= 0) {
+        fmt_emit(out, "0.", 2);
+        fmt_pad(out, '0', lead);
+    }
+
+    if (!carry) {
+        fmt_num_init(&num, m, e, buf, sizeof(buf), w);
+        first = fmt_long_first(&num, fixed, &exp);
+    }
+
+    ch.out = out;
+    ch.len = 0;
+    for (j = 0; j < ndig; j++) {
+        if (carry) {
+            /* All nines, rounded up */
+            c = (j == 0) ? 1 : 0;
+        } else {
+            c = (j == 0) ? first : fmt_num_next(&num);
+            if (sc.up && (j > sc.last9)) {
+                c = 0;
+            } else if (sc.up && (j == sc.last9)) {
+                c++;
+            }
+        }
+        fmt_chunk_put(&ch, '0' + c);
+        if (j + 1 == dot) {
+            fmt_chunk_put(&ch, '.');
+        }
+    }
+    fmt_emit(out, ch.buf, ch.len);
+
+    fmt_emit(out, tail, tlen);
+    fmt_pad(out, ' ', pad);
+}
+
+/*
+ * %a: the significand in hex with one digit before the point, then the
+ * binary exponent. Without a precision, as many digits as it takes to be
+ * exact; with one, rounded to it, ties to even.
+ */
+static void fmt_float_hex(struct fmt_out *out, uint64_t bits,
+                          unsigned int flags, int width, int prec,
+                          char *prefix, int plen)
+{
+    const char *digits = (flags & FMT_UPPER) ?
+        "0123456789ABCDEF" : "0123456789abcdef";
+    char buf[16];
+    char tail[8];
+    uint64_t m = bits & (((uint64_t) 1 << 52) - 1);
+    uint64_t rem, half;
+    int e = (int) (bits >> 52) & 0x7ff;
+    int ndig = 13, zeros = 0, len = 0, tlen = 0;
+    int i, sh, pad;
+
+    if (e == 0) {
+        e = (m == 0) ? 0 : -1022;
+    } else {
+        m |= (uint64_t) 1 << 52;
+        e -= 1023;
+    }
+
+    if ((flags & FMT_PREC) == 0) {
+        while ((ndig > 0) && ((m & 0xf) == 0)) {
+            m >>= 4;
+            ndig--;
+        }
+    } else if (prec < ndig) {
+        /* A carry can make the leading digit a 2, as in glibc */
+        sh = (ndig - prec) * 4;
+        rem = m & (((uint64_t) 1 << sh) - 1);
+        half = (uint64_t) 1 << (sh - 1);
+        m >>= sh;
+        if ((rem > half) || ((rem == half) && (m & 1))) {
+            m++;
+        }
+        ndig = prec;
+    } else {
+        zeros = prec - ndig;
+    }
+
+    prefix[plen++] = '0';
+    prefix[plen++] = (flags & FMT_UPPER) ? 'X' : 'x';
+
+    buf[len++] = digits[m >> (ndig * 4)];
+    if ((ndig > 0) || (zeros > 0) || (flags & FMT_ALT)) {
+        buf[len++] = '.';
+    }
+    for (i = ndig - 1; i >= 0; i--) {
+        buf[len++] = digits[(m >> (i * 4)) & 0xf];
+    }
+
+    tail[tlen++] = (flags & FMT_UPPER) ? 'P' : 'p';
+    tail[tlen++] = (e < 0) ? '-' : '+';
+    tlen += fmt_digits(tail + tlen, (e < 0) ? -e : e, 1);
+
+    pad = fmt_field_head(out, flags, width, prefix, plen, 0,
+                         len + zeros + tlen);
+    fmt_emit(out, buf, len);
+    fmt_pad(out, '0', zeros);
+    fmt_emit(out, tail, tlen);
+    fmt_pad(out, ' ', pad);
+}
+
+static void fmt_float(struct fmt_out *out, double v, char conv,
+                      unsigned int flags, int width, int prec)
+{
+    char buf[48];
+    uint32_t w[3];
+    char prefix[3];
+    int plen = 0;
+    bool upper = (flags & FMT_UPPER) != 0;
+    uint64_t bits, m;
+    int e;
+
+    if (__builtin_signbit(v)) {
+        prefix[plen++] = '-';
+        v = -v;
+    } else if (flags & FMT_PLUS) {
+        prefix[plen++] = '+';
+    } else if (flags & FMT_SPACE) {
+        prefix[plen++] = ' ';
+    }
+
+    if ((flags & FMT_PREC) == 0) {
+        prec = 6;
+    }
+
+    if (__builtin_isnan(v)) {
+        fmt_field(out, flags & ~FMT_ZERO, width, prefix, plen, 0,
+                  upper ? "NAN" : "nan", 3);
+        return;
+    }
+    if (__builtin_isinf(v)) {
+        fmt_field(out, flags & ~FMT_ZERO, width, prefix, plen, 0,
+                  upper ? "INF" : "inf", 3);
+        return;
+    }
+
+    memcpy(&bits, &v, sizeof(bits));
+    if ((conv == 'a') || (conv == 'A')) {
+        fmt_float_hex(out, bits, flags, width, prec, prefix, plen);
+        return;
+    }
+
+    m = bits & (((uint64_t) 1 << 52) - 1);
+    e = (int) (bits >> 52) & 0x7ff;
+    if (e == 0) {
+        e = (m == 0) ? 0 : -1074;
+    } else {
+        m |= (uint64_t) 1 << 52;
+        e -= 1075;
+    }
+
+    if (prec > FMT_MAX_PREC) {
+        fmt_float_long(out, m, e, conv, flags, width, prec, prefix, plen);
+    } else if ((e >= -60) && (e <= 11)) {
+        fmt_float_conv(out, m, e, conv, flags, width, prec, prefix, plen,
+                       buf, sizeof(buf), w);
+    } else {
+        fmt_float_big(out, m, e, conv, flags, width, prec, prefix, plen);
+    }
+}
+
+int fmt_vprintf(fmt_sink_t sink, void *ctx, const char *format, va_list ap)
+{
+    struct fmt_out out = {
+        .sink = sink,
+        .ctx = ctx,
+        .count = 0,
+    };
+    const char *p = format;
+
+    while (*p != '\0') {
+        const char *spec;
+        unsigned int flags = 0;
+        int width = 0;
+        int prec = 0;
+        enum fmt_length length = FMT_LEN_NONE;
+        unsigned int base = 10;
+        uint64_t uv;
+        int64_t sv;
+
+        /* Literal text up to the next conversion goes out as one span */
+        spec = strchr(p, '%');
+        if (spec == NULL) {
+            fmt_emit(&out, p, strlen(p));
+            break;
+        }
+        fmt_emit(&out, p, spec - p);
+        p = spec + 1;
+
+        for (;; p++) {
+            switch (*p) {
+            case '-': flags |= FMT_LEFT; continue;
+            case '+': flags |= FMT_PLUS; continue;
+            case ' ': flags |= FMT_SPACE; continue;
+            case '#': flags |= FMT_ALT; continue;
+            case '0': flags |= FMT_ZERO; continue;
+            default: break;
+            }
+            break;
+        }
+
+        if (*p == '*') {
+            width = va_arg(ap, int);
+            if (width < 0) {
+                flags |= FMT_LEFT;
+                width = -width;
+            }
+            p++;
+        } else {
+            while ((*p >= '0') && (*p <= '9')) {
+                width = width * 10 + (*p - '0');
+                p++;
+            }
+        }
+
+        if (*p == '.') {
+            flags |= FMT_PREC;
+            p++;
+            if (*p == '*') {
+                prec = va_arg(ap, int);
+                if (prec < 0) {
+                    flags &= ~FMT_PREC;
+                    prec = 0;
+                }
+                p++;
+            } else {
+                while ((*p >= '0') && (*p <= '9')) {
+                    prec = prec * 10 + (*p - '0');
+                    p++;
+                }
+            }
+        }
+
+        switch (*p) {
+        case 'h':
+            p++;
+            length = FMT_LEN_H;
+            if (*p == 'h') {
+                p++;
+                length = FMT_LEN_HH;
+            }
+            break;
+        case 'l':
+            p++;
+            length = FMT_LEN_L;
+            if (*p == 'l') {
+                p++;
+                length = FMT_LEN_LL;
+            }
+            break;
+        case 'j': p++; length = FMT_LEN_J; break;
+        case 'z': p++; length = FMT_LEN_Z; break;
+        case 't': p++; length = FMT_LEN_T; break;
+        case 'L': p++; length = FMT_LEN_LD; break;
+        default: break;
+        }
+
+        if (flags & FMT_LEFT) {
+            flags &= ~FMT_ZERO;
+        }
+
+        switch (*p) {
+        case 'd':
+        case 'i':
+            switch (length) {
+            case FMT_LEN_HH: sv = (signed char) va_arg(ap, int); break;
+            case FMT_LEN_H:  sv = (short) va_arg(ap, int); break;
+            case FMT_LEN_L:  sv = va_arg(ap, long); break;
+            case FMT_LEN_LL: sv = va_arg(ap, long long); break;
+            case FMT_LEN_J:  sv = va_arg(ap, intmax_t); break;
+            case FMT_LEN_Z:  sv = va_arg(ap, ptrdiff_t); break;
+            case FMT_LEN_T:  sv = va_arg(ap, ptrdiff_t); break;
+            default:         sv = va_arg(ap, int); break;
+            }
+            uv = sv < 0 ? (uint64_t) 0 - (uint64_t) sv : (uint64_t) sv;
+            fmt_integer(&out, uv, sv < 0, 10, flags, width, prec);
+            break;
+        case 'X':
+            flags |= FMT_UPPER;
+            // fall through
+        case 'x':
+            base = 16;
+            // fall through
+        case 'o':
+            if (*p == 'o') {
+                base = 8;
+            }
+            // fall through
+        case 'u':
+            flags &= ~(FMT_PLUS | FMT_SPACE);
+            switch (length) {
+            case FMT_LEN_HH: uv = (unsigned char) va_arg(ap, unsigned int);
+                break;
+            case FMT_LEN_H:  uv = (unsigned short) va_arg(ap, unsigned int);
+                break;
+            case FMT_LEN_L:  uv = va_arg(ap, unsigned long); break;
+            case FMT_LEN_LL: uv = va_arg(ap, unsigned long long); break;
+            case FMT_LEN_J:  uv = va_arg(ap, uintmax_t); break;
+            case FMT_LEN_Z:  uv = va_arg(ap, size_t); break;
+            case FMT_LEN_T:  uv = va_arg(ap, size_t); break;
+            default:         uv = va_arg(ap, unsigned int); break;
+            }
+            fmt_integer(&out, uv, false, base, flags, width, prec);
+            break;
+        case 'p':
+            uv = (uintptr_t) va_arg(ap, void *);
+            flags |= FMT_ALT;
+            flags &= ~(FMT_PLUS | FMT_SPACE);
+            fmt_integer(&out, uv, false, 16, flags, width, prec);
+            break;
+        case 'c': {
+            char c = (char) va_arg(ap, int);
+
+            fmt_field(&out, flags & ~FMT_ZERO, width, NULL, 0, 0, &c, 1);
+            break;
+        }
+        case 's': {
+            const char *s = va_arg(ap, const char *);
+            size_t len;
+
+            if (s == NULL) {
+                s = "(null)";
+            }
+            if (flags & FMT_PREC) {
+                len = strnlen(s, prec);
+            } else {
+                len = strlen(s);
+            }
+            fmt_field(&out, flags & ~FMT_ZERO, width, NULL, 0, 0, s, len);
+            break;
+        }
+        case 'F':
+        case 'E':
+        case 'G':
+        case 'A':
+            flags |= FMT_UPPER;
+            // fall through
+        case 'f':
+        case 'e':
+        case 'g':
+        case 'a': {
+            double v;
+
+            if (length == FMT_LEN_LD) {
+                v = (double) va_arg(ap, long double);
+            } else {
+                v = va_arg(ap, double);
+            }
+            fmt_float(&out, v, *p, flags, width, prec);
+            break;
+        }
+        case 'n':
+            switch (length) {
+            case FMT_LEN_HH: *va_arg(ap, signed char *) = out.count; break;
+            case FMT_LEN_H:  *va_arg(ap, short *) = out.count; break;
+            case FMT_LEN_L:  *va_arg(ap, long *) = out.count; break;
+            case FMT_LEN_LL: *va_arg(ap, long long *) = out.count; break;
+            default:         *va_arg(ap, int *) = out.count; break;
+            }
+            break;
+        case '%':
+            fmt_emit(&out, "%", 1);
+            break;
+        case '\0':
+            fmt_emit(&out, spec, p - spec);
+            continue;
+        default:
+            /*
+             * Not a C99 conversion, so there is no telling what argument
+             * it takes: pass it through untouched
+             */
+            fmt_emit(&out, spec, p - spec + 1);
+            break;
+        }
+
+        p++;
+    }
+
+    return out.count;
+}
+
+int fmt_printf(fmt_sink_t sink, void *ctx, const char *format, ...)
+{
+    int ret;
+    va_list ap;
+
+    va_start(ap, format);
+    ret = fmt_vprintf(sink, ctx, format, ap);
+    va_end(ap);
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,122 @@
+/*
+ * heaptrace-new.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <cstdint>
+#include <cstdarg>
+#include <cstdlib>
+#include <new>
+#include <pico-plat.h>
+
+#if PICO_PLAT_HEAP_TRACE
+
+/*
+ * new and delete get to _malloc_r() and _free_r() through malloc() and
+ * free(), and behind the SDK's pico_malloc wrapper the return address
+ * seen there is the wrapper's. These leave their own caller with
+ * heaptrace.c on the way, so that the heap command shows the code doing
+ * the allocating. Weak, so that a replacement of the application's or
+ * the SDK's own takes precedence.
+ */
+
+extern "C" void heaptrace_set_caller(void *pc);
+
+static void *heaptrace_new(std::size_t size, void *pc, bool nothrow)
+{
+    std::new_handler handler;
+    void *ptr;
+
+    if (size == 0) {
+        size = 1;
+    }
+
+    for (;;) {
+        heaptrace_set_caller(pc);
+        ptr = std::malloc(size);
+        if (ptr != NULL) {
+            break;
+        }
+        handler = std::get_new_handler();
+        if (handler == nullptr) {
+            if (nothrow) {
+                break;
+            }
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+
+    return ptr;
+}
+
+static void heaptrace_delete(void *ptr, void *pc)
+{
+    if (ptr != NULL) {
+        heaptrace_set_caller(pc);
+        std::free(ptr);
+    }
+}
+
+__attribute__((weak)) void *operator new(std::size_t size)
+{
+    return heaptrace_new(size, __builtin_return_address(0), false);
+}
+
+__attribute__((weak)) void *operator new[](std::size_t size)
+{
+    return heaptrace_new(size, __builtin_return_address(0), false);
+}
+
+__attribute__((weak)) void *operator new(std::size_t size,
+                                         const std::nothrow_t &) noexcept
+{
+    try {
+        return heaptrace_new(size, __builtin_return_address(0), true);
+    } catch (...) {
+        return NULL;
+    }
+}
+
+__attribute__((weak)) void *operator new[](std::size_t size,
+                                           const std::nothrow_t &) noexcept
+{
+    try {
+        return heaptrace_new(size, __builtin_return_address(0), true);
+    } catch (...) {
+        return NULL;
+    }
+}
+
+__attribute__((weak)) void operator delete(void *ptr) noexcept
+{
+    heaptrace_delete(ptr, __builtin_return_address(0));
+}
+
+__attribute__((weak)) void operator delete[](void *ptr) noexcept
+{
+    heaptrace_delete(ptr, __builtin_return_address(0));
+}
+
+__attribute__((weak)) void operator delete(void *ptr, std::size_t) noexcept
+{
+    heaptrace_delete(ptr, __builtin_return_address(0));
+}
+
+__attribute__((weak)) void operator delete[](void *ptr, std::size_t) noexcept
+{
+    heaptrace_delete(ptr, __builtin_return_address(0));
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
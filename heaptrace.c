@@ -0,0 +1,499 @@
+/*
+ * heaptrace.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <malloc.h>
+#include <reent.h>
+#include <unistd.h>
+#include <hardware/sync.h>
+#include <hardware/timer.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <pico-plat.h>
+
+/* Slot 0 is for allocations made outside any task, the last for overflow */
+#ifndef HEAPTRACE_TASKS_MAX
+#define HEAPTRACE_TASKS_MAX  16
+#endif
+
+/* Recent allocations and frees kept, a power of two; 0 for none */
+#ifndef HEAPTRACE_RING_SIZE
+#define HEAPTRACE_RING_SIZE  32
+#endif
+
+#if ((HEAPTRACE_RING_SIZE & (HEAPTRACE_RING_SIZE - 1)) != 0)
+#error "HEAPTRACE_RING_SIZE must be a power of two"
+#endif
+
+#if PICO_PLAT_HEAP_TRACE
+
+extern void *__real__malloc_r(struct _reent *r, size_t size);
+extern void __real__free_r(struct _reent *r, void *ptr);
+
+/*
+ * The allocator's own state, to find the free blocks with. Weak, as only
+ * one of them exists: newlib's dlmalloc keeps the top chunk in av_[2],
+ * newlib-nano a list of free chunks.
+ */
+extern char *__malloc_sbrk_base __attribute__((weak));
+extern void *__malloc_av_[] __attribute__((weak));
+struct nano_chunk {
+    long size;
+    struct nano_chunk *next;
+};
+extern struct nano_chunk *__malloc_free_list __attribute__((weak));
+
+extern char __StackLimit, __bss_end__;
+
+struct heaptrace {
+    spin_lock_t *lock;
+    size_t used;
+    size_t peak;
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long failures;
+    TaskHandle_t handle[HEAPTRACE_TASKS_MAX];
+    unsigned int ntasks;
+    struct heaptrace_task task[HEAPTRACE_TASKS_MAX];
+#if (HEAPTRACE_RING_SIZE > 0)
+    uint32_t head;
+    struct heaptrace_rec ring[HEAPTRACE_RING_SIZE];
+#endif
+};
+
+static struct heaptrace ht = { .ntasks = 1, .task = { { .name = "-", }, }, };
+
+/*
+ * Where operator new or delete was called from, left for _malloc_r() or
+ * _free_r() by heaptrace_set_caller(), with the task it is for. Per core,
+ * with interrupts held off around it; a task that is preempted or moves
+ * to the other core before getting there finds someone else's caller, or
+ * none, and falls back on its return address.
+ */
+struct heaptrace_caller {
+    TaskHandle_t task;
+    void *pc;
+};
+
+static struct heaptrace_caller ht_caller[configNUMBER_OF_CORES];
+
+/*
+ * Claimed before main() and before the other core runs; an allocation
+ * made earlier in the runtime's start-up goes unlocked, there being
+ * nothing else around yet to race it.
+ */
+static void __attribute__((constructor)) heaptrace_init(void)
+{
+    ht.lock = spin_lock_instance(spin_lock_claim_unused(true));
+}
+
+static inline uint32_t heaptrace_lock(void)
+{
+    return (ht.lock != NULL) ? spin_lock_blocking(ht.lock) : 0;
+}
+
+static inline void heaptrace_unlock(uint32_t save)
+{
+    if (ht.lock != NULL) {
+        spin_unlock(ht.lock, save);
+    }
+}
+
+static inline bool heaptrace_in_task(void)
+{
+    return (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) &&
+        !portCHECK_IF_IN_ISR();
+}
+
+/*
+ * Slot of 'task', by handle and then name, so that a task created where a
+ * deleted one was does not inherit its counts. Called under the lock.
+ */
+static unsigned int heaptrace_slot(TaskHandle_t task, const char *name)
+{
+    unsigned int i;
+
+    if (task == NULL) {
+        return 0;
+    }
+
+    for (i = 1; i < ht.ntasks; i++) {
+        if ((ht.handle[i] == task) &&
+            (strncmp(ht.task[i].name, name, HEAPTRACE_NAME_LEN - 1) == 0)) {
+            return i;
+        }
+    }
+
+    if (ht.ntasks == HEAPTRACE_TASKS_MAX) {
+        return HEAPTRACE_TASKS_MAX - 1;
+    }
+
+    i = ht.ntasks++;
+    ht.handle[i] = task;
+    if (i == HEAPTRACE_TASKS_MAX - 1) {
+        strcpy(ht.task[i].name, "(other)");
+    } else {
+        strncpy(ht.task[i].name, name, HEAPTRACE_NAME_LEN - 1);
+    }
+
+    return i;
+}
+
+/*
+ * The task is looked up before taking the lock, which is never held
+ * while calling into the kernel.
+ */
+static void heaptrace_account(int op, void *ptr, size_t size, void *pc)
+{
+    struct heaptrace_task *task;
+    TaskHandle_t handle = NULL;
+    const char *name = NULL;
+    unsigned int slot;
+    uint32_t save;
+
+    if (heaptrace_in_task()) {
+        handle = xTaskGetCurrentTaskHandle();
+        name = pcTaskGetName(handle);
+    }
+
+    save = heaptrace_lock();
+
+    slot = heaptrace_slot(handle, name);
+    task = &ht.task[slot];
+    if (op == HEAPTRACE_ALLOC) {
+        ht.used += size;
+        if (ht.used > ht.peak) {
+            ht.peak = ht.used;
+        }
+        ht.allocs++;
+        task->allocs++;
+        task->alloc_bytes += size;
+    } else {
+        ht.used -= size;
+        ht.frees++;
+        task->frees++;
+        task->free_bytes += size;
+    }
+
+#if (HEAPTRACE_RING_SIZE > 0)
+    {
+        struct heaptrace_rec *rec =
+            &ht.ring[ht.head++ & (HEAPTRACE_RING_SIZE - 1)];
+
+        rec->time_us = time_us_32();
+        rec->ptr = ptr;
+        rec->pc = pc;
+        rec->size = size;
+        rec->op = op;
+        rec->task = slot;
+    }
+#else
+    (void) ptr;
+    (void) pc;
+#endif
+
+    heaptrace_unlock(save);
+}
+
+static void *heaptrace_malloc(struct _reent *r, size_t size, void *pc)
+{
+    void *ptr;
+    uint32_t save;
+
+    ptr = __real__malloc_r(r, size);
+    if (ptr != NULL) {
+        heaptrace_account(HEAPTRACE_ALLOC, ptr,
+                          _malloc_usable_size_r(r, ptr), pc);
+    } else if (size > 0) {
+        save = heaptrace_lock();
+        ht.failures++;
+        heaptrace_unlock(save);
+    }
+
+    return ptr;
+}
+
+static void heaptrace_free(struct _reent *r, void *ptr, void *pc)
+{
+    if (ptr != NULL) {
+        heaptrace_account(HEAPTRACE_FREE, ptr,
+                          _malloc_usable_size_r(r, ptr), pc);
+    }
+
+    __real__free_r(r, ptr);
+}
+
+/* Called by heaptrace-new.cxx before it allocates or frees for 'pc' */
+void heaptrace_set_caller(void *pc)
+{
+    struct heaptrace_caller *c;
+    uint32_t save;
+
+    if (!heaptrace_in_task()) {
+        return;
+    }
+
+    save = save_and_disable_interrupts();
+    c = &ht_caller[get_core_num()];
+    c->task = xTaskGetCurrentTaskHandle();
+    c->pc = pc;
+    restore_interrupts(save);
+}
+
+/* The caller left by heaptrace_set_caller(), if any, else 'pc' */
+static void *heaptrace_caller(void *pc)
+{
+    struct heaptrace_caller *c;
+    uint32_t save;
+
+    if (!heaptrace_in_task()) {
+        return pc;
+    }
+
+    save = save_and_disable_interrupts();
+    c = &ht_caller[get_core_num()];
+    if ((c->task == xTaskGetCurrentTaskHandle()) && (c->pc != NULL)) {
+        pc = c->pc;
+        c->task = NULL;
+        c->pc = NULL;
+    }
+    restore_interrupts(save);
+
+    return pc;
+}
+
+/*
+ * The caller PC is the return address out of _malloc_r(). newlib's
+ * malloc() tail-calls it, so for a plain malloc() that is the allocating
+ * code, and behind the SDK's pico_malloc wrapper it is the wrapper. new
+ * and delete, which most allocations here come through, are replaced in
+ * heaptrace-new.cxx to pass on their own caller instead.
+ */
+void *__wrap__malloc_r(struct _reent *r, size_t size)
+{
+    return heaptrace_malloc(r, size,
+                            heaptrace_caller(__builtin_return_address(0)));
+}
+
+void __wrap__free_r(struct _reent *r, void *ptr)
+{
+    heaptrace_free(r, ptr, heaptrace_caller(__builtin_return_address(0)));
+}
+
+/*
+ * Resizing in place would change a block's size behind the accounting,
+ * so a block is kept while it is big enough and not twice too big, and
+ * is moved otherwise. Tracing builds give up growing into a free
+ * neighbour for that.
+ */
+void *__wrap__realloc_r(struct _reent *r, void *ptr, size_t size)
+{
+    void *pc = heaptrace_caller(__builtin_return_address(0));
+    void *ret;
+    size_t old;
+
+    if (ptr == NULL) {
+        return heaptrace_malloc(r, size, pc);
+    }
+    if (size == 0) {
+        heaptrace_free(r, ptr, pc);
+        return NULL;
+    }
+
+    old = _malloc_usable_size_r(r, ptr);
+    if ((size <= old) && (size > old / 2)) {
+        return ptr;
+    }
+
+    ret = heaptrace_malloc(r, size, pc);
+    if (ret != NULL) {
+        memcpy(ret, ptr, (size < old) ? size : old);
+        heaptrace_free(r, ptr, pc);
+    }
+
+    return ret;
+}
+
+/*
+ * Walk the free blocks under the allocator's lock, as mallinfo() does.
+ * The top of the heap can still grow into what sbrk() has not handed
+ * out, so the two together are one candidate for the largest allocation
+ * possible.
+ */
+static void heaptrace_walk(struct heaptrace_stats *stats)
+{
+    uintptr_t p, next, top;
+    size_t size, tail;
+
+    __malloc_lock(_REENT);
+
+    tail = &__StackLimit - (char *) sbrk(0);
+    stats->free_blocks = 0;
+    stats->free = tail;
+    stats->largest = tail;
+
+    if ((&__malloc_sbrk_base != NULL) && (__malloc_av_ != NULL) &&
+        (__malloc_sbrk_base != (char *) -1)) {
+        /* Chunks: prev_size, size | PREV_INUSE, then the user data */
+        top = (uintptr_t) __malloc_av_[2];
+        for (p = ((uintptr_t) __malloc_sbrk_base + 7) & ~7; p < top;
+             p = next) {
+            size = ((const uint32_t *) p)[1] & ~3;
+            next = p + size;
+            if ((size == 0) || (next > top)) {
+                break;
+            }
+            if ((((const uint32_t *) next)[1] & 1) == 0) {
+                stats->free_blocks++;
+                stats->free += size;
+                if (size > stats->largest) {
+                    stats->largest = size;
+                }
+            }
+        }
+
+        size = ((const uint32_t *) top)[1] & ~3;
+        stats->free += size;
+        if (tail + size > stats->largest) {
+            stats->largest = tail + size;
+        }
+    } else if (&__malloc_free_list != NULL) {
+        for (struct nano_chunk *c = __malloc_free_list; c != NULL;
+             c = c->next) {
+            stats->free_blocks++;
+            stats->free += c->size;
+            if ((size_t) c->size > stats->largest) {
+                stats->largest = c->size;
+            }
+        }
+    }
+
+    __malloc_unlock(_REENT);
+}
+
+int heaptrace_get(struct heaptrace_stats *stats)
+{
+    uint32_t save;
+
+    if (stats == NULL) {
+        return -1;
+    }
+
+    heaptrace_walk(stats);
+    stats->arena = &__StackLimit - &__bss_end__;
+
+    save = heaptrace_lock();
+    stats->used = ht.used;
+    stats->peak = ht.peak;
+    stats->allocs = ht.allocs;
+    stats->frees = ht.frees;
+    stats->failures = ht.failures;
+    heaptrace_unlock(save);
+
+    return 0;
+}
+
+unsigned int heaptrace_tasks(struct heaptrace_task *tasks, unsigned int max)
+{
+    unsigned int n;
+    uint32_t save;
+
+    save = heaptrace_lock();
+    n = (ht.ntasks < max) ? ht.ntasks : max;
+    if (tasks != NULL) {
+        memcpy(tasks, ht.task, n * sizeof(struct heaptrace_task));
+    }
+    heaptrace_unlock(save);
+
+    return n;
+}
+
+/* Up to 'max' of the latest allocations and frees, newest first */
+unsigned int heaptrace_recent(struct heaptrace_rec *recs, unsigned int max)
+{
+    unsigned int n = 0;
+#if (HEAPTRACE_RING_SIZE > 0)
+    uint32_t save;
+
+    save = heaptrace_lock();
+    while ((n < max) && (n < HEAPTRACE_RING_SIZE) && (n < ht.head)) {
+        recs[n] = ht.ring[(ht.head - 1 - n) & (HEAPTRACE_RING_SIZE - 1)];
+        n++;
+    }
+    heaptrace_unlock(save);
+#else
+    (void) recs;
+    (void) max;
+#endif
+
+    return n;
+}
+
+/* Start over on the peak and the counts; what is in use stays */
+void heaptrace_reset(void)
+{
+    uint32_t save;
+
+    save = heaptrace_lock();
+    ht.peak = ht.used;
+    ht.allocs = 0;
+    ht.frees = 0;
+    ht.failures = 0;
+    for (unsigned int i = 0; i < ht.ntasks; i++) {
+        ht.task[i].allocs = 0;
+        ht.task[i].frees = 0;
+        ht.task[i].alloc_bytes = 0;
+        ht.task[i].free_bytes = 0;
+    }
+#if (HEAPTRACE_RING_SIZE > 0)
+    ht.head = 0;
+#endif
+    heaptrace_unlock(save);
+}
+
+#else
+
+int heaptrace_get(struct heaptrace_stats *stats)
+{
+    (void) stats;
+
+    return -1;
+}
+
+unsigned int heaptrace_tasks(struct heaptrace_task *tasks, unsigned int max)
+{
+    (void) tasks;
+    (void) max;
+
+    return 0;
+}
+
+unsigned int heaptrace_recent(struct heaptrace_rec *recs, unsigned int max)
+{
+    (void) recs;
+    (void) max;
+
+    return 0;
+}
+
+void heaptrace_reset(void)
+{
+
+}
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,551 @@
+/*
+ * iocore.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pico/platform.h>
+#include <pico/time.h>
+#include <hardware/irq.h>
+#include <hardware/sync.h>
+#include <hardware/clocks.h>
+#include <hardware/structs/systick.h>
+#include <hardware/structs/xip_ctrl.h>
+#include <hardware/regs/addressmap.h>
+#include <hardware/regs/m0plus.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <queue.h>
+#include <pico-plat.h>
+#include <ringbuf.h>
+
+#ifndef IOCORE_TASK_STACK
+#define IOCORE_TASK_STACK  256
+#endif
+
+/* Calls that can be waiting for each core's service task */
+#ifndef IOCORE_QUEUE_LEN
+#define IOCORE_QUEUE_LEN  4
+#endif
+
+/* Span of flash that IOCORE_IRQLAT_LOAD streams through */
+#ifndef IOCORE_IRQLAT_LOAD_BYTES
+#define IOCORE_IRQLAT_LOAD_BYTES  (64 * 1024)
+#endif
+
+#if (configNUMBER_OF_CORES > 1) && (configUSE_CORE_AFFINITY == 1)
+#define IOCORE_AFFINITY  1
+#define IOCORE_TASKS     configNUMBER_OF_CORES
+#else
+#define IOCORE_AFFINITY  0
+#define IOCORE_TASKS     1
+#endif
+
+#if (configTASK_NOTIFICATION_ARRAY_ENTRIES < PICO_PLAT_NOTIFY_ENTRIES)
+#error "configTASK_NOTIFICATION_ARRAY_ENTRIES is too small for pico-plat"
+#endif
+
+/*
+ * A service task is done with what the waiter lent it, on its stack, and
+ * is about to tell it so. 'waiter' is read first: once 'done' is seen,
+ * 'flag' may be gone.
+ */
+static void iocore_done(volatile bool *flag, TaskHandle_t waiter)
+{
+    __dmb();
+    *flag = true;
+    xTaskNotifyGiveIndexed(waiter, PICO_PLAT_NOTIFY_DONE);
+}
+
+/*
+ * Sleep until a service task sets 'flag'. Only its own index wakes the
+ * waiter, and a notification left over there from an earlier call, or
+ * an early one, just goes around the loop again: the service task may
+ * still be using the waiter's stack until 'flag' is set.
+ */
+static void iocore_wait(volatile bool *flag)
+{
+    while (!*flag) {
+        ulTaskNotifyTakeIndexed(PICO_PLAT_NOTIFY_DONE, pdTRUE,
+                                portMAX_DELAY);
+    }
+    __dmb();
+}
+
+struct iocore_call {
+    void (*fn)(void *);
+    void *arg;
+    TaskHandle_t waiter;
+    volatile bool *done;
+};
+
+/*
+ * One top-priority service task per core, pinned to it, runs the calls
+ * queued for that core one after the other. Both the tasks and their
+ * queues are made once, before main(), and in static storage where the
+ * kernel allows it, so that running something on a core never touches
+ * the heap.
+ */
+static QueueHandle_t iocore_queue[IOCORE_TASKS];
+
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+static StaticQueue_t iocore_queue_buf[IOCORE_TASKS];
+static uint8_t iocore_queue_items[IOCORE_TASKS]
+                                 [IOCORE_QUEUE_LEN *
+                                  sizeof(struct iocore_call)];
+static StaticTask_t iocore_tcb[IOCORE_TASKS];
+static StackType_t iocore_stack[IOCORE_TASKS][IOCORE_TASK_STACK];
+#endif
+
+static void iocore_task(void *arg)
+{
+    QueueHandle_t queue = (QueueHandle_t) arg;
+    struct iocore_call call;
+
+    for (;;) {
+        if (xQueueReceive(queue, &call, portMAX_DELAY) != pdPASS) {
+            continue;
+        }
+
+        call.fn(call.arg);
+
+        if (call.done != NULL) {
+            iocore_done(call.done, call.waiter);
+        }
+    }
+}
+
+static void __attribute__((constructor)) iocore_init(void)
+{
+    TaskHandle_t task;
+    unsigned int i;
+
+    for (i = 0; i < IOCORE_TASKS; i++) {
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+        iocore_queue[i] = xQueueCreateStatic(IOCORE_QUEUE_LEN,
+                                             sizeof(struct iocore_call),
+                                             iocore_queue_items[i],
+                                             &iocore_queue_buf[i]);
+#if IOCORE_AFFINITY
+        task = xTaskCreateStaticAffinitySet(iocore_task, "iocore",
+                                            IOCORE_TASK_STACK,
+                                            iocore_queue[i],
+                                            configMAX_PRIORITIES - 1,
+                                            iocore_stack[i], &iocore_tcb[i],
+                                            1 << i);
+#else
+        task = xTaskCreateStatic(iocore_task, "iocore", IOCORE_TASK_STACK,
+                                 iocore_queue[i], configMAX_PRIORITIES - 1,
+                                 iocore_stack[i], &iocore_tcb[i]);
+#endif
+#else
+        iocore_queue[i] = xQueueCreate(IOCORE_QUEUE_LEN,
+                                       sizeof(struct iocore_call));
+        task = NULL;
+        if (iocore_queue[i] != NULL) {
+#if IOCORE_AFFINITY
+            xTaskCreateAffinitySet(iocore_task, "iocore", IOCORE_TASK_STACK,
+                                   iocore_queue[i], configMAX_PRIORITIES - 1,
+                                   1 << i, &task);
+#else
+            xTaskCreate(iocore_task, "iocore", IOCORE_TASK_STACK,
+                        iocore_queue[i], configMAX_PRIORITIES - 1, &task);
+#endif
+        }
+#endif
+        if (task == NULL) {
+            iocore_queue[i] = NULL;
+        }
+    }
+}
+
+/*
+ * Queue fn(arg) for the service task of 'core'. With 'flag', that is set
+ * and the caller notified once it has run; without, nobody waits for it,
+ * as before the scheduler starts, when the queue must not block.
+ */
+static int iocore_post(unsigned int core, void (*fn)(void *), void *arg,
+                       volatile bool *flag)
+{
+    int ret = 0;
+    QueueHandle_t queue = iocore_queue[IOCORE_AFFINITY ? core : 0];
+    struct iocore_call call;
+    TickType_t wait;
+
+    if (queue == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    call.fn = fn;
+    call.arg = arg;
+    call.waiter = (flag != NULL) ? xTaskGetCurrentTaskHandle() : NULL;
+    call.done = flag;
+    if (flag != NULL) {
+        *flag = false;
+    }
+
+    wait = (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) ?
+        portMAX_DELAY : 0;
+    if (xQueueSend(queue, &call, wait) != pdPASS) {
+        ret = -1;
+    }
+
+done:
+
+    return ret;
+}
+
+/*
+ * Run fn(arg) on 'core' and return once it is done, for set-up that has
+ * to happen on a given core, such as enabling an interrupt there or
+ * touching its SysTick. Before the scheduler starts nothing runs on the
+ * other core yet; it is then queued to run first thing after start, and
+ * this returns right away.
+ */
+int iocore_run_on(unsigned int core, void (*fn)(void *), void *arg)
+{
+    int ret = 0;
+#if IOCORE_AFFINITY
+    volatile bool ran = false;
+    bool running;
+
+    if (core >= configNUMBER_OF_CORES) {
+        ret = -1;
+        goto done;
+    }
+
+    running = xTaskGetSchedulerState() == taskSCHEDULER_RUNNING;
+    if (running ?
+        (vTaskCoreAffinityGet(NULL) == (1U << core)) :
+        (get_core_num() == core)) {
+        fn(arg);
+        goto done;
+    }
+
+    ret = iocore_post(core, fn, arg, running ? &ran : NULL);
+    if ((ret == 0) && running) {
+        iocore_wait(&ran);
+    }
+
+done:
+#else
+    if (core >= configNUMBER_OF_CORES) {
+        ret = -1;
+    } else {
+        fn(arg);
+    }
+#endif
+
+    return ret;
+}
+
+/*
+ * Run fn(arg) on the I/O core, as iocore_run_on(). Interrupts are enabled
+ * per core on the RP2040, so this is how set-up code gets them taken on
+ * the I/O core. Without one, fn(arg) is just called.
+ */
+int iocore_run(void (*fn)(void *), void *arg)
+{
+#if (PICO_PLAT_IO_CORE >= 0) && IOCORE_AFFINITY
+    return iocore_run_on(PICO_PLAT_IO_CORE, fn, arg);
+#else
+    fn(arg);
+
+    return 0;
+#endif
+}
+
+struct iocore_probe {
+    unsigned int samples;
+    struct iocore_jitter *jitter;
+    volatile bool done;
+};
+
+/*
+ * Wake up every tick at the highest priority, as a control loop would,
+ * and record how far each interval strays from the tick period.
+ */
+static void iocore_jitter_probe(void *arg)
+{
+    static const unsigned int bounds[] = IOCORE_JITTER_BOUNDS;
+    struct iocore_probe *probe = (struct iocore_probe *) arg;
+    struct iocore_jitter *jitter = probe->jitter;
+    TickType_t wake;
+    uint64_t prev, now, total = 0;
+    unsigned int i, n, dt, dev;
+
+    memset(jitter, 0, sizeof(*jitter));
+    jitter->period_us = 1000000 / configTICK_RATE_HZ;
+    jitter->min_us = UINT32_MAX;
+
+    /* Align with the tick first */
+    vTaskDelay(1);
+    wake = xTaskGetTickCount();
+    prev = time_us_64();
+
+    for (n = 0; n < probe->samples; n++) {
+        xTaskDelayUntil(&wake, 1);
+        now = time_us_64();
+        dt = (unsigned int) (now - prev);
+        prev = now;
+
+        total += dt;
+        if (dt < jitter->min_us) {
+            jitter->min_us = dt;
+        }
+        if (dt > jitter->max_us) {
+            jitter->max_us = dt;
+        }
+
+        dev = (dt > jitter->period_us) ?
+            dt - jitter->period_us : jitter->period_us - dt;
+        for (i = 0; i < IOCORE_JITTER_BUCKETS - 1; i++) {
+            if (dev < bounds[i]) {
+                break;
+            }
+        }
+        jitter->hist[i]++;
+    }
+
+    jitter->samples = n;
+    jitter->avg_us = n > 0 ? (unsigned int) (total / n) : 0;
+}
+
+/*
+ * Measure the wakeup jitter a periodic top-priority task sees on 'core'
+ * over 'samples' ticks, to compare builds with and without an I/O core
+ * under the same I/O load. Blocks the caller for the duration.
+ */
+int iocore_measure_jitter(unsigned int core, unsigned int samples,
+                          struct iocore_jitter *jitter)
+{
+    int ret = 0;
+    struct iocore_probe probe;
+
+    if ((core >= configNUMBER_OF_CORES) || (samples == 0) ||
+        (jitter == NULL)) {
+        ret = -1;
+        goto done;
+    }
+
+    probe.samples = samples;
+    probe.jitter = jitter;
+
+    if (iocore_post(core, iocore_jitter_probe, &probe, &probe.done) != 0) {
+        ret = -1;
+        goto done;
+    }
+
+    iocore_wait(&probe.done);
+
+done:
+
+    return ret;
+}
+
+struct iocore_irqlat_run {
+    unsigned int samples;
+    int flags;
+    struct iocore_irqlat *lat;
+    volatile bool loading;
+    volatile bool done;
+    volatile bool load_done;
+    int ret;
+};
+
+/* Shared with the probe interrupt handler */
+static struct {
+    struct ringbuf ring;
+    uint8_t buf[16];
+    volatile uint32_t t1;
+    volatile bool fired;
+} irqlat;
+
+/*
+ * The probe interrupt does what the pico-plat handlers do first, a ring
+ * buffer round trip, and is placed like them: in SRAM only when built
+ * with PICO_PLAT_RAM_HOT_PATH.
+ */
+static void PICO_PLAT_HOT(iocore_irqlat_handler)(void)
+{
+    uint8_t c = 0;
+
+    ringbuf_write(&irqlat.ring, &c, 1);
+    ringbuf_read(&irqlat.ring, &c, 1);
+    irqlat.t1 = systick_hw->cvr;
+    irqlat.fired = true;
+}
+
+/*
+ * Read SysTick and pend the probe interrupt with interrupts off, so that
+ * nothing gets in between, then let it in. Always in SRAM, so that only
+ * where the handler lives differs from one build to the other.
+ */
+static uint32_t __not_in_flash_func(iocore_irqlat_fire)(unsigned int irq)
+{
+    uint32_t save, t0;
+
+    save = save_and_disable_interrupts();
+    t0 = systick_hw->cvr;
+    *((io_rw_32 *) (PPB_BASE + M0PLUS_NVIC_ISPR_OFFSET)) = 1u << irq;
+    restore_interrupts(save);
+
+    return t0;
+}
+
+static void iocore_irqlat_probe(void *arg)
+{
+    struct iocore_irqlat_run *run = (struct iocore_irqlat_run *) arg;
+    struct iocore_irqlat *lat = run->lat;
+    uint64_t total = 0;
+    uint32_t reload, t0, dt;
+    unsigned int n;
+    int irq;
+
+    memset(lat, 0, sizeof(*lat));
+    lat->hz = clock_get_hz(clk_sys);
+    lat->min_cycles = UINT32_MAX;
+
+    irq = user_irq_claim_unused(false);
+    if (irq < 0) {
+        run->ret = -1;
+        return;
+    }
+
+    ringbuf_init(&irqlat.ring, irqlat.buf, sizeof(irqlat.buf),
+                 RINGBUF_DROP_NEW);
+    irq_set_exclusive_handler(irq, iocore_irqlat_handler);
+    irq_set_priority(irq, PICO_HIGHEST_IRQ_PRIORITY);
+    irq_set_enabled(irq, true);
+
+    /* SysTick counts clk_sys cycles down from 'rvr' */
+    reload = systick_hw->rvr + 1;
+
+    for (n = 0; n < run->samples; n++) {
+        if (run->flags & IOCORE_IRQLAT_COLD) {
+            xip_ctrl_hw->flush = 1;
+            (void) xip_ctrl_hw->flush;
+        }
+
+        irqlat.fired = false;
+        t0 = iocore_irqlat_fire(irq);
+        while (!irqlat.fired) {
+            tight_loop_contents();
+        }
+
+        dt = (irqlat.t1 <= t0) ? t0 - irqlat.t1 : t0 + reload - irqlat.t1;
+        total += dt;
+        if (dt < lat->min_cycles) {
+            lat->min_cycles = dt;
+        }
+        if (dt > lat->max_cycles) {
+            lat->max_cycles = dt;
+        }
+    }
+
+    irq_set_enabled(irq, false);
+    irq_remove_handler(irq, iocore_irqlat_handler);
+    user_irq_unclaim(irq);
+
+    lat->samples = n;
+    lat->avg_cycles = n > 0 ? (unsigned int) (total / n) : 0;
+}
+
+#if IOCORE_AFFINITY
+
+/*
+ * Keep the QSPI bus busy from the other core with uncached flash reads,
+ * so that every XIP cache miss of the probe has to queue behind them.
+ * The service task drops to just above idle meanwhile, as the rest of
+ * that core still has to run.
+ */
+static void iocore_irqlat_load(void *arg)
+{
+    struct iocore_irqlat_run *run = (struct iocore_irqlat_run *) arg;
+    const volatile uint32_t *flash =
+        (const volatile uint32_t *) XIP_NOCACHE_NOALLOC_BASE;
+    uint32_t sink = 0;
+    unsigned int i = 0;
+
+    vTaskPrioritySet(NULL, tskIDLE_PRIORITY + 1);
+
+    while (run->loading) {
+        sink += flash[i];
+        i = (i + 1) % (IOCORE_IRQLAT_LOAD_BYTES / sizeof(*flash));
+    }
+    (void) sink;
+
+    vTaskPrioritySet(NULL, configMAX_PRIORITIES - 1);
+}
+
+#endif
+
+/*
+ * Measure, in clk_sys cycles, how long 'samples' interrupts take on
+ * 'core' from being raised to having done a ring buffer round trip in
+ * their handler. IOCORE_IRQLAT_COLD empties the XIP cache before each
+ * one and IOCORE_IRQLAT_LOAD streams flash reads on the other core
+ * meanwhile, which together give the worst case that building with
+ * PICO_PLAT_RAM_HOT_PATH is meant to remove. Blocks the caller, and with
+ * IOCORE_IRQLAT_COLD slows everything else down, for the duration; with
+ * IOCORE_IRQLAT_LOAD, so does iocore_run_on() the other core.
+ */
+int iocore_measure_irq_latency(unsigned int core, unsigned int samples,
+                               int flags, struct iocore_irqlat *lat)
+{
+    int ret = 0;
+    struct iocore_irqlat_run run;
+
+    if ((core >= configNUMBER_OF_CORES) || (samples == 0) ||
+        (lat == NULL)) {
+        ret = -1;
+        goto done;
+    }
+
+    run.samples = samples;
+    run.flags = flags;
+    run.lat = lat;
+    run.loading = false;
+    run.ret = 0;
+
+#if IOCORE_AFFINITY
+    if (flags & IOCORE_IRQLAT_LOAD) {
+        run.loading = true;
+        if (iocore_post(core ^ 1, iocore_irqlat_load, &run,
+                        &run.load_done) != 0) {
+            ret = -1;
+            goto done;
+        }
+    }
+#endif
+
+    if (iocore_post(core, iocore_irqlat_probe, &run, &run.done) == 0) {
+        iocore_wait(&run.done);
+        ret = run.ret;
+    } else {
+        ret = -1;
+    }
+
+    if (run.loading) {
+        run.loading = false;
+        iocore_wait(&run.load_done);
+    }
+
+done:
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
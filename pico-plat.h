@@ -25,17 +25,256 @@
 #endif
 #endif
 
+/*
+ * I/O-core mode: with PICO_PLAT_IO_CORE set to a core number, the UART,
+ * RX DMA and USB interrupts, the USB service task and the dlog drain all
+ * run on that core, leaving the other one to the application. Tasks on
+ * either core still just call the usual APIs, which only touch the
+ * lock-free rings in between. -1 (the default) leaves everything on
+ * whichever core sets it up.
+ */
+#ifndef PICO_PLAT_IO_CORE
+#define PICO_PLAT_IO_CORE  -1
+#endif
+
+/*
+ * PICO_PLAT_RAM_HOT_PATH (set by the CMake option of the same name) puts
+ * the UART, RX DMA, ADC and USB interrupt handlers, the ring buffers and
+ * dlog_write() in SRAM, so an XIP cache miss cannot stall them behind a
+ * flash fetch, e.g. one made by the other core.
+ */
+#ifndef PICO_PLAT_RAM_HOT_PATH
+#define PICO_PLAT_RAM_HOT_PATH  0
+#endif
+
+#if PICO_PLAT_RAM_HOT_PATH
+#include <pico/platform.h>
+#define PICO_PLAT_HOT(func)  __not_in_flash_func(func)
+#else
+#define PICO_PLAT_HOT(func)  func
+#endif
+
+/*
+ * PICO_PLAT_HEAP_TRACE (set by the CMake option of the same name) links
+ * newlib's _malloc_r(), _free_r() and _realloc_r(), which malloc(), new
+ * and everything else in the C library allocate through, to the
+ * accounting in heaptrace.c, and replaces new and delete to record who
+ * called them (heaptrace-new.cxx).
+ */
+#ifndef PICO_PLAT_HEAP_TRACE
+#define PICO_PLAT_HEAP_TRACE  0
+#endif
+
+/*
+ * Task notification indices pico-plat waits on, which leaves index 0 to
+ * the application: one for a helper task or a job having finished, one
+ * for the shell's ^C. FreeRTOSConfig.h must set
+ * configTASK_NOTIFICATION_ARRAY_ENTRIES to PICO_PLAT_NOTIFY_ENTRIES or
+ * more.
+ */
+#define PICO_PLAT_NOTIFY_DONE     1
+#define PICO_PLAT_NOTIFY_CANCEL   2
+#define PICO_PLAT_NOTIFY_ENTRIES  3
+
 EXTERN_C_BEGIN
 
+#define SERIAL_WAIT_FOREVER  0xffffffffU
+
+struct serial_stats {
+    unsigned long tx_queued;   // bytes accepted into the TX ring
+    unsigned long tx_sent;     // bytes moved from the TX ring to the UART
+    unsigned long tx_stalls;   // writes that found the TX ring full
+    unsigned long rx_dropped;  // bytes lost to RX ring overflow or DMA lap
+};
+
+struct usbcdc_stats {
+    unsigned long tx_bytes;    // bytes queued into the IN FIFO
+    unsigned long rx_bytes;    // bytes moved from the OUT FIFO to the RX ring
+    unsigned long rx_dropped;  // bytes lost to RX ring overflow
+    unsigned long rx_stalls;   // times the RX ring filled with data pending
+};
+
+/*
+ * Completion of a usbvendor_submit() / usbvendor_receive() buffer, called
+ * from the context that services the USB stack: 'len' is the number of
+ * bytes transferred, 'status' is 0 on success or -1 if the transfer failed
+ * or was cancelled by a bus reset. Must not block. Buffers are used in
+ * place and must stay valid and untouched until their callback has run.
+ */
+typedef void (*usbvendor_cb_t)(void *ctx, void *buf, size_t len, int status);
+
+/* Upper bounds (us) of the iocore_jitter histogram buckets but the last */
+#define IOCORE_JITTER_BUCKETS  8
+#define IOCORE_JITTER_BOUNDS   { 2, 5, 10, 20, 50, 100, 200, }
+
+struct iocore_jitter {
+    unsigned int samples;      // wakeups measured
+    unsigned int period_us;    // nominal interval between them
+    unsigned int min_us;       // shortest interval seen
+    unsigned int max_us;       // longest interval seen
+    unsigned int avg_us;
+    unsigned int hist[IOCORE_JITTER_BUCKETS];  // |interval - period|
+};
+
+#define IOCORE_IRQLAT_COLD  0x1   // flush the XIP cache before each sample
+#define IOCORE_IRQLAT_LOAD  0x2   // stream flash reads on the other core
+
+struct iocore_irqlat {
+    unsigned int samples;      // interrupts measured
+    unsigned int hz;           // clk_sys, which the cycles are counted in
+    unsigned int min_cycles;
+    unsigned int avg_cycles;
+    unsigned int max_cycles;
+};
+
+#define STACKMON_HISTORY   4
+#define STACKMON_NAME_LEN  16
+
+/* A stack's least free space so far, and when it last went down */
+struct stackmon_low {
+    uint32_t uptime_s;
+    unsigned int free_words;
+};
+
+struct stackmon_task {
+    char name[STACKMON_NAME_LEN];   // "IRQ<core>" for an interrupt stack
+    unsigned int free_words;        // least free ever seen
+    int irq;
+    int gone;                       // the task has since been deleted
+    unsigned int nlows;             // new lows seen, of which
+    struct stackmon_low lows[STACKMON_HISTORY];  // the latest, newest first
+};
+
+/* From the monitor task, on every new low below the margin */
+typedef void (*stackmon_cb_t)(void *ctx, const char *name,
+                              unsigned int free_words);
+
+#define ARENA_CLASSES  4   // 32, 128, 512 and 2048-byte blocks
+
+struct arena_stats {
+    size_t size[ARENA_CLASSES];
+    unsigned int blocks[ARENA_CLASSES];
+    unsigned int used[ARENA_CLASSES];
+    unsigned int peak[ARENA_CLASSES];
+    unsigned long failures;
+};
+
+/* Block sizes are usable sizes, as malloc_usable_size() has them */
+struct heaptrace_stats {
+    size_t arena;              // from the end of .bss to the stack limit
+    size_t used;               // in allocated blocks
+    size_t peak;               // most ever in allocated blocks
+    size_t free;               // everything else in the arena
+    size_t largest;            // largest block that could be allocated now
+    unsigned int free_blocks;  // free holes below the top of the heap
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long failures;
+};
+
+#define HEAPTRACE_NAME_LEN  16
+
+/*
+ * Per task, what it allocated and freed itself: a block freed by another
+ * task counts against that one.
+ */
+struct heaptrace_task {
+    char name[HEAPTRACE_NAME_LEN];
+    unsigned long allocs;
+    unsigned long frees;
+    uint32_t alloc_bytes;      // wrapping
+    uint32_t free_bytes;       // wrapping
+};
+
+#define HEAPTRACE_ALLOC  0
+#define HEAPTRACE_FREE   1
+
+struct heaptrace_rec {
+    uint32_t time_us;
+    void *ptr;
+    void *pc;                  // return address into the allocating code
+    uint32_t size;
+    uint8_t op;                // HEAPTRACE_ALLOC or HEAPTRACE_FREE
+    uint8_t task;              // index into what heaptrace_tasks() gives
+};
+
+/*
+ * Called around a clk_sys change made by sysclock_set_hz(), from the task
+ * making it: with SYSCLOCK_CHANGING and the target frequency right before,
+ * and with SYSCLOCK_CHANGED and the new frequency right after.
+ */
+#define SYSCLOCK_CHANGING  0
+#define SYSCLOCK_CHANGED   1
+
+typedef void (*sysclock_cb_t)(void *ctx, int event, uint32_t hz);
+
+typedef void (*fmt_sink_t)(void *ctx, const char *s, size_t len);
+
+extern int fmt_printf(fmt_sink_t sink, void *ctx, const char *format, ...);
+extern int fmt_vprintf(fmt_sink_t sink, void *ctx,
+                       const char *format, va_list ap);
+
+extern int iocore_run(void (*fn)(void *), void *arg);
+extern int iocore_run_on(unsigned int core, void (*fn)(void *), void *arg);
+extern int iocore_measure_jitter(unsigned int core, unsigned int samples,
+                                 struct iocore_jitter *jitter);
+extern int iocore_measure_irq_latency(unsigned int core, unsigned int samples,
+                                      int flags, struct iocore_irqlat *lat);
+
+#define ADCSAMPLER_TEMP_SENSOR  4   // ADC input of the temperature sensor
+
+extern int adcsampler_start(uint32_t mask, unsigned int rate_hz,
+                            unsigned int oversample, unsigned int avg_shift);
+extern void adcsampler_stop(void);
+extern int adcsampler_get(unsigned int channel);
+extern unsigned long adcsampler_frames(void);
+
+extern int sysclock_set_hz(uint32_t hz);
+extern uint32_t sysclock_get_hz(void);
+extern unsigned int sysclock_get_vreg_mv(void);
+extern void sysclock_idle(void);
+extern uint32_t sysclock_sleep_us(unsigned int core);
+extern int sysclock_add_listener(sysclock_cb_t cb, void *ctx);
+extern int sysclock_remove_listener(sysclock_cb_t cb, void *ctx);
+
+extern int stackmon_start(unsigned int period_ms, unsigned int margin_words,
+                          stackmon_cb_t cb, void *ctx);
+extern void stackmon_stop(void);
+extern int stackmon_running(void);
+extern int stackmon_get(unsigned int i, struct stackmon_task *task);
+
+extern void *arena_alloc(size_t size);
+extern void arena_free(void *ptr);
+extern int arena_get_stats(struct arena_stats *stats);
+
+extern int heaptrace_get(struct heaptrace_stats *stats);
+extern unsigned int heaptrace_tasks(struct heaptrace_task *tasks,
+                                    unsigned int max);
+extern unsigned int heaptrace_recent(struct heaptrace_rec *recs,
+                                     unsigned int max);
+extern void heaptrace_reset(void);
+
 extern void serial_init(void);
 extern void serial_deinit(void);
 
 extern int serial_check_markers(unsigned int inst);
 extern int serial_write(unsigned int inst, const uint8_t *data, size_t size);
+extern void serial_set_tx_blocking(unsigned int inst, int block);
+extern int serial_flush(unsigned int inst, unsigned int timeout_ms);
+extern int serial_get_stats(unsigned int inst, struct serial_stats *stats);
 extern int serial_printf(unsigned int inst, const char *format, ...);
 extern int serial_vprintf(unsigned int inst, const char *format, va_list ap);
 extern int serial_rx_ready(unsigned int inst);
 extern int serial_read(unsigned int inst, uint8_t *data, size_t size);
+extern int serial_rx_peek(unsigned int inst,
+                          const uint8_t **ptr1, size_t *len1,
+                          const uint8_t **ptr2, size_t *len2);
+extern int serial_rx_consume(unsigned int inst, size_t len);
+extern int serial_rx_wait(unsigned int inst, unsigned int timeout_ms);
+extern int serial_read_timeout(unsigned int inst, uint8_t *data, size_t len,
+                               unsigned int timeout_ms);
+extern int serial_read_until(unsigned int inst, uint8_t *data, size_t len,
+                             uint8_t delim, unsigned int timeout_ms);
 
 static inline int serial0_check_markers(void)
 {
@@ -47,13 +286,18 @@ static inline int serial0_write(const uint8_t *data, size_t size)
     return serial_write(0, data, size);
 }
 
+static inline int serial0_flush(unsigned int timeout_ms)
+{
+    return serial_flush(0, timeout_ms);
+}
+
 static inline int serial0_printf(const char *format, ...)
 {
     int ret = 0;
     va_list ap;
 
     va_start(ap, format);
-    serial_vprintf(0, format, ap);
+    ret = serial_vprintf(0, format, ap);
     va_end(ap);
 
     return ret;
@@ -74,6 +318,34 @@ static inline int serial0_read(uint8_t *data, size_t size)
     return serial_read(0, data, size);
 }
 
+static inline int serial0_rx_peek(const uint8_t **ptr1, size_t *len1,
+                                   const uint8_t **ptr2, size_t *len2)
+{
+    return serial_rx_peek(0, ptr1, len1, ptr2, len2);
+}
+
+static inline int serial0_rx_consume(size_t len)
+{
+    return serial_rx_consume(0, len);
+}
+
+static inline int serial0_rx_wait(unsigned int timeout_ms)
+{
+    return serial_rx_wait(0, timeout_ms);
+}
+
+static inline int serial0_read_timeout(uint8_t *data, size_t size,
+                                        unsigned int timeout_ms)
+{
+    return serial_read_timeout(0, data, size, timeout_ms);
+}
+
+static inline int serial0_read_until(uint8_t *data, size_t size,
+                                      uint8_t delim, unsigned int timeout_ms)
+{
+    return serial_read_until(0, data, size, delim, timeout_ms);
+}
+
 static inline int serial1_check_markers(void)
 {
     return serial_check_markers(1);
@@ -84,13 +356,18 @@ static inline int serial1_write(const uint8_t *data, size_t size)
     return serial_write(1, data, size);
 }
 
+static inline int serial1_flush(unsigned int timeout_ms)
+{
+    return serial_flush(1, timeout_ms);
+}
+
 static inline int serial1_printf(const char *format, ...)
 {
     int ret = 0;
     va_list ap;
 
     va_start(ap, format);
-    serial_vprintf(1, format, ap);
+    ret = serial_vprintf(1, format, ap);
     va_end(ap);
 
     return ret;
@@ -111,6 +388,34 @@ static inline int serial1_read(uint8_t *data, size_t size)
     return serial_read(1, data, size);
 }
 
+static inline int serial1_rx_peek(const uint8_t **ptr1, size_t *len1,
+                                   const uint8_t **ptr2, size_t *len2)
+{
+    return serial_rx_peek(1, ptr1, len1, ptr2, len2);
+}
+
+static inline int serial1_rx_consume(size_t len)
+{
+    return serial_rx_consume(1, len);
+}
+
+static inline int serial1_rx_wait(unsigned int timeout_ms)
+{
+    return serial_rx_wait(1, timeout_ms);
+}
+
+static inline int serial1_read_timeout(uint8_t *data, size_t size,
+                                        unsigned int timeout_ms)
+{
+    return serial_read_timeout(1, data, size, timeout_ms);
+}
+
+static inline int serial1_read_until(uint8_t *data, size_t size,
+                                      uint8_t delim, unsigned int timeout_ms)
+{
+    return serial_read_until(1, data, size, delim, timeout_ms);
+}
+
 #if defined(SEMAPHORE_H)
 extern SemaphoreHandle_t uart0_sem;
 extern SemaphoreHandle_t uart1_sem;
@@ -121,17 +426,111 @@ extern SemaphoreHandle_t uart1_sem;
 extern void usbcdc_init(void);
 extern void usbcdc_deinit(void);
 extern void usbcdc_task(void);
-extern int usbcdc_is_connected(void);
-extern int usbcdc_write(const void *buf, size_t len);
-extern int usbcdc_printf(const char *format, ...);
-extern int usbcdc_vprintf(const char *format, va_list ap);
-extern int usbcdc_rx_ready(void);
-extern int usbcdc_read(void *buf, size_t len);
+extern int usbcdc_task_start(unsigned int priority, int core);
+extern void usbcdc_task_stop(void);
+extern int usbcdc_n_is_connected(unsigned int itf);
+extern int usbcdc_n_write(unsigned int itf, const void *buf, size_t len);
+extern int usbcdc_n_flush(unsigned int itf);
+extern int usbcdc_n_set_flush_threshold(unsigned int itf,
+                                        size_t bytes, unsigned int us);
+extern int usbcdc_n_printf(unsigned int itf, const char *format, ...);
+extern int usbcdc_n_vprintf(unsigned int itf, const char *format, va_list ap);
+extern int usbcdc_n_rx_ready(unsigned int itf);
+extern int usbcdc_n_read(unsigned int itf, void *buf, size_t len);
+extern int usbcdc_n_rx_peek(unsigned int itf,
+                            const uint8_t **ptr1, size_t *len1,
+                            const uint8_t **ptr2, size_t *len2);
+extern int usbcdc_n_rx_consume(unsigned int itf, size_t len);
+extern int usbcdc_n_rx_wait(unsigned int itf, unsigned int timeout_ms);
+extern int usbcdc_n_read_timeout(unsigned int itf, void *buf, size_t len,
+                                 unsigned int timeout_ms);
+extern int usbcdc_n_get_stats(unsigned int itf, struct usbcdc_stats *stats);
+
+static inline int usbcdc_is_connected(void)
+{
+    return usbcdc_n_is_connected(0);
+}
+
+static inline int usbcdc_write(const void *buf, size_t len)
+{
+    return usbcdc_n_write(0, buf, len);
+}
+
+static inline int usbcdc_flush(void)
+{
+    return usbcdc_n_flush(0);
+}
+
+static inline void usbcdc_set_flush_threshold(size_t bytes, unsigned int us)
+{
+    usbcdc_n_set_flush_threshold(0, bytes, us);
+}
+
+static inline int usbcdc_printf(const char *format, ...)
+{
+    int ret = 0;
+    va_list ap;
+
+    va_start(ap, format);
+    ret = usbcdc_n_vprintf(0, format, ap);
+    va_end(ap);
+
+    return ret;
+}
+
+static inline int usbcdc_vprintf(const char *format, va_list ap)
+{
+    return usbcdc_n_vprintf(0, format, ap);
+}
+
+static inline int usbcdc_rx_ready(void)
+{
+    return usbcdc_n_rx_ready(0);
+}
+
+static inline int usbcdc_read(void *buf, size_t len)
+{
+    return usbcdc_n_read(0, buf, len);
+}
+
+static inline int usbcdc_rx_peek(const uint8_t **ptr1, size_t *len1,
+                                 const uint8_t **ptr2, size_t *len2)
+{
+    return usbcdc_n_rx_peek(0, ptr1, len1, ptr2, len2);
+}
+
+static inline int usbcdc_rx_consume(size_t len)
+{
+    return usbcdc_n_rx_consume(0, len);
+}
+
+static inline int usbcdc_rx_wait(unsigned int timeout_ms)
+{
+    return usbcdc_n_rx_wait(0, timeout_ms);
+}
+
+static inline int usbcdc_read_timeout(void *buf, size_t len,
+                                      unsigned int timeout_ms)
+{
+    return usbcdc_n_read_timeout(0, buf, len, timeout_ms);
+}
+
+static inline int usbcdc_get_stats(struct usbcdc_stats *stats)
+{
+    return usbcdc_n_get_stats(0, stats);
+}
 
 #if defined(SEMAPHORE_H)
 extern SemaphoreHandle_t cdc_sem;
 #endif
 
+/* Vendor-class bulk interface, built when usbcdc.c has USBCDC_VENDOR=1 */
+extern int usbvendor_is_connected(void);
+extern int usbvendor_submit(const void *buf, size_t len,
+                            usbvendor_cb_t done, void *ctx);
+extern int usbvendor_receive(void *buf, size_t len,
+                             usbvendor_cb_t done, void *ctx);
+
 #endif  // !LIBPICO_STDIO_USB
 
 EXTERN_C_END
@@ -0,0 +1,243 @@
+/*
+ * ringbuf.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <string.h>
+#include <ringbuf.h>
+
+int ringbuf_init(struct ringbuf *rb, void *buf, size_t size,
+                 enum ringbuf_policy policy)
+{
+    int ret = 0;
+
+    if ((rb == NULL) || (buf == NULL) ||
+        (size == 0) || ((size & (size - 1)) != 0)) {
+        ret = -1;
+        goto done;
+    }
+
+    rb->head = 0;
+    rb->resv = 0;
+    rb->tail = 0;
+    rb->mask = size - 1;
+    rb->buf = (uint8_t *) buf;
+    rb->policy = policy;
+    rb->dropped = 0;
+
+done:
+
+    return ret;
+}
+
+void ringbuf_reset(struct ringbuf *rb)
+{
+    rb->head = 0;
+    rb->resv = 0;
+    rb->tail = 0;
+    rb->dropped = 0;
+}
+
+size_t
+PICO_PLAT_HOT(ringbuf_write)(struct ringbuf *rb, const void *data, size_t len)
+{
+    const uint8_t *src = (const uint8_t *) data;
+    uint32_t size = rb->mask + 1;
+    uint32_t head, tail, off, n;
+
+    head = rb->head;
+
+    if (rb->policy == RINGBUF_DROP_NEW) {
+        tail = __atomic_load_n(&rb->tail, __ATOMIC_ACQUIRE);
+        n = size - (head - tail);
+        if (len > n) {
+            rb->dropped += len - n;
+            len = n;
+        }
+    } else {
+        if (len > size) {
+            src += len - size;
+            head += len - size;
+            len = size;
+        }
+
+        /*
+         * Announce the range about to be overwritten before touching it,
+         * so that a consumer copying from it can tell its copy is stale.
+         */
+        __atomic_store_n(&rb->resv, head + len, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+
+    if (len == 0) {
+        goto done;
+    }
+
+    off = head & rb->mask;
+    n = size - off;
+    if (n > len) {
+        n = len;
+    }
+
+    memcpy(rb->buf + off, src, n);
+    memcpy(rb->buf, src + n, len - n);
+
+    __atomic_store_n(&rb->head, head + len, __ATOMIC_RELEASE);
+
+done:
+
+    return len;
+}
+
+/*
+ * Consumer-side view of what is readable. A RINGBUF_DROP_OLD producer
+ * may have lapped the consumer, in which case the oldest data is gone
+ * and the tail is moved up to the oldest byte still in the ring.
+ */
+static uint32_t
+PICO_PLAT_HOT(ringbuf_avail)(struct ringbuf *rb, uint32_t *ptail)
+{
+    uint32_t size = rb->mask + 1;
+    uint32_t head, tail, used;
+
+    head = __atomic_load_n(&rb->head, __ATOMIC_ACQUIRE);
+    tail = rb->tail;
+    used = head - tail;
+    if (used > size) {
+        rb->dropped += used - size;
+        tail = head - size;
+        used = size;
+    }
+
+    *ptail = tail;
+
+    return used;
+}
+
+size_t PICO_PLAT_HOT(ringbuf_read)(struct ringbuf *rb, void *data, size_t len)
+{
+    uint8_t *dst = (uint8_t *) data;
+    uint32_t size = rb->mask + 1;
+    uint32_t tail, used, off, n;
+
+    for (;;) {
+        used = ringbuf_avail(rb, &tail);
+        if (len > used) {
+            len = used;
+        }
+
+        off = tail & rb->mask;
+        n = size - off;
+        if (n > len) {
+            n = len;
+        }
+
+        memcpy(dst, rb->buf + off, n);
+        memcpy(dst + n, rb->buf, len - n);
+
+        if (rb->policy == RINGBUF_DROP_OLD) {
+            uint32_t resv;
+
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            resv = __atomic_load_n(&rb->resv, __ATOMIC_RELAXED);
+            if (resv - tail > size) {
+                /* Overwritten under us; skip past it and copy again */
+                rb->dropped += resv - size - tail;
+                __atomic_store_n(&rb->tail, resv - size, __ATOMIC_RELEASE);
+                continue;
+            }
+        }
+
+        break;
+    }
+
+    __atomic_store_n(&rb->tail, tail + len, __ATOMIC_RELEASE);
+
+    return len;
+}
+
+size_t PICO_PLAT_HOT(ringbuf_peek)(struct ringbuf *rb,
+                                   const uint8_t **ptr1, size_t *len1,
+                                   const uint8_t **ptr2, size_t *len2)
+{
+    uint32_t size = rb->mask + 1;
+    uint32_t tail, used, off, n;
+
+    used = ringbuf_avail(rb, &tail);
+    if (tail != rb->tail) {
+        __atomic_store_n(&rb->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    off = tail & rb->mask;
+    n = size - off;
+    if (n > used) {
+        n = used;
+    }
+
+    *ptr1 = rb->buf + off;
+    *len1 = n;
+    *ptr2 = rb->buf;
+    *len2 = used - n;
+
+    return used;
+}
+
+size_t PICO_PLAT_HOT(ringbuf_consume)(struct ringbuf *rb, size_t len)
+{
+    uint32_t tail, used;
+
+    used = ringbuf_avail(rb, &tail);
+    if (len > used) {
+        len = used;
+    }
+
+    __atomic_store_n(&rb->tail, tail + len, __ATOMIC_RELEASE);
+
+    return len;
+}
+
+/*
+ * Producer-side counterpart of ringbuf_peek(): the free space starting
+ * at the head, as up to two spans, for the producer to fill in place and
+ * then publish with ringbuf_commit().
+ */
+size_t PICO_PLAT_HOT(ringbuf_reserve)(struct ringbuf *rb,
+                                      uint8_t **ptr1, size_t *len1,
+                                      uint8_t **ptr2, size_t *len2)
+{
+    uint32_t room, off, n;
+
+    room = ringbuf_free(rb);
+    off = rb->head & rb->mask;
+    n = rb->mask + 1 - off;
+    if (n > room) {
+        n = room;
+    }
+
+    *ptr1 = rb->buf + off;
+    *len1 = n;
+    *ptr2 = rb->buf;
+    *len2 = room - n;
+
+    return room;
+}
+
+/*
+ * Publish 'len' bytes the producer placed directly in rb->buf (e.g. by
+ * DMA) starting at the current head.
+ */
+void PICO_PLAT_HOT(ringbuf_commit)(struct ringbuf *rb, size_t len)
+{
+    __atomic_store_n(&rb->head, rb->head + len, __ATOMIC_RELEASE);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
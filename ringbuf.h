@@ -0,0 +1,105 @@
+/*
+ * ringbuf.h
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef RINGBUF_H
+#define RINGBUF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pico-plat.h>
+
+EXTERN_C_BEGIN
+
+/*
+ * Single-producer/single-consumer byte ring. 'head' and 'tail' are
+ * free-running and only ever stored by their owning side (head by the
+ * producer, tail by the consumer) with release ordering, and loaded by
+ * the other side with acquire ordering, so the ring can be shared
+ * between an ISR and a task, or between the two cores, without locks.
+ * Only plain 32-bit loads and stores are used; the Cortex-M0+ has no
+ * exclusive-access instructions to build read-modify-write atomics on.
+ *
+ * The size must be a power of two.
+ */
+
+enum ringbuf_policy {
+    RINGBUF_DROP_NEW = 0,  // producer discards what does not fit
+    RINGBUF_DROP_OLD,      // producer overwrites, consumer skips ahead
+};
+
+struct ringbuf {
+    uint32_t head;         // written by producer
+    uint32_t resv;         // RINGBUF_DROP_OLD: head after pending write
+    uint32_t tail;         // written by consumer
+    uint32_t mask;
+    uint8_t *buf;
+    enum ringbuf_policy policy;
+    uint32_t dropped;      // bytes lost to overflow
+};
+
+#define RINGBUF_INIT(_buf, _size, _policy) {    \
+        .head = 0,                              \
+        .resv = 0,                              \
+        .tail = 0,                              \
+        .mask = (_size) - 1,                    \
+        .buf = (uint8_t *) (_buf),              \
+        .policy = (_policy),                    \
+        .dropped = 0,                           \
+    }
+
+extern int ringbuf_init(struct ringbuf *rb, void *buf, size_t size,
+                        enum ringbuf_policy policy);
+extern void ringbuf_reset(struct ringbuf *rb);
+extern size_t ringbuf_write(struct ringbuf *rb, const void *data, size_t len);
+extern size_t ringbuf_read(struct ringbuf *rb, void *data, size_t len);
+extern size_t ringbuf_peek(struct ringbuf *rb,
+                           const uint8_t **ptr1, size_t *len1,
+                           const uint8_t **ptr2, size_t *len2);
+extern size_t ringbuf_consume(struct ringbuf *rb, size_t len);
+extern size_t ringbuf_reserve(struct ringbuf *rb,
+                              uint8_t **ptr1, size_t *len1,
+                              uint8_t **ptr2, size_t *len2);
+extern void ringbuf_commit(struct ringbuf *rb, size_t len);
+
+static inline size_t ringbuf_size(const struct ringbuf *rb)
+{
+    return rb->mask + 1;
+}
+
+static inline size_t ringbuf_used(const struct ringbuf *rb)
+{
+    uint32_t head = __atomic_load_n(&rb->head, __ATOMIC_ACQUIRE);
+    uint32_t used = head - rb->tail;
+
+    return used > rb->mask + 1 ? rb->mask + 1 : used;
+}
+
+static inline size_t ringbuf_free(const struct ringbuf *rb)
+{
+    uint32_t tail = __atomic_load_n(&rb->tail, __ATOMIC_ACQUIRE);
+    uint32_t used = rb->head - tail;
+
+    return used > rb->mask + 1 ? 0 : rb->mask + 1 - used;
+}
+
+static inline int ringbuf_empty(const struct ringbuf *rb)
+{
+    return __atomic_load_n(&rb->head, __ATOMIC_ACQUIRE) == rb->tail;
+}
+
+EXTERN_C_END
+
+#endif  // RINGBUF_H
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -8,15 +8,20 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <stdarg.h>
+#include <string.h>
 #include <strings.h>
 #include <unistd.h>
 #include <pico/stdio.h>
+#include <pico/time.h>
 #include <hardware/uart.h>
 #include <hardware/gpio.h>
 #include <hardware/sync.h>
+#include <hardware/dma.h>
 #include <FreeRTOS.h>
+#include <task.h>
 #include <semphr.h>
 #include <pico-plat.h>
+#include <ringbuf.h>
 
 #ifndef UART0_TX_PIN
 #define UART0_TX_PIN      0
@@ -38,88 +43,550 @@
 #define UART1_BAUD_RATE   115200
 #endif
 
+/* Longest a clock change waits for a UART to finish sending */
+#ifndef SERIAL_SYSCLOCK_DRAIN_US
+#define SERIAL_SYSCLOCK_DRAIN_US  5000
+#endif
+
 #define UART_DATA_BITS    8
 #define UART_STOP_BITS    1
 #define UART_PARITY       UART_PARITY_NONE
 
+#ifndef SERIAL_BUF_BUF_SIZE
 #define SERIAL_BUF_BUF_SIZE  512
-#define SERIAL_PBUF_SIZE  512
+#endif
+
+#ifndef SERIAL_TX_BUF_SIZE
+#define SERIAL_TX_BUF_SIZE  1024
+#endif
+
+/* Longest a blocked writer sleeps before it looks at the ring again */
+#ifndef SERIAL_TX_WAIT_MS
+#define SERIAL_TX_WAIT_MS  10
+#endif
+
+/*
+ * Optional DMA receive: two chained channels fill the halves of
+ * serial_buf.buf in turn, and the task is woken once per half and once
+ * when the line goes idle, rather than on every RX FIFO threshold.
+ */
+#ifndef SERIAL0_RX_DMA
+#define SERIAL0_RX_DMA    0
+#endif
+#ifndef SERIAL1_RX_DMA
+#define SERIAL1_RX_DMA    0
+#endif
+#ifndef SERIAL_RX_DMA_IRQN
+#define SERIAL_RX_DMA_IRQN     1
+#endif
+#ifndef SERIAL_RX_DMA_IDLE_US
+#define SERIAL_RX_DMA_IDLE_US  1000
+#endif
+
+#define SERIAL_RX_DMA  (SERIAL0_RX_DMA || SERIAL1_RX_DMA)
+#define SERIAL_RX_DMA_HALF  (SERIAL_BUF_BUF_SIZE / 2)
 
 struct serial_buf {
-    unsigned int rp;
-    unsigned int wp;
+    struct ringbuf rx;
     uint32_t marker1;
     char buf[SERIAL_BUF_BUF_SIZE];
     uint32_t marker2;
-    char pbuf[SERIAL_PBUF_SIZE];
-    uint32_t marker3;
 };
 
 static struct serial_buf uart0_buf = {
-    .rp = 0,
-    .wp = 0,
+    .rx = RINGBUF_INIT(uart0_buf.buf, SERIAL_BUF_BUF_SIZE, RINGBUF_DROP_NEW),
     .marker1 = 0x12345678,
     .buf = { 0, },
     .marker2 = 0x12345678,
-    .pbuf = { 0, },
-    .marker3 = 0x12345678,
 };
 
 static struct serial_buf uart1_buf = {
-    .rp = 0,
-    .wp = 0,
+    .rx = RINGBUF_INIT(uart1_buf.buf, SERIAL_BUF_BUF_SIZE, RINGBUF_DROP_NEW),
     .marker1 = 0x12345678,
     .buf = { 0, },
     .marker2 = 0x12345678,
-    .pbuf = { 0, },
-    .marker3 = 0x12345678,
+};
+
+/*
+ * Transmit ring drained by the UART TX interrupt. The writer side is
+ * serialized by 'mutex', the FIFO side (task priming + ISR) by 'lock'.
+ * 'paused' keeps the FIFO from being fed across a clock change.
+ */
+struct serial_tx {
+    struct ringbuf ring;
+    char buf[SERIAL_TX_BUF_SIZE];
+    spin_lock_t *lock;
+    SemaphoreHandle_t sem;
+    SemaphoreHandle_t mutex;
+    bool block;
+    volatile bool paused;
+    struct serial_stats stats;
+};
+
+static struct serial_tx uart0_tx = {
+    .ring = RINGBUF_INIT(uart0_tx.buf, SERIAL_TX_BUF_SIZE, RINGBUF_DROP_NEW),
+};
+
+static struct serial_tx uart1_tx = {
+    .ring = RINGBUF_INIT(uart1_tx.buf, SERIAL_TX_BUF_SIZE, RINGBUF_DROP_NEW),
 };
 
 SemaphoreHandle_t uart0_sem = NULL;
 SemaphoreHandle_t uart1_sem = NULL;
 
-static void serial0_interrupt_handler(void)
+/*
+ * The RX semaphores are binary, so only one task may sleep on each at a
+ * time; blocking readers queue up on these first.
+ */
+static SemaphoreHandle_t uart0_rx_mutex = NULL;
+static SemaphoreHandle_t uart1_rx_mutex = NULL;
+
+/* Interrupts are live, on the I/O core if there is one */
+static volatile bool serial_irq_ready = false;
+
+#if SERIAL_RX_DMA
+
+struct serial_rx_dma {
+    int chan[2];
+    volatile uint32_t halves;   // halves completed, free-running
+    unsigned int idle_pos;
+    unsigned int signalled;
+    repeating_timer_t timer;
+};
+
+static struct serial_rx_dma uart0_rx_dma = { .chan = { -1, -1, }, };
+static struct serial_rx_dma uart1_rx_dma = { .chan = { -1, -1, }, };
+
+/*
+ * Offset in serial_buf.buf that DMA will write next. Whichever channel is
+ * busy owns the write pointer; in the gap between the two halves the idle
+ * one already points at where its partner starts.
+ */
+static unsigned int
+PICO_PLAT_HOT(serial_rx_dma_pos)(const struct serial_buf *serial_buf,
+                                 const struct serial_rx_dma *rx_dma)
+{
+    const dma_channel_hw_t *ch;
+
+    ch = dma_channel_hw_addr(rx_dma->chan[0]);
+    if (!dma_channel_is_busy(rx_dma->chan[0])) {
+        ch = dma_channel_hw_addr(rx_dma->chan[1]);
+    }
+
+    return (ch->write_addr - (uint32_t) (uintptr_t) serial_buf->buf) %
+        SERIAL_BUF_BUF_SIZE;
+}
+
+static void
+PICO_PLAT_HOT(serial_rx_dma_service)(struct serial_buf *serial_buf,
+                                     struct serial_rx_dma *rx_dma,
+                                     SemaphoreHandle_t sem,
+                                     BaseType_t *pxHigherPriorityTaskWoken)
+{
+    for (unsigned int i = 0; i < 2; i++) {
+        int chan = rx_dma->chan[i];
+
+        if ((chan < 0) ||
+            !dma_irqn_get_channel_status(SERIAL_RX_DMA_IRQN, chan)) {
+            continue;
+        }
+
+        dma_irqn_acknowledge_channel(SERIAL_RX_DMA_IRQN, chan);
+
+        /* Re-arm this half for when its partner chains back to it */
+        dma_channel_set_write_addr(chan,
+                                   serial_buf->buf + i * SERIAL_RX_DMA_HALF,
+                                   false);
+        dma_channel_set_trans_count(chan, SERIAL_RX_DMA_HALF, false);
+        rx_dma->halves++;
+
+        xSemaphoreGiveFromISR(sem, pxHigherPriorityTaskWoken);
+    }
+}
+
+static void PICO_PLAT_HOT(serial_rx_dma_interrupt_handler)(void)
+{
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+    serial_rx_dma_service(&uart0_buf, &uart0_rx_dma, uart0_sem,
+                          &xHigherPriorityTaskWoken);
+    serial_rx_dma_service(&uart1_buf, &uart1_rx_dma, uart1_sem,
+                          &xHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
+/*
+ * Idle-line detection. The RX DREQ drains the UART FIFO one character at
+ * a time, so the receive-timeout interrupt never sees a non-empty FIFO
+ * and cannot be used. Instead the DMA position is sampled every
+ * SERIAL_RX_DMA_IDLE_US and a partial buffer is signalled once the
+ * position has stopped moving.
+ */
+static bool
+PICO_PLAT_HOT(serial_rx_dma_idle)(const struct serial_buf *serial_buf,
+                                  struct serial_rx_dma *rx_dma,
+                                  SemaphoreHandle_t sem)
 {
-    unsigned int wp;
-    volatile char *dst;
     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    unsigned int pos;
 
-    dst = uart0_buf.buf;
-    wp = uart0_buf.wp;
-    while (uart_is_readable(uart0)) {
-        dst[wp] = (char) uart_get_hw(uart0)->dr;
-        wp = ((wp + 1) % SERIAL_BUF_BUF_SIZE);
+    pos = serial_rx_dma_pos(serial_buf, rx_dma);
+    if (pos != rx_dma->idle_pos) {
+        rx_dma->idle_pos = pos;
+    } else if (pos != rx_dma->signalled) {
+        rx_dma->signalled = pos;
+        xSemaphoreGiveFromISR(sem, &xHigherPriorityTaskWoken);
     }
-    uart0_buf.wp = wp;
 
-    xSemaphoreGiveFromISR(uart0_sem, &xHigherPriorityTaskWoken);
     portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+
+    return true;
+}
+
+#if SERIAL0_RX_DMA
+static bool PICO_PLAT_HOT(serial0_rx_dma_idle)(repeating_timer_t *rt)
+{
+    (void)(rt);
+
+    return serial_rx_dma_idle(&uart0_buf, &uart0_rx_dma, uart0_sem);
+}
+#endif
+
+#if SERIAL1_RX_DMA
+static bool PICO_PLAT_HOT(serial1_rx_dma_idle)(repeating_timer_t *rt)
+{
+    (void)(rt);
+
+    return serial_rx_dma_idle(&uart1_buf, &uart1_rx_dma, uart1_sem);
+}
+#endif
+
+static void serial_rx_dma_init(uart_inst_t *uart, struct serial_buf *serial_buf,
+                               struct serial_rx_dma *rx_dma,
+                               repeating_timer_callback_t idle_cb)
+{
+    dma_channel_config c;
+    static bool irq_installed = false;
+
+    rx_dma->chan[0] = dma_claim_unused_channel(true);
+    rx_dma->chan[1] = dma_claim_unused_channel(true);
+
+    for (unsigned int i = 0; i < 2; i++) {
+        c = dma_channel_get_default_config(rx_dma->chan[i]);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        channel_config_set_dreq(&c, uart_get_dreq(uart, false));
+        channel_config_set_chain_to(&c, rx_dma->chan[i ^ 1]);
+        dma_channel_configure(rx_dma->chan[i], &c,
+                              serial_buf->buf + i * SERIAL_RX_DMA_HALF,
+                              &uart_get_hw(uart)->dr,
+                              SERIAL_RX_DMA_HALF, false);
+        dma_irqn_set_channel_enabled(SERIAL_RX_DMA_IRQN, rx_dma->chan[i],
+                                     true);
+    }
+
+    if (!irq_installed) {
+        irq_add_shared_handler(DMA_IRQ_0 + SERIAL_RX_DMA_IRQN,
+                               serial_rx_dma_interrupt_handler,
+                               PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+        irq_set_enabled(DMA_IRQ_0 + SERIAL_RX_DMA_IRQN, true);
+        irq_installed = true;
+    }
+
+    hw_set_bits(&uart_get_hw(uart)->dmacr, UART_UARTDMACR_RXDMAE_BITS);
+    dma_channel_start(rx_dma->chan[0]);
+
+#if (PICO_PLAT_IO_CORE >= 0)
+    /* The default alarm pool fires on core 0; use one on the I/O core */
+    static alarm_pool_t *pool = NULL;
+
+    if (pool == NULL) {
+        pool = alarm_pool_create_with_unused_hardware_alarm(2);
+    }
+    alarm_pool_add_repeating_timer_us(pool, -SERIAL_RX_DMA_IDLE_US, idle_cb,
+                                      NULL, &rx_dma->timer);
+#else
+    add_repeating_timer_us(-SERIAL_RX_DMA_IDLE_US, idle_cb, NULL,
+                           &rx_dma->timer);
+#endif
+}
+
+#endif  // SERIAL_RX_DMA
+
+/*
+ * In DMA receive mode nothing in interrupt context advances the ring's
+ * head; publish whatever DMA has written since before reading the ring.
+ * The DMA position alone only says where it is within the buffer, so
+ * the count of halves completed makes it a free-running one: if DMA has
+ * lapped the reader, the head then runs more than a ring's length ahead
+ * of the tail, and the ring skips the overwritten bytes and counts them
+ * as dropped. That holds while the DMA interrupt is at most one half
+ * behind.
+ */
+static inline void serial_rx_update(unsigned int inst,
+                                    struct serial_buf *serial_buf)
+{
+#if SERIAL_RX_DMA
+    struct serial_rx_dma *rx_dma = NULL;
+    uint32_t base, pos;
+
+    switch (inst) {
+    case 0:  rx_dma = SERIAL0_RX_DMA ? &uart0_rx_dma : NULL; break;
+    case 1:  rx_dma = SERIAL1_RX_DMA ? &uart1_rx_dma : NULL; break;
+    default: break;
+    }
+
+    if (rx_dma != NULL) {
+        base = rx_dma->halves * SERIAL_RX_DMA_HALF;
+        pos = serial_rx_dma_pos(serial_buf, rx_dma);
+        pos = base + ((pos - base) & serial_buf->rx.mask);
+        if ((int32_t) (pos - serial_buf->rx.head) > 0) {
+            ringbuf_commit(&serial_buf->rx, pos - serial_buf->rx.head);
+        }
+    }
+#else
+    (void)(inst);
+    (void)(serial_buf);
+#endif
 }
 
-static void serial1_interrupt_handler(void)
+/*
+ * Interrupt-driven receive: empty the RX FIFO into the ring in one bulk
+ * copy per FIFO's worth.
+ */
+static inline void serial_rx_drain(uart_inst_t *uart,
+                                   struct serial_buf *serial_buf,
+                                   SemaphoreHandle_t sem,
+                                   BaseType_t *pxHigherPriorityTaskWoken)
+{
+    uint8_t fifo[32];
+    unsigned int count;
+    bool received = false;
+
+    do {
+        count = 0;
+        while ((count < sizeof(fifo)) && uart_is_readable(uart)) {
+            fifo[count] = (uint8_t) uart_get_hw(uart)->dr;
+            count++;
+        }
+
+        if (count > 0) {
+            ringbuf_write(&serial_buf->rx, fifo, count);
+            received = true;
+        }
+    } while (count == sizeof(fifo));
+
+    if (received) {
+        xSemaphoreGiveFromISR(sem, pxHigherPriorityTaskWoken);
+    }
+}
+
+/*
+ * Move as much as fits from the transmit ring into the UART FIFO. The TX
+ * interrupt stays enabled only while the ring still holds data, so an
+ * idle UART costs no interrupts. Caller holds tx->lock.
+ */
+static unsigned int
+PICO_PLAT_HOT(serial_tx_pump)(uart_inst_t *uart, struct serial_tx *tx)
+{
+    unsigned int count = 0;
+    const uint8_t *ptr1, *ptr2;
+    size_t len1, len2;
+
+    if (tx->paused) {
+        hw_clear_bits(&uart_get_hw(uart)->imsc, UART_UARTIMSC_TXIM_BITS);
+        return 0;
+    }
+
+    ringbuf_peek(&tx->ring, &ptr1, &len1, &ptr2, &len2);
+    while ((count < len1) && uart_is_writable(uart)) {
+        uart_get_hw(uart)->dr = ptr1[count];
+        count++;
+    }
+    while ((count >= len1) && (count < len1 + len2) &&
+           uart_is_writable(uart)) {
+        uart_get_hw(uart)->dr = ptr2[count - len1];
+        count++;
+    }
+    ringbuf_consume(&tx->ring, count);
+    tx->stats.tx_sent += count;
+
+    if (!ringbuf_empty(&tx->ring)) {
+        hw_set_bits(&uart_get_hw(uart)->imsc, UART_UARTIMSC_TXIM_BITS);
+    } else {
+        hw_clear_bits(&uart_get_hw(uart)->imsc, UART_UARTIMSC_TXIM_BITS);
+    }
+
+    return count;
+}
+
+/*
+ * Get the FIFO going after a write, with tx->lock held. A writer on
+ * another core than the I/O core leaves that to the TX interrupt, taken
+ * on the I/O core, if it is pending; the PL011 raises it when the FIFO
+ * level drops, so a UART that has not sent anything yet is primed here.
+ */
+static void serial_tx_start(uart_inst_t *uart, struct serial_tx *tx)
+{
+#if (PICO_PLAT_IO_CORE >= 0)
+    if (serial_irq_ready && !tx->paused &&
+        (get_core_num() != PICO_PLAT_IO_CORE) &&
+        (uart_get_hw(uart)->ris & UART_UARTRIS_TXRIS_BITS)) {
+        hw_set_bits(&uart_get_hw(uart)->imsc, UART_UARTIMSC_TXIM_BITS);
+        return;
+    }
+#endif
+
+    serial_tx_pump(uart, tx);
+}
+
+static void
+PICO_PLAT_HOT(serial_tx_service)(uart_inst_t *uart, struct serial_tx *tx,
+                                 BaseType_t *pxHigherPriorityTaskWoken)
+{
+    uint32_t save;
+
+    save = spin_lock_blocking(tx->lock);
+    serial_tx_pump(uart, tx);
+    spin_unlock(tx->lock, save);
+
+    if (tx->sem) {
+        xSemaphoreGiveFromISR(tx->sem, pxHigherPriorityTaskWoken);
+    }
+}
+
+static void PICO_PLAT_HOT(serial0_interrupt_handler)(void)
 {
-    unsigned int wp;
-    volatile char *dst;
     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
 
-    dst = uart1_buf.buf;
-    wp = uart1_buf.wp;
-    while (uart_is_readable(uart1)) {
-        dst[wp] = (char) uart_get_hw(uart1)->dr;
-        wp = ((wp + 1) % SERIAL_BUF_BUF_SIZE);
+#if !SERIAL0_RX_DMA
+    serial_rx_drain(uart0, &uart0_buf, uart0_sem, &xHigherPriorityTaskWoken);
+#endif
+
+    if (uart_get_hw(uart0)->mis & UART_UARTMIS_TXMIS_BITS) {
+        serial_tx_service(uart0, &uart0_tx, &xHigherPriorityTaskWoken);
+    }
+
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
+static void PICO_PLAT_HOT(serial1_interrupt_handler)(void)
+{
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+#if !SERIAL1_RX_DMA
+    serial_rx_drain(uart1, &uart1_buf, uart1_sem, &xHigherPriorityTaskWoken);
+#endif
+
+    if (uart_get_hw(uart1)->mis & UART_UARTMIS_TXMIS_BITS) {
+        serial_tx_service(uart1, &uart1_tx, &xHigherPriorityTaskWoken);
     }
-    uart1_buf.wp = wp;
 
-    xSemaphoreGiveFromISR(uart1_sem, &xHigherPriorityTaskWoken);
     portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 }
 
+/*
+ * Enable the UART and RX DMA interrupts on the calling core, which is
+ * then the one that takes them.
+ */
+static void serial_irq_init(void *arg)
+{
+    (void) arg;
+
+    irq_set_enabled(UART0_IRQ, true);
+#if SERIAL0_RX_DMA
+    uart_set_irq_enables(uart0, false, false);
+    serial_rx_dma_init(uart0, &uart0_buf, &uart0_rx_dma, serial0_rx_dma_idle);
+#else
+    uart_set_irq_enables(uart0, true, false);
+#endif
+
+    irq_set_enabled(UART1_IRQ, true);
+#if SERIAL1_RX_DMA
+    uart_set_irq_enables(uart1, false, false);
+    serial_rx_dma_init(uart1, &uart1_buf, &uart1_rx_dma, serial1_rx_dma_idle);
+#else
+    uart_set_irq_enables(uart1, true, false);
+#endif
+
+    serial_irq_ready = true;
+}
+
+/*
+ * Stop feeding the FIFO, TX interrupt included, and wait for what is in
+ * it to go out: empty, and the last byte off the shifter.
+ */
+static void serial_tx_pause(uart_inst_t *uart, struct serial_tx *tx)
+{
+    absolute_time_t until = make_timeout_time_us(SERIAL_SYSCLOCK_DRAIN_US);
+    uint32_t save;
+
+    save = spin_lock_blocking(tx->lock);
+    tx->paused = true;
+    hw_clear_bits(&uart_get_hw(uart)->imsc, UART_UARTIMSC_TXIM_BITS);
+    spin_unlock(tx->lock, save);
+
+    while (((uart_get_hw(uart)->fr & UART_UARTFR_TXFE_BITS) == 0 ||
+            (uart_get_hw(uart)->fr & UART_UARTFR_BUSY_BITS)) &&
+           !time_reached(until)) {
+        tight_loop_contents();
+    }
+}
+
+/* Feed the FIFO again, from what queued up in the ring meanwhile */
+static void serial_tx_resume(uart_inst_t *uart, struct serial_tx *tx)
+{
+    uint32_t save;
+
+    save = spin_lock_blocking(tx->lock);
+    tx->paused = false;
+    serial_tx_pump(uart, tx);
+    spin_unlock(tx->lock, save);
+}
+
+/*
+ * The baud dividers are derived from clk_peri, which follows clk_sys:
+ * hold the rings back and let the FIFOs go out at the old rate, then
+ * re-derive the dividers and carry on. Writers keep queueing meanwhile.
+ */
+static void serial_sysclock_cb(void *ctx, int event, uint32_t hz)
+{
+    (void) ctx;
+    (void) hz;
+
+    if (event == SYSCLOCK_CHANGING) {
+        serial_tx_pause(uart0, &uart0_tx);
+        serial_tx_pause(uart1, &uart1_tx);
+    } else if (event == SYSCLOCK_CHANGED) {
+        uart_set_baudrate(uart0, UART0_BAUD_RATE);
+        uart_set_baudrate(uart1, UART1_BAUD_RATE);
+        serial_tx_resume(uart0, &uart0_tx);
+        serial_tx_resume(uart1, &uart1_tx);
+    }
+}
+
 void serial_init(void)
 {
     uart0_sem = xSemaphoreCreateBinary();
     assert(uart0_sem != NULL);
     uart1_sem = xSemaphoreCreateBinary();
     assert(uart1_sem != NULL);
+    uart0_rx_mutex = xSemaphoreCreateMutex();
+    assert(uart0_rx_mutex != NULL);
+    uart1_rx_mutex = xSemaphoreCreateMutex();
+    assert(uart1_rx_mutex != NULL);
+
+    uart0_tx.lock = spin_lock_instance(spin_lock_claim_unused(true));
+    uart0_tx.sem = xSemaphoreCreateBinary();
+    assert(uart0_tx.sem != NULL);
+    uart0_tx.mutex = xSemaphoreCreateMutex();
+    assert(uart0_tx.mutex != NULL);
+    uart1_tx.lock = spin_lock_instance(spin_lock_claim_unused(true));
+    uart1_tx.sem = xSemaphoreCreateBinary();
+    assert(uart1_tx.sem != NULL);
+    uart1_tx.mutex = xSemaphoreCreateMutex();
+    assert(uart1_tx.mutex != NULL);
 
     uart_init(uart0, UART0_BAUD_RATE);
     gpio_set_function(UART0_TX_PIN, GPIO_FUNC_UART);
@@ -128,8 +595,6 @@ void serial_init(void)
     uart_set_fifo_enabled(uart0, true);
     uart_set_format(uart0, UART_DATA_BITS, UART_STOP_BITS, UART_PARITY);
     irq_set_exclusive_handler(UART0_IRQ, serial0_interrupt_handler);
-    irq_set_enabled(UART0_IRQ, true);
-    uart_set_irq_enables(uart0, true, false);
 
     uart_init(uart1, UART1_BAUD_RATE);
     gpio_set_function(UART1_TX_PIN, GPIO_FUNC_UART);
@@ -138,16 +603,30 @@ void serial_init(void)
     uart_set_fifo_enabled(uart1, true);
     uart_set_format(uart1, UART_DATA_BITS, UART_STOP_BITS, UART_PARITY);
     irq_set_exclusive_handler(UART1_IRQ, serial1_interrupt_handler);
-    irq_set_enabled(UART1_IRQ, true);
-    uart_set_irq_enables(uart1, true, false);
+
+    iocore_run(serial_irq_init, NULL);
+    sysclock_add_listener(serial_sysclock_cb, NULL);
 }
 
 void serial_deinit(void)
 {
+    sysclock_remove_listener(serial_sysclock_cb, NULL);
     vSemaphoreDelete(uart0_sem);
     uart0_sem = NULL;
     vSemaphoreDelete(uart1_sem);
     uart1_sem = NULL;
+    vSemaphoreDelete(uart0_rx_mutex);
+    uart0_rx_mutex = NULL;
+    vSemaphoreDelete(uart1_rx_mutex);
+    uart1_rx_mutex = NULL;
+    vSemaphoreDelete(uart0_tx.sem);
+    uart0_tx.sem = NULL;
+    vSemaphoreDelete(uart0_tx.mutex);
+    uart0_tx.mutex = NULL;
+    vSemaphoreDelete(uart1_tx.sem);
+    uart1_tx.sem = NULL;
+    vSemaphoreDelete(uart1_tx.mutex);
+    uart1_tx.mutex = NULL;
 }
 
 int serial_check_markers(unsigned int inst)
@@ -167,9 +646,6 @@ int serial_check_markers(unsigned int inst)
     } else if (serial_buf->marker2 != 0x12345678) {
         ret = 2;
         goto done;
-    } else if (serial_buf->marker3 != 0x12345678) {
-        ret = 4;
-        goto done;
     }
 
 done:
@@ -177,24 +653,230 @@ done:
     return ret;
 }
 
+static inline TickType_t serial_ms_to_ticks(unsigned int timeout_ms)
+{
+    return (timeout_ms == SERIAL_WAIT_FOREVER) ?
+        portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+}
+
+static inline TickType_t serial_tx_wait_ticks(void)
+{
+    TickType_t ticks = pdMS_TO_TICKS(SERIAL_TX_WAIT_MS);
+
+    return (ticks > 0) ? ticks : 1;
+}
+
+/*
+ * Queue 'len' bytes on the transmit ring and prime the UART FIFO. With
+ * 'block' set, wait on tx->sem for the TX interrupt to make room instead
+ * of truncating, and look again every SERIAL_TX_WAIT_MS regardless, so
+ * that a give missed to serial_flush() or lost to a race cannot leave it
+ * asleep. Before the scheduler runs there is nothing to wait on, so the
+ * FIFO is drained by polling instead. Task context only: the ring has a
+ * single producer, the writer holding tx->mutex.
+ */
+static int serial_tx_put(uart_inst_t *uart, struct serial_tx *tx,
+                         const uint8_t *data, size_t len, bool block)
+{
+    int ret = 0;
+    bool can_sleep;
+    uint32_t save;
+
+    can_sleep = (tx->sem != NULL) && !portCHECK_IF_IN_ISR() &&
+        (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING);
+
+    while (len > 0) {
+        size_t room;
+
+        room = ringbuf_free(&tx->ring);
+        if (room > len) {
+            room = len;
+        }
+
+        ringbuf_write(&tx->ring, data, room);
+        tx->stats.tx_queued += room;
+        data += room;
+        len -= room;
+        ret += room;
+
+        save = spin_lock_blocking(tx->lock);
+        serial_tx_start(uart, tx);
+        spin_unlock(tx->lock, save);
+
+        if (len == 0) {
+            break;
+        }
+
+        tx->stats.tx_stalls++;
+        if (!block) {
+            break;
+        }
+
+        if (can_sleep) {
+            xSemaphoreTake(tx->sem, serial_tx_wait_ticks());
+        } else {
+            while (!uart_is_writable(uart)) {
+                tight_loop_contents();
+            }
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * From an interrupt handler, where tx->mutex cannot be taken, go around
+ * the ring and straight into the UART FIFO, as many bytes as it has room
+ * for, or all of them by polling with 'block' set. tx->lock keeps each
+ * byte from landing in the middle of a pump. The bytes go out ahead of
+ * anything still in the ring. Across a clock change nothing goes, even
+ * with 'block' set: the change may be waiting on this very core.
+ */
+static int serial_tx_direct(uart_inst_t *uart, struct serial_tx *tx,
+                            const uint8_t *data, size_t len, bool block)
+{
+    int ret = 0;
+    bool sent, paused;
+    uint32_t save;
+
+    while ((size_t) ret < len) {
+        save = spin_lock_blocking(tx->lock);
+        paused = tx->paused;
+        sent = !paused && uart_is_writable(uart);
+        if (sent) {
+            uart_get_hw(uart)->dr = data[ret];
+            tx->stats.tx_queued++;
+            tx->stats.tx_sent++;
+        }
+        spin_unlock(tx->lock, save);
+
+        if (sent) {
+            ret++;
+        } else if (block && !paused) {
+            tight_loop_contents();
+        } else {
+            tx->stats.tx_stalls++;
+            break;
+        }
+    }
+
+    return ret;
+}
+
 int serial_write(unsigned int inst, const uint8_t *data, size_t len)
 {
     int ret = 0;
     uart_inst_t *uart = NULL;
+    struct serial_tx *tx = NULL;
+    bool locked = false;
 
     switch (inst) {
-    case 0:  uart = uart0; break;
-    case 1:  uart = uart1; break;
+    case 0:  uart = uart0; tx = &uart0_tx; break;
+    case 1:  uart = uart1; tx = &uart1_tx; break;
     default: ret = -1; goto done; break;
     }
 
-    for (size_t i = 0; i < len; i++) {
-        if (!uart_is_writable(uart)) {
-            break;
+    if (portCHECK_IF_IN_ISR()) {
+        ret = serial_tx_direct(uart, tx, data, len, false);
+        goto done;
+    }
+
+    if ((tx->mutex != NULL) &&
+        (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)) {
+        xSemaphoreTake(tx->mutex, portMAX_DELAY);
+        locked = true;
+    }
+
+    ret = serial_tx_put(uart, tx, data, len, tx->block);
+
+    if (locked) {
+        xSemaphoreGive(tx->mutex);
+    }
+
+done:
+
+    return ret;
+}
+
+void serial_set_tx_blocking(unsigned int inst, int block)
+{
+    switch (inst) {
+    case 0:  uart0_tx.block = block; break;
+    case 1:  uart1_tx.block = block; break;
+    default: break;
+    }
+}
+
+int serial_flush(unsigned int inst, unsigned int timeout_ms)
+{
+    int ret = 0;
+    uart_inst_t *uart = NULL;
+    struct serial_tx *tx = NULL;
+    TimeOut_t timeout;
+    TickType_t ticks, wait;
+    bool locked = false;
+
+    switch (inst) {
+    case 0:  uart = uart0; tx = &uart0_tx; break;
+    case 1:  uart = uart1; tx = &uart1_tx; break;
+    default: ret = -1; goto done; break;
+    }
+
+    ticks = serial_ms_to_ticks(timeout_ms);
+    vTaskSetTimeOutState(&timeout);
+
+    /*
+     * Hold off writers meanwhile: they wait on tx->sem too, and one left
+     * behind holding tx->mutex would stall every later write
+     */
+    if (xSemaphoreTake(tx->mutex, ticks) != pdTRUE) {
+        ret = -1;
+        goto done;
+    }
+    locked = true;
+
+    /* Wait for the ring to empty, then for the FIFO and shifter */
+    while (!ringbuf_empty(&tx->ring)) {
+        if (xTaskCheckForTimeOut(&timeout, &ticks) != pdFALSE) {
+            ret = -1;
+            goto done;
         }
+        wait = serial_tx_wait_ticks();
+        xSemaphoreTake(tx->sem, (ticks < wait) ? ticks : wait);
+    }
+
+    while (uart_get_hw(uart)->fr & UART_UARTFR_BUSY_BITS) {
+        if (xTaskCheckForTimeOut(&timeout, &ticks) != pdFALSE) {
+            ret = -1;
+            goto done;
+        }
+        vTaskDelay(1);
+    }
+
+done:
+
+    if (locked) {
+        xSemaphoreGive(tx->mutex);
+    }
+
+    return ret;
+}
+
+int serial_get_stats(unsigned int inst, struct serial_stats *stats)
+{
+    int ret = 0;
+    struct serial_tx *tx = NULL;
+    struct serial_buf *serial_buf = NULL;
 
-        uart_get_hw(uart)->dr = data[i];
-        ret++;
+    switch (inst) {
+    case 0:  tx = &uart0_tx; serial_buf = &uart0_buf; break;
+    case 1:  tx = &uart1_tx; serial_buf = &uart1_buf; break;
+    default: ret = -1; goto done; break;
+    }
+
+    if (stats) {
+        *stats = tx->stats;
+        stats->rx_dropped = serial_buf->rx.dropped;
     }
 
 done:
@@ -214,25 +896,59 @@ int serial_printf(unsigned int inst, const char *format, ...)
     return ret;
 }
 
+struct serial_sink {
+    uart_inst_t *uart;
+    struct serial_tx *tx;
+    int (*put)(uart_inst_t *uart, struct serial_tx *tx,
+               const uint8_t *data, size_t len, bool block);
+};
+
+/*
+ * fmt_vprintf() sink: queue the formatted chunk straight into the TX
+ * ring (the FIFO, from an interrupt handler), splitting it at each '\n'
+ * so that whole spans go in at once with a "\r\n" in place of the bare
+ * newline.
+ */
+static void serial_sink(void *ctx, const char *s, size_t len)
+{
+    struct serial_sink *sink = (struct serial_sink *) ctx;
+    const char *nl;
+
+    while ((nl = memchr(s, '\n', len)) != NULL) {
+        sink->put(sink->uart, sink->tx, (const uint8_t *) s, nl - s, true);
+        sink->put(sink->uart, sink->tx, (const uint8_t *) "\r\n", 2, true);
+        len -= nl - s + 1;
+        s = nl + 1;
+    }
+
+    sink->put(sink->uart, sink->tx, (const uint8_t *) s, len, true);
+}
+
 int serial_vprintf(unsigned int inst, const char *format, va_list ap)
 {
     int ret = 0;
-    char *pbuf = NULL;
+    struct serial_sink sink;
+    bool locked = false;
 
     switch (inst) {
-    case 0:  pbuf = uart0_buf.pbuf; break;
-    case 1:  pbuf = uart1_buf.pbuf; break;
+    case 0:  sink.uart = uart0; sink.tx = &uart0_tx; break;
+    case 1:  sink.uart = uart1; sink.tx = &uart1_tx; break;
     default: ret = -1; goto done; break;
     }
 
-    ret = vsnprintf(pbuf, SERIAL_PBUF_SIZE - 1, format, ap);
+    sink.put = serial_tx_put;
+    if (portCHECK_IF_IN_ISR()) {
+        sink.put = serial_tx_direct;
+    } else if ((sink.tx->mutex != NULL) &&
+               (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)) {
+        xSemaphoreTake(sink.tx->mutex, portMAX_DELAY);
+        locked = true;
+    }
 
-    for (int i = 0; (i < ret) && (i < SERIAL_PBUF_SIZE); i++) {
-        if (pbuf[i] == '\n') {
-            while (serial_write(inst, (const uint8_t *) "\r", 1) != 1);
-        }
+    ret = fmt_vprintf(serial_sink, &sink, format, ap);
 
-        while (serial_write(inst, (const uint8_t *) (pbuf + i), 1) != 1);
+    if (locked) {
+        xSemaphoreGive(sink.tx->mutex);
     }
 
 done:
@@ -251,11 +967,8 @@ int serial_rx_ready(unsigned int inst)
     default: ret = -1; goto done; break;
     }
 
-    if (serial_buf->wp < serial_buf->rp) {
-        ret = SERIAL_BUF_BUF_SIZE - serial_buf->rp + serial_buf->wp;
-    } else {
-        ret = serial_buf->wp - serial_buf->rp;
-    }
+    serial_rx_update(inst, serial_buf);
+    ret = ringbuf_used(&serial_buf->rx);
 
 done:
 
@@ -266,9 +979,6 @@ int serial_read(unsigned int inst, uint8_t *data, size_t len)
 {
     int ret = 0;
     struct serial_buf *serial_buf = NULL;
-    const uint8_t *src;
-    unsigned int rp, wp;
-    size_t size;
 
     switch (inst) {
     case 0:  serial_buf = &uart0_buf; break;
@@ -276,19 +986,229 @@ int serial_read(unsigned int inst, uint8_t *data, size_t len)
     default: ret = -1; goto done; break;
     }
 
-    src = (const uint8_t *) serial_buf->buf;
-    size = SERIAL_BUF_BUF_SIZE;
-    rp = serial_buf->rp;
-    wp = serial_buf->wp;
-    while ((len > 0) && (rp != wp)) {
-        *data = src[rp];
-        data++;
-        len--;
-        ret++;
-        rp = (rp + 1) % size;
+    serial_rx_update(inst, serial_buf);
+    ret = ringbuf_read(&serial_buf->rx, data, len);
+
+done:
+
+    return ret;
+}
+
+/*
+ * Zero-copy receive: expose the unread part of the RX ring as at most two
+ * contiguous regions. They stay valid until serial_rx_consume() releases
+ * them, so a parser can work in place and consume only what it used.
+ */
+int serial_rx_peek(unsigned int inst,
+                   const uint8_t **ptr1, size_t *len1,
+                   const uint8_t **ptr2, size_t *len2)
+{
+    int ret = 0;
+    struct serial_buf *serial_buf = NULL;
+
+    switch (inst) {
+    case 0:  serial_buf = &uart0_buf; break;
+    case 1:  serial_buf = &uart1_buf; break;
+    default: ret = -1; goto done; break;
     }
 
-    serial_buf->rp = rp;
+    serial_rx_update(inst, serial_buf);
+    ret = ringbuf_peek(&serial_buf->rx, ptr1, len1, ptr2, len2);
+
+done:
+
+    return ret;
+}
+
+int serial_rx_consume(unsigned int inst, size_t len)
+{
+    int ret = 0;
+    struct serial_buf *serial_buf = NULL;
+
+    switch (inst) {
+    case 0:  serial_buf = &uart0_buf; break;
+    case 1:  serial_buf = &uart1_buf; break;
+    default: ret = -1; goto done; break;
+    }
+
+    ret = ringbuf_consume(&serial_buf->rx, len);
+
+done:
+
+    return ret;
+}
+
+/*
+ * Sleep on the RX semaphore until the ring has data or the deadline
+ * passes. The ring is always checked before sleeping, so a give that
+ * raced ahead of us only costs one extra loop. Caller holds the RX mutex.
+ */
+static int serial_rx_wait_locked(unsigned int inst,
+                                 struct serial_buf *serial_buf,
+                                 SemaphoreHandle_t sem,
+                                 TimeOut_t *timeout, TickType_t *ticks)
+{
+    int ret;
+
+    for (;;) {
+        serial_rx_update(inst, serial_buf);
+        ret = ringbuf_used(&serial_buf->rx);
+        if (ret > 0) {
+            break;
+        }
+
+        if (xTaskCheckForTimeOut(timeout, ticks) != pdFALSE) {
+            break;
+        }
+
+        xSemaphoreTake(sem, *ticks);
+    }
+
+    return ret;
+}
+
+static int serial_rx_select(unsigned int inst,
+                            struct serial_buf **serial_buf,
+                            SemaphoreHandle_t *sem, SemaphoreHandle_t *mutex)
+{
+    int ret = 0;
+
+    switch (inst) {
+    case 0:
+        *serial_buf = &uart0_buf;
+        *sem = uart0_sem;
+        *mutex = uart0_rx_mutex;
+        break;
+    case 1:
+        *serial_buf = &uart1_buf;
+        *sem = uart1_sem;
+        *mutex = uart1_rx_mutex;
+        break;
+    default:
+        ret = -1;
+        break;
+    }
+
+    return ret;
+}
+
+int serial_rx_wait(unsigned int inst, unsigned int timeout_ms)
+{
+    int ret = 0;
+    struct serial_buf *serial_buf = NULL;
+    SemaphoreHandle_t sem, mutex;
+    TimeOut_t timeout;
+    TickType_t ticks;
+
+    if (serial_rx_select(inst, &serial_buf, &sem, &mutex) != 0) {
+        ret = -1;
+        goto done;
+    }
+
+    ticks = serial_ms_to_ticks(timeout_ms);
+    vTaskSetTimeOutState(&timeout);
+
+    if (xSemaphoreTake(mutex, ticks) != pdTRUE) {
+        goto done;
+    }
+
+    xTaskCheckForTimeOut(&timeout, &ticks);
+    ret = serial_rx_wait_locked(inst, serial_buf, sem, &timeout, &ticks);
+    xSemaphoreGive(mutex);
+
+done:
+
+    return ret;
+}
+
+int serial_read_timeout(unsigned int inst, uint8_t *data, size_t len,
+                        unsigned int timeout_ms)
+{
+    int ret = 0;
+    struct serial_buf *serial_buf = NULL;
+    SemaphoreHandle_t sem, mutex;
+    TimeOut_t timeout;
+    TickType_t ticks;
+
+    if (serial_rx_select(inst, &serial_buf, &sem, &mutex) != 0) {
+        ret = -1;
+        goto done;
+    }
+
+    ticks = serial_ms_to_ticks(timeout_ms);
+    vTaskSetTimeOutState(&timeout);
+
+    if (xSemaphoreTake(mutex, ticks) != pdTRUE) {
+        goto done;
+    }
+
+    xTaskCheckForTimeOut(&timeout, &ticks);
+    if (serial_rx_wait_locked(inst, serial_buf, sem, &timeout, &ticks) > 0) {
+        ret = ringbuf_read(&serial_buf->rx, data, len);
+    }
+    xSemaphoreGive(mutex);
+
+done:
+
+    return ret;
+}
+
+/*
+ * Read up to and including 'delim'. Returns the number of bytes stored;
+ * the last one is 'delim' unless 'len' ran out or the deadline passed.
+ */
+int serial_read_until(unsigned int inst, uint8_t *data, size_t len,
+                      uint8_t delim, unsigned int timeout_ms)
+{
+    int ret = 0;
+    struct serial_buf *serial_buf = NULL;
+    SemaphoreHandle_t sem, mutex;
+    TimeOut_t timeout;
+    TickType_t ticks;
+
+    if (serial_rx_select(inst, &serial_buf, &sem, &mutex) != 0) {
+        ret = -1;
+        goto done;
+    }
+
+    ticks = serial_ms_to_ticks(timeout_ms);
+    vTaskSetTimeOutState(&timeout);
+
+    if (xSemaphoreTake(mutex, ticks) != pdTRUE) {
+        goto done;
+    }
+
+    xTaskCheckForTimeOut(&timeout, &ticks);
+    while ((size_t) ret < len) {
+        const uint8_t *ptr1, *ptr2, *hit;
+        size_t len1, len2, n;
+
+        if (serial_rx_wait_locked(inst, serial_buf, sem,
+                                  &timeout, &ticks) <= 0) {
+            break;
+        }
+
+        ringbuf_peek(&serial_buf->rx, &ptr1, &len1, &ptr2, &len2);
+        hit = memchr(ptr1, delim, len1);
+        if (hit != NULL) {
+            n = hit - ptr1 + 1;
+        } else if ((hit = memchr(ptr2, delim, len2)) != NULL) {
+            n = len1 + (hit - ptr2) + 1;
+        } else {
+            n = len1 + len2;
+        }
+
+        if (n > len - ret) {
+            n = len - ret;
+            hit = NULL;
+        }
+
+        ret += ringbuf_read(&serial_buf->rx, data + ret, n);
+        if (hit != NULL) {
+            break;
+        }
+    }
+    xSemaphoreGive(mutex);
 
 done:
 
@@ -0,0 +1,324 @@
+/*
+ * stackmon.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <hardware/sync.h>
+#include <hardware/timer.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <pico-plat.h>
+#include <dlog.h>
+
+/* Tasks and interrupt stacks tracked; a deleted task's slot is reused */
+#ifndef STACKMON_TASKS_MAX
+#define STACKMON_TASKS_MAX  24
+#endif
+
+#ifndef STACKMON_TASK_STACK
+#define STACKMON_TASK_STACK  384
+#endif
+
+#define STACKMON_PAINT  0xa5a5a5a5
+
+/* Main stacks, which each core's interrupt handlers run on */
+extern uint32_t __StackBottom[], __StackOneBottom[];
+
+struct stackmon_slot {
+    TaskHandle_t handle;
+    uint32_t seen;                // sample that last found the task
+    struct stackmon_task t;
+};
+
+struct stackmon {
+    TaskHandle_t task;
+    volatile bool stopping;
+    unsigned int period_ms;
+    unsigned int margin_words;
+    stackmon_cb_t cb;
+    void *ctx;
+    uint32_t sample;
+    uint32_t *irq_bottom[configNUMBER_OF_CORES];
+    uint32_t *irq_top[configNUMBER_OF_CORES];
+    struct stackmon_slot slot[STACKMON_TASKS_MAX];
+};
+
+static struct stackmon sm;
+
+/*
+ * Fill the unused part of the calling core's main stack, below where it
+ * is now, with a pattern, so that how deep interrupts have gone can be
+ * read back from how much of it is left. Interrupts are held off, so
+ * nothing is on the stack below the current pointer meanwhile.
+ */
+static void stackmon_paint(void *arg)
+{
+    unsigned int core = get_core_num();
+    uint32_t *bottom = (core == 0) ? __StackBottom : __StackOneBottom;
+    uint32_t *p, *msp;
+    uint32_t save;
+
+    (void) arg;
+
+    save = save_and_disable_interrupts();
+    __asm volatile ("mrs %0, msp" : "=r" (msp));
+    for (p = bottom; p < msp - 8; p++) {
+        *p = STACKMON_PAINT;
+    }
+    restore_interrupts(save);
+
+    sm.irq_bottom[core] = bottom;
+    sm.irq_top[core] = msp;
+}
+
+static unsigned int stackmon_irq_free(unsigned int core)
+{
+    const uint32_t *p = sm.irq_bottom[core];
+
+    while ((p < sm.irq_top[core]) && (*p == STACKMON_PAINT)) {
+        p++;
+    }
+
+    return p - sm.irq_bottom[core];
+}
+
+/*
+ * Slot for 'name' and 'handle', or a new one, taken from a deleted task
+ * if the table is full. NULL if there is none to be had.
+ */
+static struct stackmon_slot *stackmon_slot(TaskHandle_t handle,
+                                           const char *name, bool irq)
+{
+    struct stackmon_slot *s, *empty = NULL, *gone = NULL, *spare;
+
+    for (unsigned int i = 0; i < STACKMON_TASKS_MAX; i++) {
+        s = &sm.slot[i];
+        if (s->t.name[0] == '\0') {
+            if (empty == NULL) {
+                empty = s;
+            }
+        } else if ((s->handle == handle) && (s->t.irq == irq) &&
+                   (strncmp(s->t.name, name, STACKMON_NAME_LEN - 1) == 0)) {
+            return s;
+        } else if (s->t.gone && (gone == NULL)) {
+            gone = s;
+        }
+    }
+
+    spare = (empty != NULL) ? empty : gone;
+
+    if (spare != NULL) {
+        memset(spare, 0, sizeof(*spare));
+        spare->handle = handle;
+        strncpy(spare->t.name, name, STACKMON_NAME_LEN - 1);
+        spare->t.irq = irq;
+        spare->t.free_words = UINT32_MAX;
+    }
+
+    return spare;
+}
+
+static void stackmon_record(TaskHandle_t handle, const char *name, bool irq,
+                            unsigned int free_words, uint32_t uptime_s)
+{
+    struct stackmon_slot *s;
+    bool low = false;
+    unsigned int i;
+
+    taskENTER_CRITICAL();
+    s = stackmon_slot(handle, name, irq);
+    if (s != NULL) {
+        s->seen = sm.sample;
+        s->t.gone = false;
+        if (free_words < s->t.free_words) {
+            s->t.free_words = free_words;
+            for (i = STACKMON_HISTORY - 1; i > 0; i--) {
+                s->t.lows[i] = s->t.lows[i - 1];
+            }
+            s->t.lows[0].uptime_s = uptime_s;
+            s->t.lows[0].free_words = free_words;
+            s->t.nlows++;
+            low = (free_words < sm.margin_words);
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    if (!low) {
+        return;
+    }
+
+    if (sm.cb != NULL) {
+        sm.cb(sm.ctx, name, free_words);
+    } else {
+        DLOG("stack of %s down to %u words free\n", name, free_words);
+    }
+}
+
+static void stackmon_sample(void)
+{
+    static const char *const irq_names[] = { "IRQ0", "IRQ1", };
+    TaskStatus_t *tasks = NULL;
+    UBaseType_t n = 0, size;
+    uint32_t uptime_s = (uint32_t) (time_us_64() / 1000000);
+    unsigned int i, core;
+
+    do {
+        arena_free(tasks);
+        size = uxTaskGetNumberOfTasks() + 4;
+        tasks = (TaskStatus_t *) arena_alloc(size * sizeof(TaskStatus_t));
+        if (tasks == NULL) {
+            break;
+        }
+        n = uxTaskGetSystemState(tasks, size, NULL);
+    } while (n == 0);
+
+    if (tasks == NULL) {
+        goto irq;
+    }
+
+    sm.sample++;
+    for (UBaseType_t j = 0; j < n; j++) {
+        stackmon_record(tasks[j].xHandle, tasks[j].pcTaskName, false,
+                        tasks[j].usStackHighWaterMark, uptime_s);
+    }
+    arena_free(tasks);
+
+    /* Whatever this sample did not find among the tasks is gone */
+    taskENTER_CRITICAL();
+    for (i = 0; i < STACKMON_TASKS_MAX; i++) {
+        struct stackmon_slot *s = &sm.slot[i];
+
+        if ((s->t.name[0] != '\0') && !s->t.irq &&
+            (s->seen != sm.sample)) {
+            s->t.gone = true;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+irq:
+
+    for (core = 0; core < configNUMBER_OF_CORES; core++) {
+        if (sm.irq_bottom[core] != NULL) {
+            stackmon_record(NULL, irq_names[core], true,
+                            stackmon_irq_free(core), uptime_s);
+        }
+    }
+}
+
+static void stackmon_task(void *arg)
+{
+    (void) arg;
+
+    while (!sm.stopping) {
+        stackmon_sample();
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(sm.period_ms));
+    }
+
+    sm.task = NULL;
+    vTaskDelete(NULL);
+}
+
+/*
+ * Sample the stack high-water mark of every task, and the depth reached
+ * by interrupts on each core's main stack, every 'period_ms' from a task
+ * at the lowest priority above idle. The least free space of each is
+ * kept with its last few new lows and when they happened, for
+ * stackmon_get(). A new low below 'margin_words' is passed to 'cb', or
+ * without one logged through DLOG. The interrupt stacks are painted here
+ * and so only show what happens from now on.
+ */
+int stackmon_start(unsigned int period_ms, unsigned int margin_words,
+                   stackmon_cb_t cb, void *ctx)
+{
+    int ret = 0;
+
+    if ((sm.task != NULL) || (period_ms == 0) ||
+        (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED)) {
+        ret = -1;
+        goto done;
+    }
+
+    sm.stopping = false;
+    sm.period_ms = period_ms;
+    sm.margin_words = margin_words;
+    sm.cb = cb;
+    sm.ctx = ctx;
+
+    for (unsigned int core = 0; core < configNUMBER_OF_CORES; core++) {
+        if (sm.irq_bottom[core] == NULL) {
+            iocore_run_on(core, stackmon_paint, NULL);
+        }
+    }
+
+    if (xTaskCreate(stackmon_task, "stackmon", STACKMON_TASK_STACK, NULL,
+                    tskIDLE_PRIORITY + 1, &sm.task) != pdPASS) {
+        sm.task = NULL;
+        ret = -1;
+        goto done;
+    }
+
+done:
+
+    return ret;
+}
+
+/* The monitor finishes its sample, if any, and exits; the history stays */
+void stackmon_stop(void)
+{
+    TaskHandle_t task = sm.task;
+
+    if (task != NULL) {
+        sm.stopping = true;
+        xTaskNotifyGive(task);
+    }
+}
+
+int stackmon_running(void)
+{
+    return (sm.task != NULL) && !sm.stopping;
+}
+
+/*
+ * The i-th tracked stack, for listing them one at a time; -1 past the
+ * last. Slots are in the order stacks were first seen.
+ */
+int stackmon_get(unsigned int i, struct stackmon_task *task)
+{
+    int ret = -1;
+    unsigned int n = 0;
+
+    if (task == NULL) {
+        goto done;
+    }
+
+    taskENTER_CRITICAL();
+    for (unsigned int j = 0; j < STACKMON_TASKS_MAX; j++) {
+        if (sm.slot[j].t.name[0] == '\0') {
+            continue;
+        }
+        if (n++ == i) {
+            *task = sm.slot[j].t;
+            ret = 0;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+done:
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
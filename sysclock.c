@@ -0,0 +1,254 @@
+/*
+ * sysclock.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pico/stdlib.h>
+#include <hardware/clocks.h>
+#include <hardware/sync.h>
+#include <hardware/vreg.h>
+#include <hardware/structs/systick.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <pico-plat.h>
+
+/*
+ * Beyond this the default flash divider would run the QSPI bus above
+ * what the usual boot flash parts are rated for.
+ */
+#ifndef SYSCLOCK_MAX_HZ
+#define SYSCLOCK_MAX_HZ          250000000
+#endif
+
+#ifndef SYSCLOCK_LISTENERS_MAX
+#define SYSCLOCK_LISTENERS_MAX   8
+#endif
+
+#ifndef SYSCLOCK_VREG_SETTLE_US
+#define SYSCLOCK_VREG_SETTLE_US  1000
+#endif
+
+struct sysclock_listener {
+    sysclock_cb_t cb;
+    void *ctx;
+};
+
+static struct sysclock_listener listeners[SYSCLOCK_LISTENERS_MAX];
+static bool sysclock_busy = false;
+static volatile uint32_t sleep_us[configNUMBER_OF_CORES];
+
+/* Lowest core voltage known to be good for 'hz' */
+static enum vreg_voltage sysclock_vsel(uint32_t hz)
+{
+    if (hz > 200000000) {
+        return VREG_VOLTAGE_1_20;
+    } else if (hz > 133000000) {
+        return VREG_VOLTAGE_1_15;
+    }
+
+    return VREG_VOLTAGE_DEFAULT;
+}
+
+static void sysclock_notify(int event, uint32_t hz)
+{
+    struct sysclock_listener copy[SYSCLOCK_LISTENERS_MAX];
+    unsigned int i;
+
+    taskENTER_CRITICAL();
+    for (i = 0; i < SYSCLOCK_LISTENERS_MAX; i++) {
+        copy[i] = listeners[i];
+    }
+    taskEXIT_CRITICAL();
+
+    for (i = 0; i < SYSCLOCK_LISTENERS_MAX; i++) {
+        if (copy[i].cb != NULL) {
+            copy[i].cb(copy[i].ctx, event, hz);
+        }
+    }
+}
+
+/*
+ * SysTick counts clk_sys on each core, so the tick would speed up or slow
+ * down with it; reload it for the new frequency on the core this runs on.
+ */
+static void sysclock_systick(void *arg)
+{
+    uint32_t hz = *(const uint32_t *) arg;
+
+    systick_hw->rvr = (hz / configTICK_RATE_HZ) - 1;
+    systick_hw->cvr = 0;
+}
+
+/*
+ * Change clk_sys (and clk_peri, which the SDK runs from it) to 'hz'.
+ * The core voltage is raised before speeding up and lowered after
+ * slowing down; the FreeRTOS tick is kept at configTICK_RATE_HZ on every
+ * core; listeners are told right before (SYSCLOCK_CHANGING, with the
+ * target) and right after (SYSCLOCK_CHANGED) so that they can quiesce and
+ * re-derive dividers. clk_usb and clk_adc run from the USB PLL and are
+ * not affected. Returns -1 if 'hz' cannot be made from the crystal,
+ * exceeds SYSCLOCK_MAX_HZ, or another change is in progress.
+ */
+int sysclock_set_hz(uint32_t hz)
+{
+    int ret = 0;
+    unsigned int vco, postdiv1, postdiv2;
+    enum vreg_voltage vsel, vcur;
+    uint32_t old_hz;
+    bool busy;
+
+    if ((hz == 0) || (hz > SYSCLOCK_MAX_HZ) || ((hz % 1000) != 0) ||
+        !check_sys_clock_khz(hz / 1000, &vco, &postdiv1, &postdiv2)) {
+        ret = -1;
+        goto done;
+    }
+
+    taskENTER_CRITICAL();
+    busy = sysclock_busy;
+    sysclock_busy = true;
+    taskEXIT_CRITICAL();
+    if (busy) {
+        ret = -1;
+        goto done;
+    }
+
+    old_hz = clock_get_hz(clk_sys);
+    if (hz == old_hz) {
+        goto unbusy;
+    }
+
+    vsel = sysclock_vsel(hz);
+    vcur = vreg_get_voltage();
+    if (vsel > vcur) {
+        vreg_set_voltage(vsel);
+        busy_wait_us(SYSCLOCK_VREG_SETTLE_US);
+    }
+
+    sysclock_notify(SYSCLOCK_CHANGING, hz);
+    set_sys_clock_pll(vco, postdiv1, postdiv2);
+    hz = clock_get_hz(clk_sys);
+
+    if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+        for (unsigned int core = 0; core < configNUMBER_OF_CORES; core++) {
+            iocore_run_on(core, sysclock_systick, &hz);
+        }
+    }
+
+    if (vsel < vcur) {
+        vreg_set_voltage(vsel);
+    }
+
+    sysclock_notify(SYSCLOCK_CHANGED, hz);
+
+unbusy:
+
+    taskENTER_CRITICAL();
+    sysclock_busy = false;
+    taskEXIT_CRITICAL();
+
+done:
+
+    return ret;
+}
+
+uint32_t sysclock_get_hz(void)
+{
+    return clock_get_hz(clk_sys);
+}
+
+unsigned int sysclock_get_vreg_mv(void)
+{
+    return 850 + ((unsigned int) vreg_get_voltage() - VREG_VOLTAGE_0_85) * 50;
+}
+
+/*
+ * For vApplicationIdleHook() (and vApplicationPassiveIdleHook() on SMP):
+ * stop the calling core's clock until the next interrupt. The tick, a
+ * yield from the other core and every device interrupt wake it, so no
+ * task is delayed; with tasks blocked rather than polling, as the shell
+ * is in PicoShell::run(), the core then stays asleep until there is work.
+ */
+void sysclock_idle(void)
+{
+    unsigned int core = get_core_num();
+    uint32_t t0 = time_us_32();
+
+    __wfi();
+    sleep_us[core] += time_us_32() - t0;
+}
+
+/*
+ * Microseconds 'core' has spent asleep in sysclock_idle(), wrapping
+ * around; the difference over an interval is its idle time, measured
+ * with the hardware timer rather than charged to whichever task an
+ * interrupt happened to land on.
+ */
+uint32_t sysclock_sleep_us(unsigned int core)
+{
+    if (core >= configNUMBER_OF_CORES) {
+        return 0;
+    }
+
+    return sleep_us[core];
+}
+
+/*
+ * Have cb(ctx, event, hz) called around every clk_sys change, from the
+ * task making it. Anything timed off clk_sys or clk_peri that is set up
+ * outside pico-plat (I2C, SPI, PWM, PIO dividers) should be re-derived
+ * there.
+ */
+int sysclock_add_listener(sysclock_cb_t cb, void *ctx)
+{
+    int ret = -1;
+
+    if (cb == NULL) {
+        goto done;
+    }
+
+    taskENTER_CRITICAL();
+    for (unsigned int i = 0; i < SYSCLOCK_LISTENERS_MAX; i++) {
+        if (listeners[i].cb == NULL) {
+            listeners[i].cb = cb;
+            listeners[i].ctx = ctx;
+            ret = 0;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+done:
+
+    return ret;
+}
+
+int sysclock_remove_listener(sysclock_cb_t cb, void *ctx)
+{
+    int ret = -1;
+
+    taskENTER_CRITICAL();
+    for (unsigned int i = 0; i < SYSCLOCK_LISTENERS_MAX; i++) {
+        if ((listeners[i].cb == cb) && (listeners[i].ctx == ctx)) {
+            listeners[i].cb = NULL;
+            listeners[i].ctx = NULL;
+            ret = 0;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
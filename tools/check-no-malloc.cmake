@@ -0,0 +1,50 @@
+# check-no-malloc.cmake
+#
+# Copyright (C) 2025, Charles Chiou
+#
+# Run with cmake -P before an executable is linked, when pico-plat is
+# built with PICO_PLAT_NO_MALLOC: fails if any of pico-plat's own objects
+# in it calls into the heap. Tasks and queues that pico-plat has FreeRTOS
+# allocate show up only in the kernel's objects, not here: it makes those
+# once, from its start and init calls, and in static storage where it
+# has to run without the heap (iocore's service tasks).
+#
+#   -DNM=<nm>
+#   -DOBJECTS=<objects of the executable, separated by '|'>
+#   -DSOURCES=<pico-plat's sources, separated by '|'>
+
+string(REPLACE "|" ";" OBJECTS "${OBJECTS}")
+string(REPLACE "|" ";" SOURCES "${SOURCES}")
+
+set(HEAP_SYMBOLS "^(malloc|calloc|realloc|memalign|aligned_alloc|strn?dup")
+string(APPEND HEAP_SYMBOLS "|_malloc_r|_calloc_r|_realloc_r|pvPortMalloc")
+string(APPEND HEAP_SYMBOLS "|_Zn[wa][jm].*)$")
+
+set(offenders "")
+foreach(src ${SOURCES})
+  get_filename_component(name ${src} NAME)
+  foreach(obj ${OBJECTS})
+    if(obj MATCHES "/${name}\\.(o|obj)$")
+      execute_process(COMMAND ${NM} -u ${obj}
+        OUTPUT_VARIABLE undefined
+        RESULT_VARIABLE rc)
+      if(NOT rc EQUAL 0)
+        message(FATAL_ERROR "${NM} failed on ${obj}")
+      endif()
+      string(REPLACE "\n" ";" undefined "${undefined}")
+      foreach(line ${undefined})
+        string(STRIP "${line}" line)
+        string(REGEX REPLACE "^U +" "" sym "${line}")
+        if(sym MATCHES "${HEAP_SYMBOLS}")
+          list(APPEND offenders "${name}: ${sym}")
+        endif()
+      endforeach()
+    endif()
+  endforeach()
+endforeach()
+
+if(offenders)
+  string(REPLACE ";" "\n  " offenders "${offenders}")
+  message(FATAL_ERROR
+    "PICO_PLAT_NO_MALLOC: pico-plat allocates from the heap:\n  ${offenders}")
+endif()
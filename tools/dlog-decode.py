@@ -0,0 +1,263 @@
+#!/usr/bin/env python3
+#
+# dlog-decode.py
+#
+# Copyright (C) 2025, Charles Chiou
+#
+# Decode the binary log stream produced by dlog.c back into text, using
+# the format strings kept in the .pplog_fmt section of the firmware ELF.
+#
+#   dlog-decode.py firmware.elf /dev/ttyACM0       (needs pyserial)
+#   dlog-decode.py firmware.elf capture.bin
+#   dlog-decode.py firmware.elf - < capture.bin
+#
+
+import argparse
+import re
+import struct
+import sys
+
+SECTION = '.pplog_fmt'
+
+T_END, T_I32, T_U32, T_I64, T_U64, T_F64, T_STR, T_PTR = range(8)
+
+F_CORE1 = 0x01
+F_ABS = 0x02
+F_LOST = 0x04
+
+SHT_PROGBITS = 1
+SHF_ALLOC = 0x2
+
+CONV = re.compile(r'%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?'
+                  r'(hh|h|ll|l|j|z|t|L)?([diouxXeEfFgGaAcspn%])')
+
+
+def load_sections(path):
+    with open(path, 'rb') as f:
+        elf = f.read()
+
+    if elf[:4] != b'\x7fELF':
+        raise ValueError('%s: not an ELF file' % path)
+    is64 = elf[4] == 2
+    end = '<' if elf[5] == 1 else '>'
+
+    if is64:
+        shoff, = struct.unpack_from(end + 'Q', elf, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from(end + 'HHH', elf, 0x3a)
+        shfmt = end + 'IIQQQQIIQQ'
+    else:
+        shoff, = struct.unpack_from(end + 'I', elf, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from(end + 'HHH', elf, 0x2e)
+        shfmt = end + 'IIIIIIIIII'
+
+    sections = [struct.unpack_from(shfmt, elf, shoff + i * shentsize)
+                for i in range(shnum)]
+    strtab = sections[shstrndx]
+    found = None
+    loaded = []
+
+    for sh in sections:
+        name = elf[strtab[4] + sh[0]:].split(b'\0', 1)[0].decode()
+        if name == SECTION:
+            found = (sh[3], elf[sh[4]:sh[4] + sh[5]])
+        elif sh[1] == SHT_PROGBITS and sh[2] & SHF_ALLOC:
+            loaded.append((sh[3], elf[sh[4]:sh[4] + sh[5]]))
+
+    if found is None:
+        raise ValueError('%s: no %s section' % (path, SECTION))
+
+    # Descriptors GCC would not place in SECTION (static locals of
+    # template instances) stay in loaded data and are found by address
+    return [found] + loaded, end
+
+
+class Decoder:
+
+    def __init__(self, elf):
+        self.sections, self.end = load_sections(elf)
+        self.cache = {}
+        self.clock = [None, None]
+
+    def lookup(self, ident):
+        if ident not in self.cache:
+            for base, data in self.sections:
+                off = ident - base
+                if 0 <= off and off + 4 <= len(data):
+                    break
+            else:
+                raise ValueError('bad string id 0x%x' % ident)
+            sig, = struct.unpack_from(self.end + 'I', data, off)
+            fmt = data[off + 4:].split(b'\0', 1)[0].decode(errors='replace')
+            self.cache[ident] = (sig, fmt)
+
+        return self.cache[ident]
+
+    @staticmethod
+    def varint(buf, pos):
+        v = 0
+        shift = 0
+        while True:
+            b = buf[pos]
+            pos += 1
+            v |= (b & 0x7f) << shift
+            shift += 7
+            if not b & 0x80:
+                return v, pos
+
+    @staticmethod
+    def cobs(frame):
+        out = bytearray()
+        pos = 0
+        while pos < len(frame):
+            code = frame[pos]
+            if code == 0 or pos + code > len(frame) + 1:
+                raise ValueError('bad COBS frame')
+            out += frame[pos + 1:pos + code]
+            pos += code
+            if code < 0xff and pos < len(frame):
+                out.append(0)
+        return bytes(out)
+
+    def args(self, sig, buf, pos):
+        vals = []
+        while sig:
+            t = sig & 0xf
+            sig >>= 4
+            if pos >= len(buf):
+                break
+            if t in (T_I32, T_I64):
+                v, pos = self.varint(buf, pos)
+                vals.append((t, (v >> 1) ^ -(v & 1)))
+            elif t == T_F64:
+                vals.append((t, struct.unpack_from('<d', buf, pos)[0]))
+                pos += 8
+            elif t == T_STR:
+                n = buf[pos]
+                vals.append((t, buf[pos + 1:pos + 1 + n].decode(
+                    errors='replace')))
+                pos += 1 + n
+            else:
+                v, pos = self.varint(buf, pos)
+                vals.append((t, v))
+        return vals
+
+    @staticmethod
+    def format(fmt, vals):
+        vals = list(vals)
+        out = []
+        last = 0
+
+        def take():
+            return vals.pop(0) if vals else (T_END, None)
+
+        for m in CONV.finditer(fmt):
+            out.append(fmt[last:m.start()])
+            last = m.end()
+            flags, width, prec, _, conv = m.groups()
+            if conv == '%':
+                out.append('%')
+                continue
+            if width == '*':
+                width = str(take()[1])
+            if prec == '*':
+                prec = str(take()[1])
+            t, v = take()
+            if conv == 'n':
+                continue
+            if v is None:
+                out.append('<?>')
+                continue
+            spec = '%' + flags + (width or '') + \
+                ('.' + prec if prec is not None else '')
+            if conv in 'di':
+                out.append((spec + 'd') % int(v))
+            elif conv in 'ouxX':
+                bits = 64 if t in (T_I64, T_U64) else 32
+                out.append((spec + ('d' if conv == 'u' else conv)) %
+                           (int(v) & ((1 << bits) - 1)))
+            elif conv in 'eEfFgGaA':
+                out.append((spec + ('f' if conv in 'aA' else conv)) %
+                           float(v))
+            elif conv == 'c':
+                out.append((spec + 'c') % (int(v) & 0xff))
+            elif conv == 's':
+                out.append((spec + 's') % v)
+            elif conv == 'p':
+                out.append('0x%08x' % int(v))
+        out.append(fmt[last:])
+
+        return ''.join(out)
+
+    def record(self, rec):
+        flags = rec[0]
+        core = flags & F_CORE1
+        ident, pos = self.varint(rec, 1)
+        ts, pos = self.varint(rec, pos)
+        lost = 0
+        if flags & F_LOST:
+            lost, pos = self.varint(rec, pos)
+
+        if flags & F_ABS or self.clock[core] is None:
+            self.clock[core] = ts
+        else:
+            self.clock[core] += ts
+
+        sig, fmt = self.lookup(ident)
+        text = self.format(fmt, self.args(sig, rec, pos)).rstrip('\n')
+        now = self.clock[core]
+        prefix = '[%6d.%06d] c%d ' % (now // 1000000, now % 1000000, core)
+        lines = []
+        if lost:
+            lines.append(prefix + '*** %d record(s) lost' % lost)
+        lines.append(prefix + text)
+
+        return '\n'.join(lines)
+
+    def frame(self, frame):
+        try:
+            return self.record(self.cobs(frame))
+        except (ValueError, IndexError, struct.error):
+            # Not one of ours, e.g. plain text on a shared port
+            return frame.decode(errors='replace').rstrip('\r\n')
+
+
+def open_input(path, baud):
+    if path == '-':
+        return sys.stdin.buffer
+    if path.startswith('/dev/') or path.upper().startswith('COM'):
+        import serial
+        return serial.Serial(path, baud, timeout=None)
+    return open(path, 'rb')
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Decode pico-plat dlog output')
+    ap.add_argument('elf', help='firmware ELF the log was produced by')
+    ap.add_argument('input', help='serial device, capture file or -')
+    ap.add_argument('-b', '--baud', type=int, default=115200)
+    opts = ap.parse_args()
+
+    dec = Decoder(opts.elf)
+    src = open_input(opts.input, opts.baud)
+    pending = bytearray()
+
+    while True:
+        chunk = src.read(1) if hasattr(src, 'in_waiting') else src.read(4096)
+        if not chunk:
+            break
+        pending += chunk
+        while True:
+            idx = pending.find(b'\0')
+            if idx < 0:
+                break
+            frame = bytes(pending[:idx])
+            del pending[:idx + 1]
+            if frame:
+                print(dec.frame(frame), flush=True)
+
+
+if __name__ == '__main__':
+    try:
+        main()
+    except KeyboardInterrupt:
+        pass
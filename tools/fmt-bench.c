@@ -0,0 +1,242 @@
+/*
+ * fmt-bench.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+/*
+ * Host-side check and benchmark of fmt.c, which builds as is with a
+ * host compiler. The check formats random doubles, across the whole
+ * range and at decimal ties, with fmt_vprintf() and with the C library
+ * and compares the two. The benchmark times a typical log line through
+ * fmt_vprintf() with a sink like serial.c's, and through what
+ * serial_vprintf() did before: vsnprintf() into a 512-byte buffer, then
+ * one write per byte with a '\r' ahead of each '\n'.
+ *
+ *   cc -O2 -I. -o fmt-bench tools/fmt-bench.c fmt.c
+ *   ./fmt-bench [values]
+ *
+ * The host's C library stands in for newlib on both counts: the check
+ * holds fmt.c to C99 rounding, and the old path is timed with the
+ * host's vsnprintf(), not the target's.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pico-plat.h>
+
+struct buf_sink {
+    char *buf;
+    size_t size;
+    size_t len;
+};
+
+static void buf_sink(void *ctx, const char *s, size_t len)
+{
+    struct buf_sink *b = (struct buf_sink *) ctx;
+
+    if (len > b->size - 1 - b->len) {
+        len = b->size - 1 - b->len;
+    }
+    memcpy(b->buf + b->len, s, len);
+    b->len += len;
+    b->buf[b->len] = '\0';
+}
+
+static int fmt_snprintf(char *buf, size_t size, const char *format, ...)
+{
+    struct buf_sink b = { buf, size, 0, };
+    va_list ap;
+    int ret;
+
+    buf[0] = '\0';
+    va_start(ap, format);
+    ret = fmt_vprintf(buf_sink, &b, format, ap);
+    va_end(ap);
+
+    return ret;
+}
+
+static uint64_t rng = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t rand64(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+
+    return rng;
+}
+
+/* Any finite double, or one near the decimal ties printf has to round */
+static double rand_double(unsigned int i)
+{
+    uint64_t bits;
+    double v;
+
+    switch (i % 4) {
+    case 0:
+        do {
+            bits = rand64();
+            memcpy(&v, &bits, sizeof(v));
+        } while (__builtin_isnan(v) || __builtin_isinf(v));
+        return v;
+    case 1:
+        return (double) (rand64() % 100000) / 2000.0;
+    case 2:
+        return (double) (int64_t) (rand64() % 2000001 - 1000000) / 1000.0;
+    default:
+        return ((double) (rand64() >> 11) / 9007199254740992.0) *
+            (double) (1ULL << (rand64() % 64));
+    }
+}
+
+static const char *const formats[] = {
+    "%f", "%.0f", "%.1f", "%.2f", "%.3f", "%.17f", "%#.0f", "%+09.2f",
+    "%e", "%.0e", "%.3e", "%.17E", "%#.0e", "%-14.4e",
+    "%g", "%.1g", "%.3g", "%.17g", "%#g", "%#.3g", "%G", "%12.5g",
+    "%.20f", "%.40f", "%.25e", "%#.30E", "%.30g", "%#.22g", "%-40.20g",
+    "%a", "%.0a", "%#.0a", "%.3a", "%.20A", "%+025.4a",
+};
+
+static unsigned int check(unsigned int count)
+{
+    char want[512], got[512];
+    unsigned int bad = 0;
+    unsigned int i, j;
+    double v;
+
+    for (i = 0; i < count; i++) {
+        v = rand_double(i);
+        for (j = 0; j < sizeof(formats) / sizeof(formats[0]); j++) {
+            snprintf(want, sizeof(want), formats[j], v);
+            fmt_snprintf(got, sizeof(got), formats[j], v);
+            /*
+             * glibc's %#g drops the zeros when rounding carries into a
+             * new power of ten ("1.e+03" for %#.3g of 999.6, not C99's
+             * "1.00e+03")
+             */
+            if ((strchr(formats[j], '#') != NULL) &&
+                (strstr(want, ".e") != NULL)) {
+                continue;
+            }
+            if (strcmp(want, got) != 0) {
+                if (bad < 10) {
+                    printf("%s of %a: want \"%s\", got \"%s\"\n",
+                           formats[j], v, want, got);
+                }
+                bad++;
+            }
+        }
+    }
+
+    return bad;
+}
+
+/* serial_sink(), with a plain buffer for the TX ring */
+static void crlf_sink(void *ctx, const char *s, size_t len)
+{
+    const char *nl;
+
+    while ((nl = memchr(s, '\n', len)) != NULL) {
+        buf_sink(ctx, s, nl - s);
+        buf_sink(ctx, "\r\n", 2);
+        len -= nl - s + 1;
+        s = nl + 1;
+    }
+
+    buf_sink(ctx, s, len);
+}
+
+static void __attribute__((noinline))
+put_byte(struct buf_sink *b, const char *c)
+{
+    buf_sink(b, c, 1);
+}
+
+static int old_vprintf(struct buf_sink *b, const char *format, va_list ap)
+{
+    static char pbuf[512];
+    int ret;
+
+    ret = vsnprintf(pbuf, sizeof(pbuf) - 1, format, ap);
+    for (int i = 0; (i < ret) && (i < (int) sizeof(pbuf)); i++) {
+        if (pbuf[i] == '\n') {
+            put_byte(b, "\r");
+        }
+        put_byte(b, pbuf + i);
+    }
+
+    return ret;
+}
+
+static int bench_printf(bool old, struct buf_sink *b, const char *format,
+                        ...)
+{
+    va_list ap;
+    int ret;
+
+    va_start(ap, format);
+    ret = old ? old_vprintf(b, format, ap) :
+        fmt_vprintf(crlf_sink, b, format, ap);
+    va_end(ap);
+
+    return ret;
+}
+
+static double bench(bool old, unsigned int lines)
+{
+    static char out[4096];
+    struct buf_sink b = { out, sizeof(out), 0, };
+    struct timespec t0, t1;
+    uint64_t bytes = 0;
+    double s;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (unsigned int i = 0; i < lines; i++) {
+        b.len = 0;
+        bytes += bench_printf(old, &b,
+                              "[%8lu] adc ch%u = %5d mV, %s: %.1fC\n",
+                              (unsigned long) i, i % 4, (int) (i % 3300),
+                              "board", 20.0 + (i % 200) / 10.0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    return bytes / s / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int count = 100000;
+    unsigned int bad;
+
+    if (argc > 1) {
+        count = strtoul(argv[1], NULL, 0);
+    }
+
+    bad = check(count);
+    printf("%u values x %u formats: %u mismatches\n", count,
+           (unsigned int) (sizeof(formats) / sizeof(formats[0])), bad);
+
+    printf("fmt_vprintf: %6.1f MB/s\n", bench(false, 1000000));
+    printf("vsnprintf:   %6.1f MB/s\n", bench(true, 1000000));
+
+    return bad ? 1 : 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,320 @@
+/*
+ * ringbuf-bench.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+/*
+ * Host-side check and microbenchmark of ringbuf.c, which builds as is
+ * with a host compiler. The checks cover wrap-around, both overflow
+ * policies and a DMA-style producer lapping the reader. The benchmark
+ * streams a counting pattern from one thread to another through a
+ * 512-byte ring, verifying every byte, once through struct ringbuf and
+ * once through the byte loop serial.c and usbcdc.c used before it.
+ *
+ *   cc -O2 -I. -o ringbuf-bench tools/ringbuf-bench.c ringbuf.c -lpthread
+ *   ./ringbuf-bench [MB]
+ *
+ * Either side yields when the ring is full or empty, so that it runs on
+ * a single CPU too. A host core is not a Cortex-M0+, and the legacy
+ * loop's missing barriers only go unpunished here thanks to x86's strong
+ * ordering; the figures compare copy strategies, not absolute firmware
+ * throughput.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <ringbuf.h>
+
+#define RING_SIZE  512
+
+static unsigned int failures = 0;
+
+#define CHECK(cond) do {                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n",               \
+                    __FILE__, __LINE__, #cond);                         \
+            failures++;                                                 \
+        }                                                               \
+    } while (0)
+
+static void check_wrap(void)
+{
+    struct ringbuf rb;
+    uint8_t buf[16], in[64], out[64];
+    unsigned int i, n;
+
+    ringbuf_init(&rb, buf, sizeof(buf), RINGBUF_DROP_NEW);
+    for (i = 0; i < sizeof(in); i++) {
+        in[i] = (uint8_t) i;
+    }
+
+    /* Odd-sized chunks, so that copies straddle the end of the buffer */
+    for (i = 0; i < 100; i++) {
+        n = 1 + (i % 11);
+        CHECK(ringbuf_write(&rb, in + i % 7, n) == n);
+        CHECK(ringbuf_used(&rb) == n);
+        CHECK(ringbuf_read(&rb, out, sizeof(out)) == n);
+        CHECK(memcmp(out, in + i % 7, n) == 0);
+        CHECK(ringbuf_empty(&rb));
+    }
+    CHECK(rb.dropped == 0);
+}
+
+static void check_drop_new(void)
+{
+    struct ringbuf rb;
+    uint8_t buf[16], in[24], out[24];
+    unsigned int i;
+
+    ringbuf_init(&rb, buf, sizeof(buf), RINGBUF_DROP_NEW);
+    for (i = 0; i < sizeof(in); i++) {
+        in[i] = (uint8_t) i;
+    }
+
+    CHECK(ringbuf_write(&rb, in, sizeof(in)) == 16);
+    CHECK(rb.dropped == 8);
+    CHECK(ringbuf_free(&rb) == 0);
+    CHECK(ringbuf_read(&rb, out, sizeof(out)) == 16);
+    CHECK(memcmp(out, in, 16) == 0);
+}
+
+static void check_drop_old(void)
+{
+    struct ringbuf rb;
+    uint8_t buf[16], in[24], out[24];
+    unsigned int i;
+
+    ringbuf_init(&rb, buf, sizeof(buf), RINGBUF_DROP_OLD);
+    for (i = 0; i < sizeof(in); i++) {
+        in[i] = (uint8_t) i;
+    }
+
+    CHECK(ringbuf_write(&rb, in, 10) == 10);
+    CHECK(ringbuf_write(&rb, in + 10, 14) == 14);
+    CHECK(ringbuf_read(&rb, out, sizeof(out)) == 16);
+    CHECK(memcmp(out, in + 8, 16) == 0);
+    CHECK(rb.dropped == 8);
+}
+
+/*
+ * What serial_rx_update() does in DMA receive mode: the data is already
+ * in the buffer and the head is moved by however far DMA got, which can
+ * be more than a ring's length if it lapped the reader.
+ */
+static void check_dma_lap(void)
+{
+    struct ringbuf rb;
+    uint8_t buf[16], out[16];
+    const uint8_t *p1, *p2;
+    size_t l1, l2;
+    unsigned int i, pos = 0;
+
+    ringbuf_init(&rb, buf, sizeof(buf), RINGBUF_DROP_NEW);
+
+    /* 40 bytes arrive, counting up, before the reader looks */
+    for (i = 0; i < 40; i++) {
+        buf[pos++ & rb.mask] = (uint8_t) i;
+    }
+    ringbuf_commit(&rb, 40);
+
+    CHECK(ringbuf_peek(&rb, &p1, &l1, &p2, &l2) == 16);
+    CHECK(rb.dropped == 24);
+    CHECK(ringbuf_read(&rb, out, sizeof(out)) == 16);
+    for (i = 0; i < 16; i++) {
+        CHECK(out[i] == 24 + i);
+    }
+    CHECK(ringbuf_empty(&rb));
+}
+
+/* The per-instance ring serial.c and usbcdc.c had before struct ringbuf */
+struct legacy_buf {
+    volatile unsigned int rp;
+    volatile unsigned int wp;
+    char buf[RING_SIZE];
+};
+
+struct bench {
+    struct ringbuf rb;
+    struct legacy_buf lb;
+    uint8_t buf[RING_SIZE];
+    size_t total;
+    size_t chunk;
+    bool legacy;
+    bool bad;
+};
+
+/* As the UART ISR fed it, one byte at a time, dropping when full */
+static size_t legacy_write(struct legacy_buf *lb, const uint8_t *data,
+                           size_t len)
+{
+    unsigned int wp = lb->wp;
+    size_t n = 0;
+
+    while ((n < len) && (((wp + 1) % RING_SIZE) != lb->rp)) {
+        lb->buf[wp] = (char) data[n++];
+        wp = (wp + 1) % RING_SIZE;
+    }
+    lb->wp = wp;
+
+    return n;
+}
+
+/* serial_read() as it was */
+static size_t legacy_read(struct legacy_buf *lb, uint8_t *data, size_t len)
+{
+    const uint8_t *src = (const uint8_t *) lb->buf;
+    unsigned int rp, wp;
+    size_t ret = 0;
+
+    rp = lb->rp;
+    wp = lb->wp;
+    while ((len > 0) && (rp != wp)) {
+        *data = src[rp];
+        data++;
+        len--;
+        ret++;
+        rp = (rp + 1) % RING_SIZE;
+    }
+    lb->rp = rp;
+
+    return ret;
+}
+
+static void *producer(void *arg)
+{
+    struct bench *b = (struct bench *) arg;
+    uint8_t chunk[RING_SIZE];
+    size_t sent = 0, n, i, done;
+
+    while (sent < b->total) {
+        n = b->chunk;
+        if (n > b->total - sent) {
+            n = b->total - sent;
+        }
+        for (i = 0; i < n; i++) {
+            chunk[i] = (uint8_t) (sent + i);
+        }
+        for (i = 0; i < n; ) {
+            done = b->legacy ?
+                legacy_write(&b->lb, chunk + i, n - i) :
+                ringbuf_write(&b->rb, chunk + i, n - i);
+            if (done == 0) {
+                sched_yield();
+            }
+            i += done;
+        }
+        sent += n;
+    }
+
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    struct bench *b = (struct bench *) arg;
+    uint8_t chunk[RING_SIZE];
+    size_t got = 0, n, i;
+
+    while (got < b->total) {
+        n = b->legacy ?
+            legacy_read(&b->lb, chunk, sizeof(chunk)) :
+            ringbuf_read(&b->rb, chunk, sizeof(chunk));
+        if (n == 0) {
+            sched_yield();
+        }
+        for (i = 0; i < n; i++) {
+            if (chunk[i] != (uint8_t) (got + i)) {
+                b->bad = true;
+            }
+        }
+        got += n;
+    }
+
+    return NULL;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double bench(bool legacy, size_t chunk, size_t total)
+{
+    struct bench b;
+    pthread_t tp, tc;
+    double t0, t1;
+
+    memset(&b, 0, sizeof(b));
+    ringbuf_init(&b.rb, b.buf, sizeof(b.buf), RINGBUF_DROP_NEW);
+    b.total = total;
+    b.chunk = chunk;
+    b.legacy = legacy;
+
+    t0 = now_s();
+    pthread_create(&tc, NULL, consumer, &b);
+    pthread_create(&tp, NULL, producer, &b);
+    pthread_join(tp, NULL);
+    pthread_join(tc, NULL);
+    t1 = now_s();
+
+    /* A full ring counts as drops what the producer then retries */
+    CHECK(!b.bad);
+
+    return total / (t1 - t0) / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t chunks[] = { 1, 16, 64, 256, };
+    size_t total = 64;
+    double ring, legacy;
+
+    if (argc > 1) {
+        total = strtoul(argv[1], NULL, 0);
+    }
+    total *= 1000000;
+
+    check_wrap();
+    check_drop_new();
+    check_drop_old();
+    check_dma_lap();
+
+    printf("%u-byte ring, %zu MB per run, MB/s\n", RING_SIZE,
+           total / 1000000);
+    printf("  chunk    ringbuf     legacy\n");
+    for (unsigned int i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        ring = bench(false, chunks[i], total);
+        legacy = bench(true, chunks[i], total);
+        printf("  %5zu  %9.1f  %9.1f\n", chunks[i], ring, legacy);
+    }
+
+    if (failures > 0) {
+        printf("%u checks failed\n", failures);
+        return 1;
+    }
+
+    printf("all checks passed\n");
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,182 @@
+#!/usr/bin/env python3
+#
+# usbvendor-bench.py
+#
+# Copyright (C) 2025, Charles Chiou
+#
+# Measure sustained throughput of the vendor bulk interface of usbcdc.c
+# (built with USBCDC_VENDOR=1), or of a CDC port for comparison. The
+# firmware is expected to keep the endpoint busy, e.g. by resubmitting
+# a buffer from its usbvendor_submit() completion callback (or by
+# writing to the CDC port in a loop), and to drain what it is sent.
+#
+# With --loopback, the firmware is expected to echo what it reads from
+# the CDC port back to it (usbcdc_read_timeout() then usbcdc_write() in a
+# task will do). A pattern is streamed out from a thread while the echo
+# is read back and checked, which times the round trip through both
+# rings and the flush thresholds.
+#
+#   usbvendor-bench.py                       (IN, needs pyusb + libusb)
+#   usbvendor-bench.py --out -t 5            (OUT)
+#   usbvendor-bench.py --cdc /dev/ttyACM0    (CDC IN, needs pyserial)
+#   usbvendor-bench.py --cdc /dev/ttyACM0 --loopback
+#
+
+import argparse
+import sys
+import threading
+import time
+
+VID = 0xcafe
+PID = 0x4000
+CLASS_VENDOR = 0xff
+
+
+def open_vendor(vid, pid):
+    import usb.core
+    import usb.util
+
+    dev = usb.core.find(idVendor=vid, idProduct=pid)
+    if dev is None:
+        raise SystemExit('no device %04x:%04x' % (vid, pid))
+
+    cfg = dev.get_active_configuration()
+    itf = usb.util.find_descriptor(cfg, bInterfaceClass=CLASS_VENDOR)
+    if itf is None:
+        raise SystemExit('device has no vendor interface')
+
+    try:
+        if dev.is_kernel_driver_active(itf.bInterfaceNumber):
+            dev.detach_kernel_driver(itf.bInterfaceNumber)
+    except (NotImplementedError, usb.core.USBError):
+        pass
+    usb.util.claim_interface(dev, itf)
+
+    ep_in = usb.util.find_descriptor(
+        itf, custom_match=lambda e: usb.util.endpoint_direction(
+            e.bEndpointAddress) == usb.util.ENDPOINT_IN)
+    ep_out = usb.util.find_descriptor(
+        itf, custom_match=lambda e: usb.util.endpoint_direction(
+            e.bEndpointAddress) == usb.util.ENDPOINT_OUT)
+
+    return dev, ep_in, ep_out
+
+
+def run(step, seconds, report):
+    total = 0
+    start = last = time.monotonic()
+    mark = 0
+
+    while True:
+        total += step()
+        now = time.monotonic()
+        if now - last >= report:
+            print('%8.3f MB/s' % ((total - mark) / (now - last) / 1e6),
+                  flush=True)
+            last = now
+            mark = total
+        if now - start >= seconds:
+            break
+
+    elapsed = time.monotonic() - start
+    print('%d bytes in %.2f s: %.3f MB/s sustained' %
+          (total, elapsed, total / elapsed / 1e6))
+
+
+def loopback(port, size):
+    import serial
+
+    pattern = bytes(range(256)) * ((size + 511) // 256)
+    state = {'sent': 0, 'stop': False}
+
+    def writer():
+        while not state['stop']:
+            off = state['sent'] % 256
+            try:
+                state['sent'] += port.write(pattern[off:off + size])
+            except serial.SerialTimeoutException:
+                pass
+
+    thread = threading.Thread(target=writer, daemon=True)
+    thread.start()
+    got = [0]
+
+    def step():
+        data = port.read(min(size, port.in_waiting or 1))
+        off = got[0] % 256
+        if data != pattern[off:off + len(data)]:
+            raise SystemExit('echo corrupted after %d bytes' % got[0])
+        got[0] += len(data)
+        if len(data) == 0 and state['sent'] > got[0]:
+            raise SystemExit('echo stalled after %d of %d bytes' %
+                             (got[0], state['sent']))
+        return len(data)
+
+    def stop():
+        state['stop'] = True
+        thread.join()
+
+    return step, stop
+
+
+def main():
+    ap = argparse.ArgumentParser(
+        description='Measure pico-plat USB bulk throughput')
+    ap.add_argument('-t', '--seconds', type=float, default=10.0)
+    ap.add_argument('-s', '--size', type=int, default=65536,
+                    help='bytes per host transfer')
+    ap.add_argument('-r', '--report', type=float, default=1.0,
+                    help='seconds between interim reports')
+    ap.add_argument('--out', action='store_true',
+                    help='send to the device instead of receiving')
+    ap.add_argument('--cdc', metavar='TTY',
+                    help='measure a CDC port instead of the vendor interface')
+    ap.add_argument('--loopback', action='store_true',
+                    help='send to a CDC port and read back its echo')
+    ap.add_argument('--vid', type=lambda x: int(x, 0), default=VID)
+    ap.add_argument('--pid', type=lambda x: int(x, 0), default=PID)
+    opts = ap.parse_args()
+    stop = None
+
+    if opts.loopback and not opts.cdc:
+        ap.error('--loopback needs --cdc')
+
+    if opts.cdc:
+        import serial
+
+        port = serial.Serial(opts.cdc, timeout=1, write_timeout=1)
+        data = bytes(opts.size)
+        if opts.loopback:
+            step, stop = loopback(port, opts.size)
+        elif opts.out:
+            def step():
+                return port.write(data)
+        else:
+            def step():
+                return len(port.read(opts.size))
+    else:
+        import usb.core
+
+        dev, ep_in, ep_out = open_vendor(opts.vid, opts.pid)
+        data = bytes(opts.size)
+        buf = bytearray(opts.size)
+        if opts.out:
+            def step():
+                return ep_out.write(data, timeout=1000)
+        else:
+            def step():
+                try:
+                    return ep_in.read(buf, timeout=1000)
+                except usb.core.USBTimeoutError:
+                    return 0
+
+    run(step, opts.seconds, opts.report)
+    if stop is not None:
+        stop()
+
+
+if __name__ == '__main__':
+    try:
+        main()
+    except KeyboardInterrupt:
+        sys.exit(1)
@@ -6,34 +6,107 @@
 
 #include <tusb.h>
 #include <bsp/board_api.h>
+#include <string.h>
 #include <pico/stdio.h>
+#include <pico/time.h>
+#include <hardware/irq.h>
 #include <FreeRTOS.h>
+#include <task.h>
 #include <semphr.h>
 #include <pico-plat.h>
+#include <ringbuf.h>
+#include <device/usbd_pvt.h>
 
 #if !defined(LIB_PICO_STDIO_USB)
 
+/*
+ * Optional vendor-class interface after the CDC ones: a bulk endpoint
+ * pair for raw binary streaming without the CDC/tty overhead, see
+ * usbvendor_submit(). It comes with WebUSB and Microsoft OS 2.0
+ * descriptors, so browsers and Windows (WinUSB) can use it driverless.
+ */
+#if !defined(USBCDC_VENDOR)
+#define USBCDC_VENDOR       0
+#endif
+
 #define LIBPICO_CDC_VID     0xcafe
 #define LIBPICO_CDC_PID     0x4000
+#if USBCDC_VENDOR
+#define LIBPICO_CDC_BCD     0x0210  // 2.1: has a BOS descriptor
+#else
 #define LIBPICO_CDC_BCD     0x0200
+#endif
 #define LIBPICO_CDC_REL     0x0100
 
 #define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + \
-                             (CFG_TUD_CDC * TUD_CDC_DESC_LEN))
+                             (CFG_TUD_CDC * TUD_CDC_DESC_LEN) + \
+                             (USBCDC_VENDOR * TUD_VENDOR_DESC_LEN))
+
+/*
+ * Each CDC instance n (0 .. CFG_TUD_CDC - 1) takes interfaces 2n and
+ * 2n + 1 and endpoints 0x81 + 2n (notification), 0x02 + 2n (OUT) and
+ * 0x82 + 2n (IN).
+ */
+#define EPNUM_CDC_NOTIF(n)  (0x81 + 2 * (n))
+#define EPNUM_CDC_OUT(n)    (0x02 + 2 * (n))
+#define EPNUM_CDC_IN(n)     (0x82 + 2 * (n))
 
-#define EPNUM_CDC_0_NOTIF   0x81
-#define EPNUM_CDC_0_OUT     0x02
-#define EPNUM_CDC_0_IN      0x82
+/* The vendor interface takes the next endpoint pair */
+#define EPNUM_VENDOR_OUT    (0x02 + 2 * CFG_TUD_CDC)
+#define EPNUM_VENDOR_IN     (0x82 + 2 * CFG_TUD_CDC)
 
-#if !defined(SERIAL_PBUF_SIZE)
-#define SERIAL_PBUF_SIZE  512
+#if (CFG_TUD_CDC < 1) || (CFG_TUD_CDC > 4)
+#error "usbcdc.c supports 1 to 4 CDC interfaces"
 #endif
 
+#if !defined(SERIAL_BUF_BUF_SIZE)
 #define SERIAL_BUF_BUF_SIZE  512
+#endif
+
+/*
+ * Writes are batched in the TinyUSB IN FIFO: a transfer is started once
+ * this many bytes are pending, or by the servicing context once the oldest
+ * pending byte is this old, or by usbcdc_flush().
+ */
+#if !defined(USBCDC_FLUSH_BYTES)
+#define USBCDC_FLUSH_BYTES  64
+#endif
+
+#if !defined(USBCDC_FLUSH_US)
+#define USBCDC_FLUSH_US     2000
+#endif
+
+#if !defined(USBCDC_TX_BUF_SIZE)
+#define USBCDC_TX_BUF_SIZE  1024
+#endif
+
+#if !defined(USBCDC_TASK_STACK)
+#define USBCDC_TASK_STACK   512
+#endif
+
+/* Buffers that may be queued per direction on the vendor interface */
+#if !defined(USBVENDOR_QUEUE_DEPTH)
+#define USBVENDOR_QUEUE_DEPTH  4
+#endif
 
 enum {
     ITF_NUM_CDC_0 = 0,
     ITF_NUM_CDC_0_DATA,
+#if (CFG_TUD_CDC > 1)
+    ITF_NUM_CDC_1,
+    ITF_NUM_CDC_1_DATA,
+#endif
+#if (CFG_TUD_CDC > 2)
+    ITF_NUM_CDC_2,
+    ITF_NUM_CDC_2_DATA,
+#endif
+#if (CFG_TUD_CDC > 3)
+    ITF_NUM_CDC_3,
+    ITF_NUM_CDC_3_DATA,
+#endif
+#if USBCDC_VENDOR
+    ITF_NUM_VENDOR,
+#endif
     ITF_NUM_TOTAL
 };
 
@@ -42,7 +115,8 @@ enum {
     STRID_MANUFACTURER, // 1: Manufacturer
     STRID_PRODUCT,      // 2: Product
     STRID_SERIAL,       // 3: Serials
-    STRID_CDC_0,        // 4: CDC Interface 0
+    STRID_CDC_0,        // 4: CDC Interface 0, followed by the others
+    STRID_VENDOR = STRID_CDC_0 + CFG_TUD_CDC,
 };
 
 tusb_desc_device_t const desc_device = {
@@ -67,16 +141,44 @@ static const char *string_desc_arr[] = {
     "LibPico",                        // 1: Manufacturer
     "Generic",                        // 2: Product
     NULL,                             // 3: Serials
-    "CDC"                             // 4: CDC Interface 0
-    "LibPicoCDCReset"                 // 6: Reset Interface
+    "CDC",                            // 4: CDC Interface 0
+#if (CFG_TUD_CDC > 1)
+    "CDC1",                           // 5: CDC Interface 1
+#endif
+#if (CFG_TUD_CDC > 2)
+    "CDC2",                           // 6: CDC Interface 2
+#endif
+#if (CFG_TUD_CDC > 3)
+    "CDC3",                           // 7: CDC Interface 3
+#endif
+#if USBCDC_VENDOR
+    "Vendor",                         // Vendor Interface
+#endif
+    "LibPicoCDCReset",                // Reset Interface
 };
 
+#define USBCDC_DESCRIPTOR(n)                                    \
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC_0 + 2 * (n), STRID_CDC_0 + (n),  \
+                       EPNUM_CDC_NOTIF(n), 8,                   \
+                       EPNUM_CDC_OUT(n),                        \
+                       EPNUM_CDC_IN(n), 64)
+
 static const uint8_t desc_configuration[] = {
     TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0x80, 100),
-    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC_0, 4,
-                       EPNUM_CDC_0_NOTIF, 8,
-                       EPNUM_CDC_0_OUT,
-                       EPNUM_CDC_0_IN, 64),
+    USBCDC_DESCRIPTOR(0),
+#if (CFG_TUD_CDC > 1)
+    USBCDC_DESCRIPTOR(1),
+#endif
+#if (CFG_TUD_CDC > 2)
+    USBCDC_DESCRIPTOR(2),
+#endif
+#if (CFG_TUD_CDC > 3)
+    USBCDC_DESCRIPTOR(3),
+#endif
+#if USBCDC_VENDOR
+    TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR, STRID_VENDOR,
+                          EPNUM_VENDOR_OUT, EPNUM_VENDOR_IN, 64),
+#endif
 };
 
 static tusb_desc_device_qualifier_t const desc_device_qualifier = {
@@ -91,22 +193,124 @@ static tusb_desc_device_qualifier_t const desc_device_qualifier = {
     .bReserved = 0x00
 };
 
-struct serial_buf {
-    unsigned int rp;
-    unsigned int wp;
-    char buf[SERIAL_BUF_BUF_SIZE];
+#if USBCDC_VENDOR
+
+/* bRequest codes the host uses to fetch the platform descriptors */
+enum {
+    VENDOR_REQUEST_WEBUSB = 1,
+    VENDOR_REQUEST_MICROSOFT = 2,
+};
+
+#define MS_OS_20_DESC_LEN   0xb2
+#define BOS_TOTAL_LEN       (TUD_BOS_DESC_LEN + TUD_BOS_WEBUSB_DESC_LEN + \
+                             TUD_BOS_MICROSOFT_OS_DESC_LEN)
+
+static const uint8_t desc_bos[] = {
+    TUD_BOS_DESCRIPTOR(BOS_TOTAL_LEN, 2),
+    TUD_BOS_WEBUSB_DESCRIPTOR(VENDOR_REQUEST_WEBUSB, 0),
+    TUD_BOS_MS_OS_20_DESCRIPTOR(MS_OS_20_DESC_LEN, VENDOR_REQUEST_MICROSOFT),
+};
+
+/*
+ * Binds WinUSB to the vendor interface and registers a device interface
+ * GUID for it, so that libusb and WinUSB applications find it on Windows.
+ */
+static const uint8_t desc_ms_os_20[] = {
+    /* Set header: length, type, Windows version, total length */
+    U16_TO_U8S_LE(0x000a), U16_TO_U8S_LE(MS_OS_20_SET_HEADER_DESCRIPTOR),
+    U32_TO_U8S_LE(0x06030000), U16_TO_U8S_LE(MS_OS_20_DESC_LEN),
+
+    /* Configuration subset header */
+    U16_TO_U8S_LE(0x0008), U16_TO_U8S_LE(MS_OS_20_SUBSET_HEADER_CONFIGURATION),
+    0, 0, U16_TO_U8S_LE(MS_OS_20_DESC_LEN - 0x0a),
+
+    /* Function subset header: first interface, subset length */
+    U16_TO_U8S_LE(0x0008), U16_TO_U8S_LE(MS_OS_20_SUBSET_HEADER_FUNCTION),
+    ITF_NUM_VENDOR, 0, U16_TO_U8S_LE(MS_OS_20_DESC_LEN - 0x0a - 0x08),
+
+    /* Compatible ID: WINUSB */
+    U16_TO_U8S_LE(0x0014), U16_TO_U8S_LE(MS_OS_20_FEATURE_COMPATBLE_ID),
+    'W', 'I', 'N', 'U', 'S', 'B', 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+
+    /* Registry property: DeviceInterfaceGUIDs (REG_MULTI_SZ) */
+    U16_TO_U8S_LE(MS_OS_20_DESC_LEN - 0x0a - 0x08 - 0x08 - 0x14),
+    U16_TO_U8S_LE(MS_OS_20_FEATURE_REG_PROPERTY),
+    U16_TO_U8S_LE(0x0007), U16_TO_U8S_LE(0x002a),
+    'D', 0, 'e', 0, 'v', 0, 'i', 0, 'c', 0, 'e', 0, 'I', 0, 'n', 0,
+    't', 0, 'e', 0, 'r', 0, 'f', 0, 'a', 0, 'c', 0, 'e', 0, 'G', 0,
+    'U', 0, 'I', 0, 'D', 0, 's', 0, 0, 0,
+    U16_TO_U8S_LE(0x0050),
+    '{', 0, '8', 0, 'D', 0, '9', 0, 'C', 0, '1', 0, 'E', 0, '2', 0,
+    'A', 0, '-', 0, '5', 0, 'B', 0, '4', 0, '7', 0, '-', 0, '4', 0,
+    'F', 0, '6', 0, '3', 0, '-', 0, 'A', 0, '1', 0, 'C', 0, '8', 0,
+    '-', 0, '3', 0, 'E', 0, '6', 0, 'B', 0, '7', 0, 'D', 0, '0', 0,
+    '2', 0, '4', 0, 'F', 0, '9', 0, '5', 0, '}', 0,
+    0, 0, 0, 0,
+};
+
+_Static_assert(sizeof(desc_ms_os_20) == MS_OS_20_DESC_LEN,
+               "MS OS 2.0 descriptor length");
+
+#endif
+
+/*
+ * Per-interface state. Writers only ever touch 'tx'; moving its contents
+ * into the TinyUSB FIFO is left to whoever services the device stack,
+ * which is either the built-in task (usbcdc_task_start()) or the
+ * application calling usbcdc_task().
+ */
+struct usbcdc_port {
+    struct ringbuf rx;
+    struct ringbuf tx;
+    SemaphoreHandle_t rx_sem;
+    SemaphoreHandle_t rx_mutex;   // blocking readers
+    SemaphoreHandle_t tx_mutex;   // writers of 'tx'
+    TaskHandle_t tx_owner;        // holder of tx_mutex
+    SemaphoreHandle_t tx_sem;     // 'tx' was drained
+    uint32_t flush_bytes;
+    uint32_t flush_us;
+    uint32_t pending;             // bytes queued since the last flush
+    uint64_t since;               // time_us_64() when 'pending' went non-zero
+    volatile bool flush_req;
+    volatile bool rx_stalled;
+    struct usbcdc_stats stats;
+    uint8_t rx_storage[SERIAL_BUF_BUF_SIZE];
+    uint8_t tx_storage[USBCDC_TX_BUF_SIZE];
 };
 
-static struct serial_buf cdc_rx_buf = {
-    .rp = 0,
-    .wp = 0,
-    .buf = { 0, },
+#define USBCDC_PORT_INIT(n) {                                           \
+        .rx = RINGBUF_INIT(cdc_ports[n].rx_storage, SERIAL_BUF_BUF_SIZE, \
+                           RINGBUF_DROP_NEW),                           \
+        .tx = RINGBUF_INIT(cdc_ports[n].tx_storage, USBCDC_TX_BUF_SIZE, \
+                           RINGBUF_DROP_NEW),                           \
+        .flush_bytes = USBCDC_FLUSH_BYTES,                              \
+        .flush_us = USBCDC_FLUSH_US,                                    \
+    }
+
+static struct usbcdc_port cdc_ports[CFG_TUD_CDC] = {
+    USBCDC_PORT_INIT(0),
+#if (CFG_TUD_CDC > 1)
+    USBCDC_PORT_INIT(1),
+#endif
+#if (CFG_TUD_CDC > 2)
+    USBCDC_PORT_INIT(2),
+#endif
+#if (CFG_TUD_CDC > 3)
+    USBCDC_PORT_INIT(3),
+#endif
 };
 
-static char pbuf[SERIAL_PBUF_SIZE];
+SemaphoreHandle_t cdc_sem = NULL;                 // rx_sem of interface 0
+static SemaphoreHandle_t cdc_mutex = NULL;        // usbcdc_task() callers
+static TaskHandle_t cdc_task_handle = NULL;
+static TaskHandle_t cdc_servicer = NULL;          // inside usbcdc_task()
+static volatile bool cdc_kicked = false;
 
-SemaphoreHandle_t cdc_sem = NULL;
-static SemaphoreHandle_t cdc_mutex = NULL;
+static inline struct usbcdc_port *usbcdc_port(unsigned int itf)
+{
+    return itf < CFG_TUD_CDC ? &cdc_ports[itf] : NULL;
+}
 
 const uint8_t *tud_descriptor_device_cb(void)
 {
@@ -162,38 +366,313 @@ const uint16_t *tud_descriptor_string_cb(uint8_t index, uint16_t langid)
     return descstr;
 }
 
+#if USBCDC_VENDOR
+
+const uint8_t *tud_descriptor_bos_cb(void)
+{
+    return desc_bos;
+}
+
+bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage,
+                                tusb_control_request_t const *request)
+{
+    if (stage != CONTROL_STAGE_SETUP) {
+        return true;
+    }
+
+    /* No WebUSB landing page is advertised, so only MS OS 2.0 is asked */
+    if ((request->bmRequestType_bit.type == TUSB_REQ_TYPE_VENDOR) &&
+        (request->bRequest == VENDOR_REQUEST_MICROSOFT) &&
+        (request->wIndex == 7)) {
+        return tud_control_xfer(rhport, request, (void *) desc_ms_os_20,
+                                sizeof(desc_ms_os_20));
+    }
+
+    return false;
+}
+
+#endif
+
+#if (CFG_TUSB_OS == OPT_OS_FREERTOS)
+
+static void usbcdc_kick_cb(void *param)
+{
+    (void) param;
+    cdc_kicked = false;
+}
+
+#else
+
+/*
+ * Runs after TinyUSB's own USBCTRL handler has queued its events, to
+ * wake the service task that will process them.
+ */
+static void PICO_PLAT_HOT(usbcdc_irq_handler)(void)
+{
+    BaseType_t woken = pdFALSE;
+
+    if (cdc_task_handle != NULL) {
+        vTaskNotifyGiveFromISR(cdc_task_handle, &woken);
+        portYIELD_FROM_ISR(woken);
+    }
+}
+
+#endif
+
+/*
+ * Wake the service task, if there is one, to move data in or out. With
+ * the FreeRTOS OSAL it sleeps in TinyUSB's event queue, so an empty
+ * deferred call is queued there; otherwise it sleeps on its notification.
+ */
+static void usbcdc_kick(void)
+{
+    if (cdc_task_handle == NULL) {
+        return;
+    }
+
+#if (CFG_TUSB_OS == OPT_OS_FREERTOS)
+    if (!cdc_kicked) {
+        cdc_kicked = true;
+        usbd_defer_func(usbcdc_kick_cb, NULL, false);
+    }
+#else
+    xTaskNotifyGive(cdc_task_handle);
+#endif
+}
+
+/*
+ * Whether the caller is servicing the stack, i.e. is a TinyUSB callback
+ * run from the service task or from usbcdc_task(). It must then neither
+ * service the stack again nor wait for it to be serviced; whatever it
+ * queues goes out when the pass it is part of reaches usbcdc_service().
+ */
+static bool usbcdc_in_service(void)
+{
+    TaskHandle_t self;
+
+    if (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED) {
+        return false;
+    }
+
+    self = xTaskGetCurrentTaskHandle();
+
+    return (self == cdc_task_handle) || (self == cdc_servicer);
+}
+
+/*
+ * Move what fits from the TinyUSB OUT FIFO straight into the free space
+ * of the receive ring. Whatever does not fit stays in the FIFO, which
+ * keeps the OUT endpoint NAKing until the reader catches up, instead of
+ * data being dropped. Only runs in the context that services the stack,
+ * which makes it the ring's only producer.
+ */
+static size_t usbcdc_rx_fill(unsigned int itf)
+{
+    struct usbcdc_port *port = &cdc_ports[itf];
+    uint8_t *ptr1, *ptr2;
+    size_t len1, len2, n = 0;
+
+    ringbuf_reserve(&port->rx, &ptr1, &len1, &ptr2, &len2);
+    if (len1 > 0) {
+        n = tud_cdc_n_read(itf, ptr1, len1);
+    }
+    if ((n == len1) && (len2 > 0)) {
+        n += tud_cdc_n_read(itf, ptr2, len2);
+    }
+    ringbuf_commit(&port->rx, n);
+    port->stats.rx_bytes += n;
+
+    port->rx_stalled = tud_cdc_n_available(itf) > 0;
+    if (port->rx_stalled) {
+        port->stats.rx_stalls++;
+    }
+
+    return n;
+}
+
 void tud_cdc_rx_cb(uint8_t itf)
 {
-    uint8_t buf[CFG_TUD_CDC_RX_BUFSIZE];
-    size_t count;
-    unsigned int wp;
-    const char *src = (const char *) buf;
-    char *dst = cdc_rx_buf.buf;
+    struct usbcdc_port *port = usbcdc_port(itf);
 
-    if (tud_cdc_n_available(itf) == 0) {
-        goto done;
+    if ((port != NULL) && (usbcdc_rx_fill(itf) > 0) && port->rx_sem) {
+        xSemaphoreGive(port->rx_sem);
     }
+}
 
-    count = tud_cdc_n_read(itf, buf, sizeof(buf));
+/*
+ * Called by readers after freeing ring space: pull in what was left
+ * behind in the FIFO, since the host will not send more (and so
+ * tud_cdc_rx_cb() will not run) until it is taken.
+ */
+static void usbcdc_rx_refill(unsigned int itf)
+{
+    if (!cdc_ports[itf].rx_stalled) {
+        return;
+    }
 
-    wp = cdc_rx_buf.wp;
-    while (count > 0) {
-        dst[wp] = *src;
-        src++;
-        wp = ((wp + 1) % SERIAL_BUF_BUF_SIZE);
-        count--;
+    if (usbcdc_in_service()) {
+        usbcdc_rx_fill(itf);
+    } else if (cdc_task_handle != NULL) {
+        usbcdc_kick();
+    } else {
+        xSemaphoreTake(cdc_mutex, portMAX_DELAY);
+        usbcdc_rx_fill(itf);
+        xSemaphoreGive(cdc_mutex);
     }
-    cdc_rx_buf.wp = wp;
+}
 
-    if (cdc_sem) {
-        xSemaphoreGive(cdc_sem);
+#if USBCDC_VENDOR
+
+/*
+ * Vendor interface, run as an application class driver so that buffers
+ * go to usbd_edpt_xfer() as they are, without the copy through a FIFO
+ * that TinyUSB's own vendor class makes. Each direction has a small
+ * queue of caller-owned buffers: the head one is on the endpoint, and
+ * its completion starts the next. Submitters only ever append to a
+ * queue, and only the servicing context starts and completes transfers.
+ */
+struct usbvendor_xfer {
+    uint8_t *buf;
+    size_t len;
+    usbvendor_cb_t done;
+    void *ctx;
+};
+
+struct usbvendor_queue {
+    struct usbvendor_xfer xfer[USBVENDOR_QUEUE_DEPTH];
+    volatile uint32_t head;       // next slot to fill, by submitters
+    volatile uint32_t tail;       // slot on (or next for) the endpoint
+    bool busy;                    // the tail slot is on the endpoint
+    uint8_t ep;
+};
+
+static struct {
+    struct usbvendor_queue in;
+    struct usbvendor_queue out;
+    uint8_t rhport;
+    volatile bool mounted;
+} usbvendor;
+
+static void usbvendor_start(struct usbvendor_queue *q)
+{
+    struct usbvendor_xfer *x;
+
+    if (!usbvendor.mounted || q->busy || (q->head == q->tail)) {
+        return;
     }
 
-done:
+    x = &q->xfer[q->tail % USBVENDOR_QUEUE_DEPTH];
+    if (usbd_edpt_xfer(usbvendor.rhport, q->ep, x->buf, (uint16_t) x->len)) {
+        q->busy = true;
+    }
+}
+
+static void usbvendor_complete(struct usbvendor_queue *q,
+                               size_t len, int status)
+{
+    struct usbvendor_xfer x;
+
+    taskENTER_CRITICAL();
+    x = q->xfer[q->tail % USBVENDOR_QUEUE_DEPTH];
+    q->tail++;
+    taskEXIT_CRITICAL();
+    q->busy = false;
+
+    if (x.done) {
+        x.done(x.ctx, x.buf, len, status);
+    }
+}
+
+static void usbvendor_drv_init(void)
+{
+    memset(&usbvendor, 0, sizeof(usbvendor));
+}
+
+static void usbvendor_drv_reset(uint8_t rhport)
+{
+    (void) rhport;
+
+    usbvendor.mounted = false;
+
+    while (usbvendor.in.tail != usbvendor.in.head) {
+        usbvendor_complete(&usbvendor.in, 0, -1);
+    }
+    while (usbvendor.out.tail != usbvendor.out.head) {
+        usbvendor_complete(&usbvendor.out, 0, -1);
+    }
+}
+
+static uint16_t usbvendor_drv_open(uint8_t rhport,
+                                   tusb_desc_interface_t const *desc,
+                                   uint16_t max_len)
+{
+    if ((desc->bInterfaceClass != TUSB_CLASS_VENDOR_SPECIFIC) ||
+        (desc->bInterfaceNumber != ITF_NUM_VENDOR) ||
+        (max_len < TUD_VENDOR_DESC_LEN)) {
+        return 0;
+    }
+
+    if (!usbd_open_edpt_pair(rhport, tu_desc_next(desc), 2, TUSB_XFER_BULK,
+                             &usbvendor.out.ep, &usbvendor.in.ep)) {
+        return 0;
+    }
+
+    usbvendor.rhport = rhport;
+    usbvendor.mounted = true;
+
+    /* Buffers queued before the host configured the device */
+    usbvendor_start(&usbvendor.in);
+    usbvendor_start(&usbvendor.out);
+
+    return TUD_VENDOR_DESC_LEN;
+}
+
+static bool usbvendor_drv_control_xfer_cb(uint8_t rhport, uint8_t stage,
+                                          tusb_control_request_t const *req)
+{
+    (void) rhport;
+    (void) stage;
+    (void) req;
+
+    return false;
+}
+
+static bool usbvendor_drv_xfer_cb(uint8_t rhport, uint8_t ep_addr,
+                                  xfer_result_t result, uint32_t xferred)
+{
+    struct usbvendor_queue *q;
+
+    (void) rhport;
 
-    return;
+    q = (ep_addr == usbvendor.in.ep) ? &usbvendor.in : &usbvendor.out;
+    if (!q->busy) {
+        return false;
+    }
+
+    usbvendor_complete(q, xferred, result == XFER_RESULT_SUCCESS ? 0 : -1);
+    usbvendor_start(q);
+
+    return true;
 }
 
+static const usbd_class_driver_t usbvendor_driver = {
+    .init = usbvendor_drv_init,
+    .reset = usbvendor_drv_reset,
+    .open = usbvendor_drv_open,
+    .control_xfer_cb = usbvendor_drv_control_xfer_cb,
+    .xfer_cb = usbvendor_drv_xfer_cb,
+    .sof = NULL,
+};
+
+usbd_class_driver_t const *usbd_app_driver_get_cb(uint8_t *driver_count)
+{
+    *driver_count = 1;
+
+    return &usbvendor_driver;
+}
+
+#endif
+
 void tud_mount_cb(void)
 {
     //serial0_printf("%s\n", __FUNCTION__);
@@ -216,146 +695,735 @@ void tud_resume_cb(void)
 
 void usbcdc_init(void)
 {
-    if (cdc_sem == NULL) {
-        cdc_sem = xSemaphoreCreateBinary();
-    }
+    struct usbcdc_port *port;
+    unsigned int i;
+
     if (cdc_mutex == NULL) {
         cdc_mutex = xSemaphoreCreateMutex();
     }
+
+    for (i = 0; i < CFG_TUD_CDC; i++) {
+        port = &cdc_ports[i];
+        if (port->rx_sem == NULL) {
+            port->rx_sem = xSemaphoreCreateBinary();
+        }
+        if (port->rx_mutex == NULL) {
+            port->rx_mutex = xSemaphoreCreateMutex();
+        }
+        if (port->tx_mutex == NULL) {
+            port->tx_mutex = xSemaphoreCreateMutex();
+        }
+        if (port->tx_sem == NULL) {
+            port->tx_sem = xSemaphoreCreateBinary();
+        }
+    }
+
+    cdc_sem = cdc_ports[0].rx_sem;
 }
 
 void usbcdc_deinit(void)
 {
-    if (cdc_sem) {
-        vSemaphoreDelete(cdc_sem);
-        cdc_sem = NULL;
-    }
+    struct usbcdc_port *port;
+    unsigned int i;
+
+    usbcdc_task_stop();
+
     if (cdc_mutex) {
         vSemaphoreDelete(cdc_mutex);
+        cdc_mutex = NULL;
+    }
+
+    for (i = 0; i < CFG_TUD_CDC; i++) {
+        port = &cdc_ports[i];
+        if (port->rx_sem) {
+            vSemaphoreDelete(port->rx_sem);
+            port->rx_sem = NULL;
+        }
+        if (port->rx_mutex) {
+            vSemaphoreDelete(port->rx_mutex);
+            port->rx_mutex = NULL;
+        }
+        if (port->tx_mutex) {
+            vSemaphoreDelete(port->tx_mutex);
+            port->tx_mutex = NULL;
+        }
+        if (port->tx_sem) {
+            vSemaphoreDelete(port->tx_sem);
+            port->tx_sem = NULL;
+        }
+    }
+
+    cdc_sem = NULL;
+}
+
+/*
+ * Move what the writers queued into the IN FIFO and start a transfer
+ * once a flush threshold is reached; also pull in receive data that was
+ * left behind. Only ever runs in the context that services the stack.
+ */
+static void usbcdc_service(void)
+{
+    struct usbcdc_port *port;
+    const uint8_t *ptr1, *ptr2;
+    size_t len1, len2;
+    uint32_t n;
+    uint64_t now = time_us_64();
+    unsigned int itf;
+
+    for (itf = 0; itf < CFG_TUD_CDC; itf++) {
+        port = &cdc_ports[itf];
+        n = 0;
+
+        if (ringbuf_peek(&port->tx, &ptr1, &len1, &ptr2, &len2) > 0) {
+            n = tud_cdc_n_write(itf, ptr1, len1);
+            if ((n == len1) && (len2 > 0)) {
+                n += tud_cdc_n_write(itf, ptr2, len2);
+            }
+        }
+
+        if (n > 0) {
+            if (port->pending == 0) {
+                port->since = now;
+            }
+            port->pending += n;
+            ringbuf_consume(&port->tx, n);
+            if (port->tx_sem) {
+                xSemaphoreGive(port->tx_sem);
+            }
+        }
+
+        if ((port->pending > 0) &&
+            (port->flush_req ||
+             (port->pending >= port->flush_bytes) ||
+             ((now - port->since) >= port->flush_us))) {
+            tud_cdc_n_write_flush(itf);
+            port->pending = 0;
+        }
+        port->flush_req = false;
+
+        if (port->rx_stalled) {
+            usbcdc_rx_fill(itf);
+        }
     }
+
+#if USBCDC_VENDOR
+    usbvendor_start(&usbvendor.in);
+    usbvendor_start(&usbvendor.out);
+#endif
 }
 
 void usbcdc_task(void)
 {
+    if (usbcdc_in_service()) {
+        return;
+    }
+
     xSemaphoreTake(cdc_mutex, portMAX_DELAY);
+    cdc_servicer = xTaskGetCurrentTaskHandle();
     tud_task();
+    usbcdc_service();
+    cdc_servicer = NULL;
     xSemaphoreGive(cdc_mutex);
 }
 
-int usbcdc_is_connected(void)
+/*
+ * How long the service task may sleep: until the earliest pending tail
+ * is due to be flushed, or until the next event if nothing is pending.
+ */
+static TickType_t usbcdc_service_ticks(void)
+{
+    TickType_t ticks = portMAX_DELAY;
+    TickType_t t;
+    unsigned int itf;
+
+    for (itf = 0; itf < CFG_TUD_CDC; itf++) {
+        struct usbcdc_port *port = &cdc_ports[itf];
+
+        if ((port->pending == 0) && ringbuf_empty(&port->tx)) {
+            continue;
+        }
+
+        t = pdMS_TO_TICKS((port->flush_us + 999) / 1000);
+        if (t == 0) {
+            t = 1;
+        }
+        if (t < ticks) {
+            ticks = t;
+        }
+    }
+
+    return ticks;
+}
+
+static void usbcdc_service_task(void *arg)
 {
-   int itf = ITF_NUM_CDC_0;
+    (void) arg;
+
+    for (;;) {
+#if (CFG_TUSB_OS == OPT_OS_FREERTOS)
+        TickType_t ticks = usbcdc_service_ticks();
 
-   return tud_cdc_n_connected(itf);
+        tud_task_ext(ticks == portMAX_DELAY ?
+                     UINT32_MAX : ticks * portTICK_PERIOD_MS, false);
+#else
+        ulTaskNotifyTake(pdTRUE, usbcdc_service_ticks());
+        tud_task();
+#endif
+        usbcdc_service();
+    }
 }
 
-int usbcdc_write(const void *buf, size_t len)
+#if (PICO_PLAT_IO_CORE >= 0)
+
+/*
+ * Runs on the I/O core: bring the stack up there, or move the USB
+ * interrupt over if the application already did that elsewhere.
+ */
+static void usbcdc_irq_init(void *arg)
+{
+    (void) arg;
+
+    if (!tud_inited()) {
+        tud_init(BOARD_TUD_RHPORT);
+    } else {
+        irq_set_enabled(USBCTRL_IRQ, true);
+    }
+}
+
+#endif
+
+/*
+ * In I/O-core mode the task runs on the I/O core unless 'core' says
+ * otherwise, and the USB interrupt is moved there: leave tud_init() to
+ * this function, or call it from the same core as this function.
+ */
+int usbcdc_task_start(unsigned int priority, int core)
 {
     int ret = 0;
-    int itf = ITF_NUM_CDC_0;
-    const uint8_t *data = (const uint8_t *) buf;
+    BaseType_t rc;
 
-    xSemaphoreTake(cdc_mutex, portMAX_DELAY);
+    if (cdc_task_handle != NULL) {
+        goto done;
+    }
+
+#if (PICO_PLAT_IO_CORE >= 0)
+    if (core < 0) {
+        core = PICO_PLAT_IO_CORE;
+    }
+    if (tud_inited()) {
+        irq_set_enabled(USBCTRL_IRQ, false);
+    }
+    iocore_run(usbcdc_irq_init, NULL);
+#endif
+
+#if (CFG_TUSB_OS != OPT_OS_FREERTOS)
+    irq_add_shared_handler(USBCTRL_IRQ, usbcdc_irq_handler,
+                           PICO_SHARED_IRQ_HANDLER_LOWEST_ORDER_PRIORITY);
+#endif
+
+#if (configNUMBER_OF_CORES > 1) && (configUSE_CORE_AFFINITY == 1)
+    if (core >= 0) {
+        rc = xTaskCreateAffinitySet(usbcdc_service_task, "usbcdc",
+                                    USBCDC_TASK_STACK, NULL, priority,
+                                    1 << core, &cdc_task_handle);
+    } else
+#endif
+    {
+        (void) core;
+        rc = xTaskCreate(usbcdc_service_task, "usbcdc",
+                         USBCDC_TASK_STACK, NULL, priority,
+                         &cdc_task_handle);
+    }
+
+    if (rc != pdPASS) {
+        cdc_task_handle = NULL;
+#if (CFG_TUSB_OS != OPT_OS_FREERTOS)
+        irq_remove_handler(USBCTRL_IRQ, usbcdc_irq_handler);
+#endif
+        ret = -1;
+        goto done;
+    }
+
+done:
+
+    return ret;
+}
+
+void usbcdc_task_stop(void)
+{
+    if (cdc_task_handle != NULL) {
+#if (CFG_TUSB_OS != OPT_OS_FREERTOS)
+        irq_remove_handler(USBCTRL_IRQ, usbcdc_irq_handler);
+#endif
+        vTaskDelete(cdc_task_handle);
+        cdc_task_handle = NULL;
+    }
+}
+
+int usbcdc_n_is_connected(unsigned int itf)
+{
+    int ret = 0;
+
+    if (usbcdc_port(itf) == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    ret = tud_cdc_n_connected(itf);
+
+done:
+
+    return ret;
+}
+
+/*
+ * Take a port's tx_mutex for writing. A TinyUSB callback never waits for
+ * it, since its holder may be waiting for the very service pass the
+ * callback is part of: false if it is taken. Unless the holder is the
+ * calling task itself, which polls usbcdc_task() from usbcdc_put(), in
+ * which case the write goes in between, with nothing else running.
+ * 'locked' tells usbcdc_tx_unlock() whether it was taken here.
+ */
+static bool usbcdc_tx_lock(struct usbcdc_port *port, bool *locked)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+
+    *locked = false;
+
+    if (!usbcdc_in_service()) {
+        xSemaphoreTake(port->tx_mutex, portMAX_DELAY);
+    } else if (port->tx_owner == self) {
+        return true;
+    } else if (xSemaphoreTake(port->tx_mutex, 0) != pdTRUE) {
+        return false;
+    }
+
+    port->tx_owner = self;
+    *locked = true;
+
+    return true;
+}
+
+static void usbcdc_tx_unlock(struct usbcdc_port *port, bool locked)
+{
+    if (locked) {
+        port->tx_owner = NULL;
+        xSemaphoreGive(port->tx_mutex);
+    }
+}
+
+/*
+ * Queue 'len' bytes for transmission, called with port->tx_mutex held.
+ * When the ring is full, wait for the service task to drain it, or
+ * service the stack in place if the application polls usbcdc_task()
+ * (possibly from this very task). Gives up if the host goes away, or
+ * when called from a TinyUSB callback, which cannot wait for the stack.
+ */
+static size_t usbcdc_put(unsigned int itf, const void *buf, size_t len)
+{
+    struct usbcdc_port *port = &cdc_ports[itf];
+    const uint8_t *data = (const uint8_t *) buf;
+    size_t ret = 0;
+    size_t room;
 
     while (len > 0) {
-        uint32_t size;
-        int wl;
+        room = ringbuf_free(&port->tx);
+        if (room > len) {
+            room = len;
+        }
 
-        size = tud_cdc_n_write_available(itf) < len ?
-            tud_cdc_n_write_available(itf) : len;
+        ringbuf_write(&port->tx, data, room);
+        data += room;
+        len -= room;
+        ret += room;
+        port->stats.tx_bytes += room;
 
-        wl = tud_cdc_n_write(itf, data, size);
-        if (wl == 0) {
+        if ((len == 0) || !tud_cdc_n_connected(itf) ||
+            usbcdc_in_service()) {
             break;
         }
 
-        len -= wl;
-        data += wl;
-        ret++;
+        if (cdc_task_handle != NULL) {
+            usbcdc_kick();
+            xSemaphoreTake(port->tx_sem, pdMS_TO_TICKS(10));
+        } else {
+            usbcdc_task();
+            if (ringbuf_free(&port->tx) == 0) {
+                vTaskDelay(1);
+            }
+        }
     }
 
-    if (ret > 0) {
-        tud_cdc_n_write_flush(itf);
+    return ret;
+}
+
+int usbcdc_n_write(unsigned int itf, const void *buf, size_t len)
+{
+    int ret = 0;
+    struct usbcdc_port *port = usbcdc_port(itf);
+    bool locked;
+
+    if (port == NULL) {
+        ret = -1;
+        goto done;
     }
 
-    xSemaphoreGive(cdc_mutex);
+    if (usbcdc_tx_lock(port, &locked)) {
+        ret = usbcdc_put(itf, buf, len);
+        usbcdc_tx_unlock(port, locked);
+    }
+    usbcdc_kick();
+
+done:
+
+    return ret;
+}
+
+int usbcdc_n_flush(unsigned int itf)
+{
+    int ret = 0;
+    struct usbcdc_port *port = usbcdc_port(itf);
+
+    if (port == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    port->flush_req = true;
+
+    if (usbcdc_in_service()) {
+        /* usbcdc_service() is yet to run in this pass */
+    } else if (cdc_task_handle != NULL) {
+        usbcdc_kick();
+    } else {
+        usbcdc_task();
+    }
+
+done:
 
     return ret;
 }
 
-int usbcdc_printf(const char *format, ...)
+int usbcdc_n_set_flush_threshold(unsigned int itf,
+                                 size_t bytes, unsigned int us)
+{
+    int ret = 0;
+    struct usbcdc_port *port = usbcdc_port(itf);
+
+    if (port == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    port->flush_bytes = bytes > 0 ? bytes : 1;
+    port->flush_us = us;
+
+done:
+
+    return ret;
+}
+
+int usbcdc_n_printf(unsigned int itf, const char *format, ...)
 {
     int ret = 0;
     va_list ap;
 
     va_start(ap, format);
-    ret = usbcdc_vprintf(format, ap);
+    ret = usbcdc_n_vprintf(itf, format, ap);
     va_end(ap);
 
     return ret;
 }
 
-int usbcdc_vprintf(const char *format, va_list ap)
+/*
+ * fmt_vprintf() sink: pass the formatted chunk on in spans, with "\r\n"
+ * in place of each bare newline.
+ */
+static void usbcdc_sink(void *ctx, const char *s, size_t len)
+{
+    unsigned int itf = (unsigned int) (uintptr_t) ctx;
+    const char *nl;
+
+    while ((nl = memchr(s, '\n', len)) != NULL) {
+        usbcdc_put(itf, s, nl - s);
+        usbcdc_put(itf, "\r\n", 2);
+        len -= nl - s + 1;
+        s = nl + 1;
+    }
+
+    usbcdc_put(itf, s, len);
+}
+
+int usbcdc_n_vprintf(unsigned int itf, const char *format, va_list ap)
 {
     int ret = 0;
-    int len;
+    struct usbcdc_port *port = usbcdc_port(itf);
+    bool locked;
 
-    len = vsnprintf(pbuf, SERIAL_PBUF_SIZE - 1, format, ap);
+    if (port == NULL) {
+        ret = -1;
+        goto done;
+    }
 
-    for (int i = 0; i < len; i++, ret++) {
-        if (pbuf[i] == '\n') {
-            if (usbcdc_write("\r", 1) != 1) {
-                break;
-            }
+    /* tx_mutex keeps the output of concurrent callers apart */
+    if (usbcdc_tx_lock(port, &locked)) {
+        ret = fmt_vprintf(usbcdc_sink, (void *) (uintptr_t) itf, format,
+                          ap);
+        usbcdc_tx_unlock(port, locked);
+    }
+    usbcdc_kick();
+
+done:
+
+    return ret;
+}
+
+int usbcdc_n_rx_ready(unsigned int itf)
+{
+    int ret = 0;
+    struct usbcdc_port *port = usbcdc_port(itf);
+
+    if (port == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    ret = ringbuf_used(&port->rx);
+
+done:
+
+    return ret;
+}
+
+int usbcdc_n_read(unsigned int itf, void *buf, size_t len)
+{
+    int ret = 0;
+    struct usbcdc_port *port = usbcdc_port(itf);
+
+    if (port == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    ret = ringbuf_read(&port->rx, buf, len);
+    usbcdc_rx_refill(itf);
+
+done:
+
+    return ret;
+}
+
+int usbcdc_n_rx_peek(unsigned int itf,
+                     const uint8_t **ptr1, size_t *len1,
+                     const uint8_t **ptr2, size_t *len2)
+{
+    int ret = 0;
+    struct usbcdc_port *port = usbcdc_port(itf);
+
+    if (port == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    ret = ringbuf_peek(&port->rx, ptr1, len1, ptr2, len2);
+
+done:
+
+    return ret;
+}
+
+int usbcdc_n_rx_consume(unsigned int itf, size_t len)
+{
+    int ret = 0;
+    struct usbcdc_port *port = usbcdc_port(itf);
+
+    if (port == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    ret = ringbuf_consume(&port->rx, len);
+    usbcdc_rx_refill(itf);
+
+done:
+
+    return ret;
+}
+
+/*
+ * Sleep on rx_sem until the receive ring has data or the deadline
+ * passes. Blocking readers are serialized on rx_mutex so that only one
+ * of them ever waits on the binary semaphore.
+ */
+static int usbcdc_rx_wait_locked(struct usbcdc_port *port,
+                                 TimeOut_t *timeout, TickType_t *ticks)
+{
+    int ret;
+
+    for (;;) {
+        ret = ringbuf_used(&port->rx);
+        if (ret > 0) {
+            break;
         }
 
-        if (usbcdc_write(pbuf + i, 1) != 1) {
+        if (xTaskCheckForTimeOut(timeout, ticks) != pdFALSE) {
             break;
         }
+
+        xSemaphoreTake(port->rx_sem, *ticks);
     }
 
     return ret;
 }
 
-int usbcdc_rx_ready(void)
+int usbcdc_n_rx_wait(unsigned int itf, unsigned int timeout_ms)
 {
     int ret = 0;
+    struct usbcdc_port *port = usbcdc_port(itf);
+    TimeOut_t timeout;
+    TickType_t ticks;
 
-    if (cdc_rx_buf.wp < cdc_rx_buf.rp) {
-        ret = SERIAL_BUF_BUF_SIZE - cdc_rx_buf.rp + cdc_rx_buf.wp;
-    } else {
-        ret = cdc_rx_buf.wp - cdc_rx_buf.rp;
+    if (port == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    ticks = (timeout_ms == SERIAL_WAIT_FOREVER) ?
+        portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+    vTaskSetTimeOutState(&timeout);
+
+    if (xSemaphoreTake(port->rx_mutex, ticks) != pdTRUE) {
+        goto done;
     }
 
+    xTaskCheckForTimeOut(&timeout, &ticks);
+    ret = usbcdc_rx_wait_locked(port, &timeout, &ticks);
+    xSemaphoreGive(port->rx_mutex);
+
+done:
+
+    return ret;
+}
+
+int usbcdc_n_read_timeout(unsigned int itf, void *buf, size_t len,
+                          unsigned int timeout_ms)
+{
+    int ret = 0;
+    struct usbcdc_port *port = usbcdc_port(itf);
+    TimeOut_t timeout;
+    TickType_t ticks;
+
+    if (port == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    ticks = (timeout_ms == SERIAL_WAIT_FOREVER) ?
+        portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+    vTaskSetTimeOutState(&timeout);
+
+    if (xSemaphoreTake(port->rx_mutex, ticks) != pdTRUE) {
+        goto done;
+    }
+
+    xTaskCheckForTimeOut(&timeout, &ticks);
+    if (usbcdc_rx_wait_locked(port, &timeout, &ticks) > 0) {
+        ret = ringbuf_read(&port->rx, buf, len);
+        usbcdc_rx_refill(itf);
+    }
+    xSemaphoreGive(port->rx_mutex);
+
+done:
+
+    return ret;
+}
+
+int usbcdc_n_get_stats(unsigned int itf, struct usbcdc_stats *stats)
+{
+    int ret = 0;
+    struct usbcdc_port *port = usbcdc_port(itf);
+
+    if (port == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    if (stats) {
+        *stats = port->stats;
+        stats->rx_dropped = port->rx.dropped;
+    }
+
+done:
+
     return ret;
 }
 
-int usbcdc_read(void *buf, size_t len)
+#if USBCDC_VENDOR
+
+int usbvendor_is_connected(void)
+{
+    return usbvendor.mounted && tud_ready();
+}
+
+/*
+ * Append a buffer to a vendor endpoint queue and get it started: by the
+ * service task if there is one, otherwise right here, unless the stack
+ * is being serviced at this moment (e.g. when called from a completion
+ * callback), in which case the next usbcdc_task() call picks it up.
+ */
+static int usbvendor_queue(struct usbvendor_queue *q, void *buf, size_t len,
+                           usbvendor_cb_t done, void *ctx)
 {
     int ret = 0;
-    uint8_t *dst;
-    const uint8_t *src;
-    unsigned int rp, wp;
-    size_t size;
-
-    dst = (uint8_t *) buf;
-    src = (const uint8_t *) cdc_rx_buf.buf;
-    size = SERIAL_BUF_BUF_SIZE;
-    rp = cdc_rx_buf.rp;
-    wp = cdc_rx_buf.wp;
-    while ((len > 0) && (rp != wp)) {
-        *dst = src[rp];
-        dst++;
-        len--;
-        ret++;
-        rp = (rp + 1) % size;
-    }
-
-    cdc_rx_buf.rp = rp;
+    struct usbvendor_xfer *x;
+
+    if ((buf == NULL) || (len == 0) || (len > UINT16_MAX)) {
+        ret = -1;
+        goto done;
+    }
+
+    taskENTER_CRITICAL();
+    if ((q->head - q->tail) >= USBVENDOR_QUEUE_DEPTH) {
+        ret = -1;
+    } else {
+        x = &q->xfer[q->head % USBVENDOR_QUEUE_DEPTH];
+        x->buf = (uint8_t *) buf;
+        x->len = len;
+        x->done = done;
+        x->ctx = ctx;
+        q->head++;
+    }
+    taskEXIT_CRITICAL();
+
+    if (ret != 0) {
+        goto done;
+    }
+
+    if (cdc_task_handle != NULL) {
+        usbcdc_kick();
+    } else if (xSemaphoreTake(cdc_mutex, 0) == pdTRUE) {
+        usbvendor_start(q);
+        xSemaphoreGive(cdc_mutex);
+    }
+
+done:
 
     return ret;
 }
 
+int usbvendor_submit(const void *buf, size_t len,
+                     usbvendor_cb_t done, void *ctx)
+{
+    return usbvendor_queue(&usbvendor.in, (void *) buf, len, done, ctx);
+}
+
+int usbvendor_receive(void *buf, size_t len, usbvendor_cb_t done, void *ctx)
+{
+    return usbvendor_queue(&usbvendor.out, buf, len, done, ctx);
+}
+
+#endif
+
 #endif  // !LIB_PICO_STDIO_USB
 
 /*